@@ -0,0 +1,386 @@
+/*
+ * File:   Buffer.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(BUFFER_HPP)
+#define BUFFER_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+
+// Third-party Headers
+
+#include <boost/asio/buffer.hpp>
+
+// Other Headers
+
+#include "BufferPool.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+using std::string;
+
+/*- TYPE DEFINITIONS ---------------------------------------------------------*/
+
+typedef boost::asio::const_buffer Fragment; ///< A piece of a message.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A gather list of fragments that together make up one message, such as a
+ * header and a payload held in different places. The fragments are only
+ * borrowed for the duration of a call.
+ */
+class Fragments
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor.
+     * @param aFragments The fragments, in order.
+     * @param aCount The number of fragments.
+     */
+    Fragments(const Fragment *aFragments, const size_t &aCount) :
+        m_fragments(aFragments),
+        m_count(aCount)
+    {
+    }
+
+    // Methods
+
+    /**
+     * Gets the fragments.
+     * @return The fragments.
+     */
+    const Fragment* fragments() const
+    {
+        return m_fragments;
+    }
+
+    /**
+     * Gets the number of fragments.
+     * @return The number of fragments.
+     */
+    size_t count() const
+    {
+        return m_count;
+    }
+
+    /**
+     * Gets the length of the whole message.
+     * @return The total length of the fragments.
+     */
+    size_t length() const
+    {
+        size_t length = 0;
+
+        for (size_t i = 0; i < m_count; ++i)
+        {
+            length += boost::asio::buffer_size(m_fragments[i]);
+        }
+
+        return length;
+    }
+
+    /**
+     * Copies the whole message into a string.
+     * @param aDestination The string, whose contents are replaced.
+     */
+    void copyTo(string &aDestination) const
+    {
+        aDestination.clear();
+        aDestination.reserve(length());
+
+        for (size_t i = 0; i < m_count; ++i)
+        {
+            aDestination.append(boost::asio::buffer_cast<const char*>(m_fragments[i]),
+                                boost::asio::buffer_size(m_fragments[i]));
+        }
+    }
+
+protected:
+
+    // Attributes
+
+    const Fragment *m_fragments; ///< The borrowed fragments.
+    size_t m_count; ///< The number of fragments.
+};
+
+/**
+ * A reference-counted handle to the bytes of a message, which come from the
+ * BufferPool and go back to it when the last handle lets go. Copies of a
+ * handle share the bytes, so a transport can hold on to a message until it
+ * has been sent without copying it. A default-constructed handle has no
+ * bytes until they are first written to.
+ *
+ * A transport that is given a buffer may take the bytes instead of sharing
+ * them: if no other handle shares them they are swapped into the transport,
+ * and the buffer is left holding bytes the transport no longer needs. The
+ * caller may reuse the buffer but must not rely on what it holds, and should
+ * call prepare() before writing to it again.
+ */
+class Buffer
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The default constructor, which creates an empty buffer.
+     */
+    Buffer() :
+        m_block(NULL)
+    {
+    }
+
+    /**
+     * A constructor that copies bytes into a new buffer.
+     * @param aBytes The bytes to copy.
+     */
+    explicit Buffer(const string &aBytes) :
+        m_block(NULL)
+    {
+        prepare(aBytes.length());
+        m_block->bytes.assign(aBytes);
+    }
+
+    /**
+     * The copy constructor, which shares the bytes.
+     * @param aBuffer The buffer to share.
+     */
+    Buffer(const Buffer &aBuffer) :
+        m_block(aBuffer.m_block)
+    {
+        if (m_block != NULL)
+        {
+            m_block->references.fetch_add(1, boost::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * The destructor, which gives the bytes back to the pool if this was the
+     * last handle to them.
+     */
+    ~Buffer()
+    {
+        reset();
+    }
+
+    // Operators
+
+    /**
+     * Shares the bytes of another buffer.
+     * @param aBuffer The buffer to share.
+     * @return This buffer.
+     */
+    Buffer& operator=(const Buffer &aBuffer)
+    {
+        // Read the block first; reset() clears it when assigning to itself
+        BufferBlock *block = aBuffer.m_block;
+
+        if (block != NULL)
+        {
+            block->references.fetch_add(1, boost::memory_order_relaxed);
+        }
+
+        reset();
+        m_block = block;
+
+        return *this;
+    }
+
+    // Methods
+
+    /**
+     * Makes this the only handle to its bytes, taking a fresh buffer from the
+     * pool if others share them or there are none yet.
+     * @param aSizeHint The number of bytes the buffer will likely hold.
+     */
+    void prepare(const size_t &aSizeHint = 0)
+    {
+        if (m_block != NULL && unique())
+        {
+            return;
+        }
+
+        reset();
+
+        m_block = BufferPool::instance().acquire(aSizeHint);
+        m_block->references.store(1, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Lets go of the bytes, giving them back to the pool if this was the last
+     * handle to them.
+     */
+    void reset()
+    {
+        if (m_block == NULL)
+        {
+            return;
+        }
+
+        if (m_block->references.fetch_sub(1, boost::memory_order_acq_rel) == 1)
+        {
+            BufferPool::instance().recycle(m_block);
+        }
+
+        m_block = NULL;
+    }
+
+    /**
+     * Gets the bytes, which may be written to. Call prepare() first if the
+     * bytes may be shared.
+     * @return The bytes.
+     */
+    string& bytes()
+    {
+        if (m_block == NULL)
+        {
+            prepare();
+        }
+
+        return m_block->bytes;
+    }
+
+    /**
+     * Gets the bytes.
+     * @return The bytes.
+     */
+    const string& bytes() const
+    {
+        static const string EMPTY;
+
+        return m_block == NULL ? EMPTY : m_block->bytes;
+    }
+
+    /**
+     * Gets a pointer to the bytes.
+     * @return A pointer to the bytes.
+     */
+    const char* data() const
+    {
+        return bytes().data();
+    }
+
+    /**
+     * Gets the number of bytes.
+     * @return The number of bytes.
+     */
+    size_t length() const
+    {
+        return bytes().length();
+    }
+
+    /**
+     * Is this the only handle to the bytes?
+     * @return True if no other buffer shares the bytes.
+     */
+    bool unique() const
+    {
+        return m_block == NULL || m_block->references.load(boost::memory_order_acquire) == 1;
+    }
+
+    /**
+     * Moves the bytes into a string, swapping them if no other handle shares
+     * them and copying them if one does.
+     * @param aDestination The string to move the bytes into.
+     */
+    void release(string &aDestination)
+    {
+        if (unique())
+        {
+            aDestination.swap(bytes());
+        }
+        else
+        {
+            aDestination.assign(bytes());
+        }
+    }
+
+    /**
+     * Puts a message into a string by copying it.
+     * @param aSource The message.
+     * @param aDestination The string to put it into.
+     */
+    static void transfer(const string &aSource, string &aDestination)
+    {
+        aDestination.assign(aSource);
+    }
+
+    /**
+     * Puts a message into a string, taking its bytes if it can.
+     * @param aSource The message.
+     * @param aDestination The string to put it into.
+     */
+    static void transfer(Buffer &aSource, string &aDestination)
+    {
+        aSource.release(aDestination);
+    }
+
+    /**
+     * Puts a message into a string by copying its fragments.
+     * @param aSource The message.
+     * @param aDestination The string to put it into.
+     */
+    static void transfer(const Fragments &aSource, string &aDestination)
+    {
+        aSource.copyTo(aDestination);
+    }
+
+    /**
+     * Puts a message into a buffer by copying it.
+     * @param aSource The message.
+     * @param aDestination The buffer to put it into.
+     */
+    static void transfer(const string &aSource, Buffer &aDestination)
+    {
+        aDestination.prepare(aSource.length());
+        aDestination.bytes().assign(aSource);
+    }
+
+    /**
+     * Puts a message into a buffer by sharing its bytes.
+     * @param aSource The message.
+     * @param aDestination The buffer to put it into.
+     */
+    static void transfer(Buffer &aSource, Buffer &aDestination)
+    {
+        aDestination = aSource;
+    }
+
+    /**
+     * Puts a message into a buffer by copying its fragments.
+     * @param aSource The message.
+     * @param aDestination The buffer to put it into.
+     */
+    static void transfer(const Fragments &aSource, Buffer &aDestination)
+    {
+        aDestination.prepare(aSource.length());
+        aSource.copyTo(aDestination.bytes());
+    }
+
+protected:
+
+    // Attributes
+
+    BufferBlock *m_block; ///< The shared bytes, or NULL.
+};
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(BUFFER_HPP)
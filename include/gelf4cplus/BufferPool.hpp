@@ -0,0 +1,323 @@
+/*
+ * File:   BufferPool.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(BUFFERPOOL_HPP)
+#define BUFFERPOOL_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+// Third-party Headers
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+// Other Headers
+
+#include "MessageIdGenerator.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+using std::string;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t BUFFER_SIZE_CLASS_COUNT = 6; ///< Number of size classes.
+const size_t SMALLEST_BUFFER_SIZE = 512; ///< Capacity of the smallest class.
+const size_t MAX_POOLED_BYTES_PER_CLASS = 4 * 1024 * 1024; ///< Per class and shard.
+const size_t MIN_POOLED_BUFFERS_PER_CLASS = 8; ///< Even for the largest class.
+const size_t BUFFER_POOL_SHARDS = 16; ///< Independently locked parts of the pool.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * Reference-counted bytes that come from and go back to a BufferPool.
+ */
+struct BufferBlock : private boost::noncopyable
+{
+    boost::atomic<long> references; ///< Handles pointing at this block.
+    string bytes; ///< The bytes, whose capacity is what the pool recycles.
+
+    BufferBlock() :
+        references(0)
+    {
+    }
+};
+
+/**
+ * A pool of byte buffers in size classes of 512 bytes to 128 KB, each class
+ * four times the one before. A buffer is taken from the smallest class that
+ * holds the size asked for and has one, or else from a larger class, and goes
+ * back to the class its capacity has grown to, so once the pool has warmed up
+ * logging does not touch the general heap.
+ *
+ * The pool is split into shards with a lock each. A thread takes buffers from
+ * its own shard first and then from the others, and gives them back to its
+ * own, so threads rarely wait for each other and buffers freed on the I/O
+ * thread are still found by the threads that build messages. Each class of a
+ * shard keeps at most MAX_POOLED_BYTES_PER_CLASS; buffers beyond that, and
+ * buffers that grew past the largest class, are freed.
+ */
+class BufferPool : private boost::noncopyable
+{
+public:
+
+    // Methods
+
+    /**
+     * Gets the process-wide pool. It is never destroyed, so buffers may be
+     * returned to it while static objects are being destroyed.
+     * @return The pool.
+     */
+    static BufferPool& instance()
+    {
+        static BufferPool *pool = new BufferPool();
+
+        return *pool;
+    }
+
+    /**
+     * Takes an empty buffer with room for at least the given size, from the
+     * smallest size class that has one. A buffer from a larger class is
+     * better than a new one: messages often outgrow the size hint.
+     * @param aSizeHint The number of bytes the buffer will likely hold.
+     * @return A block with no references.
+     */
+    BufferBlock* acquire(const size_t &aSizeHint = 0)
+    {
+        size_t sizeClass = classFor(aSizeHint);
+
+        if (sizeClass < BUFFER_SIZE_CLASS_COUNT)
+        {
+            size_t home = shardIndex();
+
+            for (size_t i = 0; i < BUFFER_POOL_SHARDS; ++i)
+            {
+                if (BufferBlock *block = m_shards[(home + i) % BUFFER_POOL_SHARDS].take(sizeClass))
+                {
+                    // A block smaller than its class is grown here, once;
+                    // reserving less than the capacity may shrink it
+                    block->bytes.clear();
+
+                    if (block->bytes.capacity() < classSize(sizeClass))
+                    {
+                        block->bytes.reserve(classSize(sizeClass));
+                    }
+
+                    return block;
+                }
+            }
+        }
+
+        m_allocations.fetch_add(1, boost::memory_order_relaxed);
+
+        BufferBlock *block = new BufferBlock();
+        block->bytes.reserve(sizeClass < BUFFER_SIZE_CLASS_COUNT ? classSize(sizeClass) : aSizeHint);
+
+        return block;
+    }
+
+    /**
+     * Gives a buffer back to the pool, or frees it if its class is full.
+     * @param aBlock A block with no references.
+     */
+    void recycle(BufferBlock *aBlock)
+    {
+        size_t sizeClass = classHolding(aBlock->bytes.capacity());
+
+        if (sizeClass < BUFFER_SIZE_CLASS_COUNT &&
+            m_shards[shardIndex()].put(sizeClass, aBlock))
+        {
+            return;
+        }
+
+        delete aBlock;
+    }
+
+    /**
+     * Gets the number of buffers allocated from the heap because the pool
+     * had none of the right size.
+     * @return The number of allocations.
+     */
+    uint64_t allocations() const
+    {
+        return m_allocations.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the capacity of a size class.
+     * @param aSizeClass The size class.
+     * @return The capacity in bytes.
+     */
+    static size_t classSize(const size_t &aSizeClass)
+    {
+        return SMALLEST_BUFFER_SIZE << (2 * aSizeClass);
+    }
+
+protected:
+
+    // Type Definitions
+
+    /**
+     * A part of the pool with its own lock.
+     */
+    class Shard : private boost::noncopyable
+    {
+    public:
+
+        /**
+         * Takes a buffer of the smallest size class, no smaller than the one
+         * given, that has one.
+         * @param aSizeClass The smallest size class to take from.
+         * @return A block, or NULL if there is none.
+         */
+        BufferBlock* take(const size_t &aSizeClass)
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+
+            for (size_t sizeClass = aSizeClass; sizeClass < BUFFER_SIZE_CLASS_COUNT; ++sizeClass)
+            {
+                std::vector<BufferBlock*> &blocks = m_blocks[sizeClass];
+
+                if (!blocks.empty())
+                {
+                    BufferBlock *block = blocks.back();
+                    blocks.pop_back();
+
+                    return block;
+                }
+            }
+
+            return NULL;
+        }
+
+        /**
+         * Keeps a buffer of a size class.
+         * @param aSizeClass The size class.
+         * @param aBlock The block.
+         * @return False if the class is full and the block was not kept.
+         */
+        bool put(const size_t &aSizeClass, BufferBlock *aBlock)
+        {
+            size_t limit = std::max(MIN_POOLED_BUFFERS_PER_CLASS,
+                                    MAX_POOLED_BYTES_PER_CLASS / classSize(aSizeClass));
+
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+
+            std::vector<BufferBlock*> &blocks = m_blocks[aSizeClass];
+
+            if (blocks.size() >= limit)
+            {
+                return false;
+            }
+
+            blocks.push_back(aBlock);
+
+            return true;
+        }
+
+    protected:
+
+        boost::mutex m_mutex; ///< Guards m_blocks.
+        std::vector<BufferBlock*> m_blocks[BUFFER_SIZE_CLASS_COUNT]; ///< Idle blocks by class.
+    };
+
+    // Members
+
+    Shard m_shards[BUFFER_POOL_SHARDS]; ///< The parts of the pool.
+    boost::atomic<uint64_t> m_allocations; ///< Blocks taken from the heap.
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor. Use instance() to get the pool.
+     */
+    BufferPool() :
+        m_allocations(0)
+    {
+    }
+
+    // Methods
+
+    /**
+     * Gets the smallest size class with room for a size.
+     * @param aSize The size.
+     * @return The size class, or BUFFER_SIZE_CLASS_COUNT if none is big enough.
+     */
+    static size_t classFor(const size_t &aSize)
+    {
+        size_t sizeClass = 0;
+
+        while (sizeClass < BUFFER_SIZE_CLASS_COUNT && classSize(sizeClass) < aSize)
+        {
+            ++sizeClass;
+        }
+
+        return sizeClass;
+    }
+
+    /**
+     * Gets the largest size class a capacity fills. Buffers far larger than
+     * the largest class are not kept.
+     * @param aCapacity The capacity.
+     * @return The size class, or BUFFER_SIZE_CLASS_COUNT to free the buffer.
+     */
+    static size_t classHolding(const size_t &aCapacity)
+    {
+        if (aCapacity > 2 * classSize(BUFFER_SIZE_CLASS_COUNT - 1))
+        {
+            return BUFFER_SIZE_CLASS_COUNT;
+        }
+
+        size_t sizeClass = 0;
+
+        while (sizeClass + 1 < BUFFER_SIZE_CLASS_COUNT && classSize(sizeClass + 1) <= aCapacity)
+        {
+            ++sizeClass;
+        }
+
+        // Blocks too small for any class are grown when next taken
+        return sizeClass;
+    }
+
+    /**
+     * Gets the shard of the calling thread.
+     * @return The shard index.
+     */
+    static size_t shardIndex()
+    {
+        // Zero initialized, so the first call sees 0 and draws an index
+        static GELF4CPLUS_THREAD_LOCAL size_t index;
+
+        if (index == 0)
+        {
+            static boost::atomic<size_t> nextIndex(0);
+
+            index = nextIndex.fetch_add(1, boost::memory_order_relaxed) % BUFFER_POOL_SHARDS + 1;
+        }
+
+        return index - 1;
+    }
+};
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(BUFFERPOOL_HPP)
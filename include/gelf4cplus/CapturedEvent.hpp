@@ -0,0 +1,197 @@
+/*
+ * File:   CapturedEvent.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(CAPTUREDEVENT_HPP)
+#define CAPTUREDEVENT_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Header Files
+
+#include <algorithm>
+
+// Third-party Header Files
+
+#include <log4cplus/spi/loggingevent.h>
+#include <log4cplus/helpers/timehelper.h>
+#include <log4cplus/loglevel.h>
+#include <log4cplus/tstring.h>
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace appender
+{
+
+using log4cplus::tstring;
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A copy of the fields of a logging event that the GELF message is built from.
+ * The getters mirror those of log4cplus::spi::InternalLoggingEvent, so either
+ * can be handed to the same message building code. Instances are meant to be
+ * reused: capture() assigns into the existing strings, so a slot that has
+ * already held a message of similar size does not allocate again.
+ */
+class CapturedEvent
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The default constructor.
+     */
+    CapturedEvent() :
+        m_logLevel(log4cplus::NOT_SET_LOG_LEVEL),
+        m_line(0),
+        m_type(0)
+    {
+    }
+
+    // Methods
+
+    /**
+     * Copies the fields of a logging event into this object. This has to run
+     * on the logging thread, since the NDC and thread name of the event are
+     * looked up lazily from the calling thread.
+     * @param anEvent The logging event to capture.
+     */
+    void capture(const log4cplus::spi::InternalLoggingEvent &anEvent)
+    {
+        m_message.assign(anEvent.getMessage());
+        m_loggerName.assign(anEvent.getLoggerName());
+        m_ndc.assign(anEvent.getNDC());
+        m_thread.assign(anEvent.getThread());
+        m_file.assign(anEvent.getFile());
+        m_timestamp = anEvent.getTimestamp();
+        m_logLevel = anEvent.getLogLevel();
+        m_line = anEvent.getLine();
+        m_type = anEvent.getType();
+    }
+
+    /**
+     * Return the message.
+     * @return The message.
+     */
+    const tstring& getMessage() const
+    {
+        return m_message;
+    }
+
+    /**
+     * Return the logger name.
+     * @return The logger name.
+     */
+    const tstring& getLoggerName() const
+    {
+        return m_loggerName;
+    }
+
+    /**
+     * Return the nested diagnostic context.
+     * @return The nested diagnostic context.
+     */
+    const tstring& getNDC() const
+    {
+        return m_ndc;
+    }
+
+    /**
+     * Return the name of the thread that logged the event.
+     * @return The thread name.
+     */
+    const tstring& getThread() const
+    {
+        return m_thread;
+    }
+
+    /**
+     * Return the filename.
+     * @return The filename.
+     */
+    const tstring& getFile() const
+    {
+        return m_file;
+    }
+
+    /**
+     * Return the time the event was logged.
+     * @return The event timestamp.
+     */
+    const log4cplus::helpers::Time& getTimestamp() const
+    {
+        return m_timestamp;
+    }
+
+    /**
+     * Return the log level.
+     * @return The log level.
+     */
+    log4cplus::LogLevel getLogLevel() const
+    {
+        return m_logLevel;
+    }
+
+    /**
+     * Return the line number.
+     * @return The line number.
+     */
+    int getLine() const
+    {
+        return m_line;
+    }
+
+    /**
+     * Return the event type.
+     * @return The event type.
+     */
+    unsigned int getType() const
+    {
+        return m_type;
+    }
+
+    /**
+     * Exchanges the fields of two captured events. Used to move an event out
+     * of a queue slot without copying it; the slot gets the other event's
+     * strings, whose capacity the next capture() reuses.
+     * @param anEvent The event to exchange with.
+     */
+    void swap(CapturedEvent &anEvent)
+    {
+        m_message.swap(anEvent.m_message);
+        m_loggerName.swap(anEvent.m_loggerName);
+        m_ndc.swap(anEvent.m_ndc);
+        m_thread.swap(anEvent.m_thread);
+        m_file.swap(anEvent.m_file);
+        std::swap(m_timestamp, anEvent.m_timestamp);
+        std::swap(m_logLevel, anEvent.m_logLevel);
+        std::swap(m_line, anEvent.m_line);
+        std::swap(m_type, anEvent.m_type);
+    }
+
+protected:
+
+    // Attributes
+
+    tstring m_message; ///< The message.
+    tstring m_loggerName; ///< The logger name.
+    tstring m_ndc; ///< The nested diagnostic context.
+    tstring m_thread; ///< The thread name.
+    tstring m_file; ///< The filename.
+    log4cplus::helpers::Time m_timestamp; ///< The event timestamp.
+    log4cplus::LogLevel m_logLevel; ///< The log level.
+    int m_line; ///< The line number.
+    unsigned int m_type; ///< The event type.
+};
+
+} // namespace appender
+} // namespace gelf4cplus
+
+#endif // #if !defined(CAPTUREDEVENT_HPP)
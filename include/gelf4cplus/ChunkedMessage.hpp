@@ -0,0 +1,251 @@
+/*
+ * File:   ChunkedMessage.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(CHUNKEDMESSAGE_HPP)
+#define CHUNKEDMESSAGE_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+// Third-party Headers
+
+#include <boost/array.hpp>
+#include <boost/asio/buffer.hpp>
+
+// Other Headers
+
+#include "Buffer.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+using std::string;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t CHUNK_HEADER_SIZE = 12; ///< Size of a chunked GELF header.
+const size_t MESSAGE_ID_SIZE = 8; ///< Size of a chunked GELF message ID.
+const size_t MAX_CHUNK_COUNT = 128; ///< Most chunks a receiver accepts per message.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A GELF message ready to go out as one or more UDP datagrams. The payload is
+ * held once, and each datagram is a gather list of its 12-byte chunk header
+ * and a slice of the payload, so splitting a message copies nothing. A
+ * payload given as a Buffer is shared rather than copied. Objects are meant
+ * to be reused: assign() keeps the capacity of the header table, and clear()
+ * gives the payload back to the pool once the datagrams have been sent.
+ */
+class ChunkedMessage
+{
+public:
+
+    // Type Definitions
+
+    typedef boost::array<boost::asio::const_buffer, 2> Datagram; ///< Gather list
+
+    // Constructors & Destructor
+
+    /**
+     * The default constructor.
+     */
+    ChunkedMessage() :
+        m_maxChunkSize(0),
+        m_chunkCount(0)
+    {
+    }
+
+    // Methods
+
+    /**
+     * Puts a message in the payload and builds the chunk headers for it.
+     * @param aMessage The message to send: a string or fragments, which are
+     * copied into a pooled buffer, or a Buffer, whose bytes are shared.
+     * @param aMaxChunkSize The maximum chunk payload size, 0 to not chunk.
+     * @param aMessageId The 8-byte ID of this message, used when chunked.
+     */
+    template <typename Message>
+    void assign(Message &aMessage,
+                const size_t &aMaxChunkSize,
+                const string &aMessageId)
+    {
+        Buffer::transfer(aMessage, m_payload);
+        split(aMaxChunkSize, aMessageId);
+    }
+
+    /**
+     * Builds the chunk headers for the message already in the payload.
+     * @param aMaxChunkSize The maximum chunk payload size, 0 to not chunk.
+     * @param aMessageId The 8-byte ID of this message, used when chunked.
+     */
+    void split(const size_t &aMaxChunkSize, const string &aMessageId)
+    {
+        size_t length = m_payload.length();
+
+        if (aMaxChunkSize == 0 || length <= aMaxChunkSize)
+        {
+            m_maxChunkSize = length;
+            m_chunkCount = 1;
+            m_headers.clear();
+
+            return;
+        }
+
+        // Round up, so a message that fills its last chunk exactly does not
+        // get an empty one after it
+        m_maxChunkSize = aMaxChunkSize;
+        m_chunkCount = (length + aMaxChunkSize - 1) / aMaxChunkSize;
+        m_headers.resize(m_chunkCount * CHUNK_HEADER_SIZE);
+
+        for (size_t i = 0; i < m_chunkCount; ++i)
+        {
+            createChunkHeader(aMessageId, i, m_chunkCount, &m_headers[i * CHUNK_HEADER_SIZE]);
+        }
+    }
+
+    /**
+     * Gets the payload, which may be written to before calling split().
+     * @return The payload.
+     */
+    string& payload()
+    {
+        // If the last payload is still shared, start one about as large
+        m_payload.prepare(m_payload.length());
+
+        return m_payload.bytes();
+    }
+
+    /**
+     * Gets the payload.
+     * @return The payload.
+     */
+    const string& payload() const
+    {
+        return m_payload.bytes();
+    }
+
+    /**
+     * Lets go of the payload, so that it can go back to the pool.
+     */
+    void clear()
+    {
+        m_payload.reset();
+        m_chunkCount = 0;
+        m_headers.clear();
+    }
+
+    /**
+     * Is the message sent in more than one datagram?
+     * @return True if the datagrams carry chunk headers.
+     */
+    bool chunked() const
+    {
+        return !m_headers.empty();
+    }
+
+    /**
+     * Gets the number of datagrams.
+     * @return The number of datagrams.
+     */
+    size_t chunkCount() const
+    {
+        return m_chunkCount;
+    }
+
+    /**
+     * Gets the chunk header of a datagram.
+     * @param anIndex The datagram index.
+     * @return The chunk header or an empty buffer if not chunked.
+     */
+    boost::asio::const_buffer header(const size_t &anIndex) const
+    {
+        if (!chunked())
+        {
+            return boost::asio::const_buffer();
+        }
+
+        return boost::asio::const_buffer(&m_headers[anIndex * CHUNK_HEADER_SIZE],
+                                         CHUNK_HEADER_SIZE);
+    }
+
+    /**
+     * Gets the slice of the payload carried by a datagram.
+     * @param anIndex The datagram index.
+     * @return The payload slice.
+     */
+    boost::asio::const_buffer slice(const size_t &anIndex) const
+    {
+        size_t offset = anIndex * m_maxChunkSize;
+        size_t length = std::min(m_maxChunkSize, m_payload.length() - offset);
+
+        return boost::asio::const_buffer(m_payload.data() + offset, length);
+    }
+
+    /**
+     * Gets the gather list of a datagram.
+     * @param anIndex The datagram index.
+     * @return The header and payload slice of the datagram.
+     */
+    Datagram datagram(const size_t &anIndex) const
+    {
+        Datagram result = {{header(anIndex), slice(anIndex)}};
+
+        return result;
+    }
+
+    /**
+     * Writes a chunk header.
+     * @param aMessageId The 8-byte ID of the message.
+     * @param anIndex This chunk index.
+     * @param aChunkCount The total chunk count.
+     * @param aResult Where to write the CHUNK_HEADER_SIZE bytes.
+     */
+    static void createChunkHeader(const string &aMessageId,
+                                  const size_t &anIndex,
+                                  const size_t &aChunkCount,
+                                  char *aResult)
+    {
+        // Chunked GELF ID: 0x1e 0x0f (identifying this message as a chunked GELF message)
+        aResult[0] = 0x1e;
+        aResult[1] = 0x0f;
+
+        // Message ID: 8 bytes
+        std::memcpy(aResult + 2, aMessageId.data(), MESSAGE_ID_SIZE);
+
+        // Sequence Number: 1 byte (The sequence number of this chunk)
+        aResult[10] = (char) anIndex;
+
+        // Total Number: 1 byte (How many chunks does this message consist of in total)
+        aResult[11] = (char) aChunkCount;
+    }
+
+protected:
+
+    // Attributes
+
+    Buffer m_payload; ///< The whole message.
+    std::vector<char> m_headers; ///< CHUNK_HEADER_SIZE bytes per chunk.
+    size_t m_maxChunkSize; ///< Payload bytes per chunk.
+    size_t m_chunkCount; ///< Number of datagrams.
+};
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(CHUNKEDMESSAGE_HPP)
@@ -0,0 +1,226 @@
+/*
+ * File:   CompressionLevelController.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(COMPRESSIONLEVELCONTROLLER_HPP)
+#define COMPRESSIONLEVELCONTROLLER_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Header Files
+
+#include <algorithm>
+#include <ctime>
+#include <stdint.h>
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace appender
+{
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const int DEFAULT_ADAPTIVE_MIN_LEVEL = 0; ///< Lowest level: no compression.
+const int DEFAULT_ADAPTIVE_MAX_LEVEL = 6; ///< Highest level to climb to.
+const int DEFAULT_CPU_BUDGET_PERCENT = 50; ///< Share of a core per compressing thread.
+const long DEFAULT_ADAPT_INTERVAL_MS = 1000; ///< Time between adjustments.
+const double BACKLOG_HIGH_WATER = 0.5; ///< Queue fill that means falling behind.
+const double BACKLOG_LOW_WATER = 0.1; ///< Queue fill that means keeping up.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * Chooses the compression level of the sender thread from how far behind it
+ * is and how much CPU it uses.
+ *
+ * Once per interval the controller looks at the fullest the queue got and at
+ * the CPU time used by the threads that compress: the sender thread itself,
+ * or with a worker pool the workers, whose average share of a core is held to
+ * the budget. The sender's own CPU time says nothing about compression once
+ * the workers do it. If the queue passed the high water mark or the CPU time
+ * passed the budget, the level drops straight to 1, and from 1 to the minimum
+ * (no compression by default). If the queue stayed below the low water mark
+ * and the CPU time below half the budget, the level climbs one step, up to
+ * the maximum, to save bandwidth. Otherwise it stays put.
+ *
+ * Only the sender thread may call update().
+ */
+class CompressionLevelController
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor.
+     * @param aMinLevel The lowest level, 0 meaning no compression.
+     * @param aMaxLevel The highest level.
+     * @param aCpuBudgetPercent The share of one core each compressing thread may use.
+     * @param anIntervalMs The time between adjustments.
+     */
+    CompressionLevelController(const int &aMinLevel = DEFAULT_ADAPTIVE_MIN_LEVEL,
+                               const int &aMaxLevel = DEFAULT_ADAPTIVE_MAX_LEVEL,
+                               const int &aCpuBudgetPercent = DEFAULT_CPU_BUDGET_PERCENT,
+                               const long &anIntervalMs = DEFAULT_ADAPT_INTERVAL_MS) :
+        m_minLevel(std::max(0, std::min(aMinLevel, 9))),
+        m_maxLevel(std::max(m_minLevel, std::min(aMaxLevel, 9))),
+        m_cpuBudget(aCpuBudgetPercent / 100.0),
+        m_intervalUs((int64_t) anIntervalMs * 1000),
+        m_intervalStartUs(-1),
+        m_cpuStartUs(0),
+        m_maxBacklog(0.0)
+    {
+    }
+
+    // Methods
+
+    /**
+     * Records the queue fill and, once per interval, picks a new level from
+     * it and the CPU time of the calling thread.
+     * @param aLevel The current level.
+     * @param aBacklog How full the queue is, from 0 to 1.
+     * @return The level to use from now on.
+     */
+    int update(const int &aLevel, const double &aBacklog)
+    {
+        return update(aLevel, aBacklog, threadCpuMicroseconds(), 1);
+    }
+
+    /**
+     * Records the queue fill and, once per interval, picks a new level from
+     * it and the CPU time of the threads that compress.
+     * @param aLevel The current level.
+     * @param aBacklog How full the queue is, from 0 to 1.
+     * @param aCpuMicroseconds The CPU time used so far by those threads.
+     * @param aThreads The number of those threads.
+     * @return The level to use from now on.
+     */
+    int update(const int &aLevel,
+               const double &aBacklog,
+               const int64_t &aCpuMicroseconds,
+               const size_t &aThreads)
+    {
+        m_maxBacklog = std::max(m_maxBacklog, aBacklog);
+
+        int64_t now = monotonicMicroseconds();
+        int64_t cpu = aCpuMicroseconds;
+
+        if (m_intervalStartUs < 0)
+        {
+            restart(now, cpu);
+
+            return aLevel;
+        }
+
+        int64_t elapsed = now - m_intervalStartUs;
+
+        if (elapsed < m_intervalUs)
+        {
+            return aLevel;
+        }
+
+        double cpuShare = (double) (cpu - m_cpuStartUs) /
+                ((double) elapsed * (double) std::max<size_t>(aThreads, 1));
+        int level = aLevel;
+
+        if (m_maxBacklog >= BACKLOG_HIGH_WATER || cpuShare > m_cpuBudget)
+        {
+            level = aLevel > 1 ? 1 : m_minLevel;
+        }
+        else if (m_maxBacklog < BACKLOG_LOW_WATER && cpuShare < m_cpuBudget / 2)
+        {
+            level = aLevel + 1;
+        }
+
+        restart(now, cpu);
+
+        return std::max(m_minLevel, std::min(level, m_maxLevel));
+    }
+
+    /**
+     * Gets the lowest level.
+     * @return The lowest level.
+     */
+    int minLevel() const
+    {
+        return m_minLevel;
+    }
+
+    /**
+     * Gets the highest level.
+     * @return The highest level.
+     */
+    int maxLevel() const
+    {
+        return m_maxLevel;
+    }
+
+    /**
+     * Gets the CPU time used by the calling thread. Where there is no thread
+     * CPU clock this is always 0, and only the backlog drives the level.
+     * @return Microseconds of CPU time.
+     */
+    static int64_t threadCpuMicroseconds()
+    {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+        struct timespec cpu;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+
+        return (int64_t) cpu.tv_sec * 1000000 + cpu.tv_nsec / 1000;
+#else
+        return 0;
+#endif
+    }
+
+protected:
+
+    // Attributes
+
+    int m_minLevel; ///< The lowest level.
+    int m_maxLevel; ///< The highest level.
+    double m_cpuBudget; ///< The share of one core per compressing thread.
+    int64_t m_intervalUs; ///< The time between adjustments.
+    int64_t m_intervalStartUs; ///< When the interval started, or -1.
+    int64_t m_cpuStartUs; ///< Thread CPU time when the interval started.
+    double m_maxBacklog; ///< The fullest the queue got this interval.
+
+    // Methods
+
+    /**
+     * Starts a new interval.
+     * @param aNow The current time.
+     * @param aCpu The current thread CPU time.
+     */
+    void restart(const int64_t &aNow, const int64_t &aCpu)
+    {
+        m_intervalStartUs = aNow;
+        m_cpuStartUs = aCpu;
+        m_maxBacklog = 0.0;
+    }
+
+    /**
+     * Gets a steady clock reading.
+     * @return Microseconds since an arbitrary point.
+     */
+    static int64_t monotonicMicroseconds()
+    {
+#if defined(CLOCK_MONOTONIC)
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#else
+        return (int64_t) std::time(NULL) * 1000000;
+#endif
+    }
+};
+
+} // namespace appender
+} // namespace gelf4cplus
+
+#endif // #if !defined(COMPRESSIONLEVELCONTROLLER_HPP)
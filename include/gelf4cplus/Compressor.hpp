@@ -0,0 +1,543 @@
+/*
+ * File:   Compressor.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(COMPRESSOR_HPP)
+#define COMPRESSOR_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Header Files
+
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Third-party Header Files
+
+#include <zlib.h>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/tss.hpp>
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace message
+{
+
+using std::string;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const int DEFAULT_COMPRESSION_LEVEL = Z_DEFAULT_COMPRESSION; ///< zlib's default.
+const int GZIP_WINDOW_BITS = 15 + 16; ///< Window bits for gzip framing.
+const int ZLIB_WINDOW_BITS = 15; ///< Window bits for zlib framing.
+const int RAW_WINDOW_BITS = -15; ///< Window bits for deflate without framing.
+const int AUTO_WINDOW_BITS = 15 + 32; ///< Window bits to inflate zlib or gzip.
+const size_t MAX_DICTIONARY_SIZE = 32768; ///< Size of the deflate window.
+const size_t FLUSH_MARKER_SIZE = 16; ///< Room for a sync flush beyond the bound.
+const int DEFAULT_MEMORY_LEVEL = 8; ///< zlib's default memory level.
+
+/*- ENUMERATIONS -------------------------------------------------------------*/
+
+/**
+ * The framings of a GELF message that receivers accept.
+ */
+enum Compression
+{
+    COMPRESSION_NONE, ///< Plain JSON.
+    COMPRESSION_ZLIB, ///< zlib framing, which has a smaller header and trailer.
+    COMPRESSION_GZIP ///< gzip framing.
+};
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A deflate stream that is set up once and reset between messages, so the
+ * deflate state (about 256 KB) is not allocated and freed for every message.
+ */
+class DeflateContext : private boost::noncopyable
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor.
+     * @param aWindowBits The zlib window bits, which select the framing.
+     * @param aLevel The compression level.
+     */
+    DeflateContext(const int &aWindowBits, const int &aLevel) :
+        m_level(aLevel)
+    {
+        std::memset(&m_stream, 0, sizeof(m_stream));
+
+        if (deflateInit2(&m_stream, aLevel, Z_DEFLATED, aWindowBits,
+                         DEFAULT_MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            throw std::runtime_error("deflateInit2() failed");
+        }
+    }
+
+    /**
+     * The destructor.
+     */
+    ~DeflateContext()
+    {
+        deflateEnd(&m_stream);
+    }
+
+    // Methods
+
+    /**
+     * Compresses a message in one go.
+     * @param aMessage The message to compress.
+     * @param aLength The length of the message.
+     * @param aLevel The compression level.
+     * @param aCompressedMessage The compressed message. Its capacity is kept,
+     * so a reused buffer stops allocating.
+     */
+    void compress(const char *aMessage,
+                  const size_t &aLength,
+                  const int &aLevel,
+                  string &aCompressedMessage)
+    {
+        aCompressedMessage.clear();
+
+        append(NULL, 0, aMessage, aLength, aLevel, Z_FINISH, aCompressedMessage);
+    }
+
+    /**
+     * Compresses a message in one go and appends it to a buffer.
+     * @param aDictionary Text the message may refer back to, or NULL. Only a
+     * raw deflate stream can take a dictionary without the decoder needing it
+     * separately, so this is for raw streams that continue a decoded prefix.
+     * @param aDictionaryLength The length of the dictionary.
+     * @param aMessage The message to compress.
+     * @param aLength The length of the message.
+     * @param aLevel The compression level.
+     * @param aFlush Z_FINISH to end the stream, or Z_SYNC_FLUSH to stop on a
+     * byte boundary so more blocks can follow.
+     * @param aBuffer The buffer to append to.
+     */
+    void append(const char *aDictionary,
+                const size_t &aDictionaryLength,
+                const char *aMessage,
+                const size_t &aLength,
+                const int &aLevel,
+                const int &aFlush,
+                string &aBuffer)
+    {
+        deflateReset(&m_stream);
+
+        // Changing the level is cheap right after a reset
+        if (aLevel != m_level && deflateParams(&m_stream, aLevel, Z_DEFAULT_STRATEGY) == Z_OK)
+        {
+            m_level = aLevel;
+        }
+
+        if (aDictionary != NULL)
+        {
+            size_t length = std::min(aDictionaryLength, MAX_DICTIONARY_SIZE);
+
+            deflateSetDictionary(&m_stream,
+                                 (const Bytef*) aDictionary + aDictionaryLength - length,
+                                 (uInt) length);
+        }
+
+        // Size the output for the worst case so one deflate() call finishes
+        size_t start = aBuffer.length();
+        aBuffer.resize(start + deflateBound(&m_stream, (uLong) aLength) + FLUSH_MARKER_SIZE);
+
+        m_stream.next_in = (Bytef*) aMessage;
+        m_stream.avail_in = (uInt) aLength;
+        m_stream.next_out = (Bytef*) &aBuffer[start];
+        m_stream.avail_out = (uInt) (aBuffer.length() - start);
+
+        int result = deflate(&m_stream, aFlush);
+
+        if (aFlush == Z_FINISH ? result != Z_STREAM_END : (result != Z_OK || m_stream.avail_out == 0))
+        {
+            aBuffer.resize(start);
+
+            throw std::runtime_error("deflate() failed");
+        }
+
+        aBuffer.resize(start + m_stream.total_out);
+    }
+
+protected:
+
+    // Attributes
+
+    z_stream m_stream; ///< The zlib stream.
+    int m_level; ///< The current compression level.
+};
+
+/**
+ * Compresses GELF messages with a deflate context kept per thread and per
+ * framing, so each thread sets up zlib once and reuses it for every message.
+ */
+class Compressor
+{
+public:
+
+    // Methods
+
+    /**
+     * Compresses a message.
+     * @param aCompression The framing, which must not be COMPRESSION_NONE.
+     * @param aMessage The message to compress.
+     * @param aCompressedMessage The compressed message.
+     * @param aLevel The compression level.
+     */
+    static void compress(const Compression &aCompression,
+                         const string &aMessage,
+                         string &aCompressedMessage,
+                         const int &aLevel = DEFAULT_COMPRESSION_LEVEL)
+    {
+        if (aCompression == COMPRESSION_ZLIB)
+        {
+            zlib(aMessage, aCompressedMessage, aLevel);
+        }
+        else
+        {
+            gzip(aMessage, aCompressedMessage, aLevel);
+        }
+    }
+
+    /**
+     * Compresses a message with zlib framing.
+     * @param aMessage The message to compress.
+     * @param aCompressedMessage The compressed message.
+     * @param aLevel The compression level.
+     */
+    static void zlib(const string &aMessage,
+                     string &aCompressedMessage,
+                     const int &aLevel = DEFAULT_COMPRESSION_LEVEL)
+    {
+        context(contexts().zlib, ZLIB_WINDOW_BITS, aLevel).compress(
+                aMessage.data(), aMessage.length(), aLevel, aCompressedMessage);
+    }
+
+    /**
+     * Compresses a message with gzip framing.
+     * @param aMessage The message to compress.
+     * @param aCompressedMessage The compressed message.
+     * @param aLevel The compression level.
+     */
+    static void gzip(const string &aMessage,
+                     string &aCompressedMessage,
+                     const int &aLevel = DEFAULT_COMPRESSION_LEVEL)
+    {
+        context(contexts().gzip, GZIP_WINDOW_BITS, aLevel).compress(
+                aMessage.data(), aMessage.length(), aLevel, aCompressedMessage);
+    }
+
+    /**
+     * Is a message compressed, going by the magic bytes of its framing?
+     * @param aMessage The message.
+     * @param aLength The length of the message.
+     * @return True if it starts like a zlib or gzip stream rather than JSON.
+     */
+    static bool compressed(const char *aMessage, const size_t &aLength)
+    {
+        if (aLength < 2)
+        {
+            return false;
+        }
+
+        unsigned char first = (unsigned char) aMessage[0];
+        unsigned char second = (unsigned char) aMessage[1];
+
+        // gzip's magic, or a zlib header: deflate method and a valid check
+        return (first == 0x1f && second == 0x8b) ||
+               ((first & 0x0f) == Z_DEFLATED && ((first << 8) | second) % 31 == 0);
+    }
+
+    /**
+     * Decompresses a message with zlib or gzip framing. Not meant for the
+     * hot path; each call sets up its own inflate stream.
+     * @param aMessage The compressed message.
+     * @param aLength The length of the compressed message.
+     * @param aDecompressedMessage The decompressed message.
+     */
+    static void decompress(const char *aMessage,
+                           const size_t &aLength,
+                           string &aDecompressedMessage)
+    {
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(stream));
+
+        if (inflateInit2(&stream, AUTO_WINDOW_BITS) != Z_OK)
+        {
+            throw std::runtime_error("inflateInit2() failed");
+        }
+
+        stream.next_in = (Bytef*) aMessage;
+        stream.avail_in = (uInt) aLength;
+
+        aDecompressedMessage.resize(std::max(aLength * 4, (size_t) 256));
+
+        int result;
+
+        do
+        {
+            // Grow the output until the whole stream fits
+            if (stream.total_out == aDecompressedMessage.length())
+            {
+                aDecompressedMessage.resize(aDecompressedMessage.length() * 2);
+            }
+
+            stream.next_out = (Bytef*) &aDecompressedMessage[stream.total_out];
+            stream.avail_out = (uInt) (aDecompressedMessage.length() - stream.total_out);
+
+            result = inflate(&stream, Z_NO_FLUSH);
+        }
+        while (result == Z_OK);
+
+        aDecompressedMessage.resize(stream.total_out);
+        inflateEnd(&stream);
+
+        if (result != Z_STREAM_END)
+        {
+            throw std::runtime_error("inflate() failed");
+        }
+    }
+
+    /**
+     * Gets the raw deflate context of the calling thread.
+     * @param aLevel The compression level for a new context.
+     * @return The context.
+     */
+    static DeflateContext& raw(const int &aLevel = DEFAULT_COMPRESSION_LEVEL)
+    {
+        return context(contexts().raw, RAW_WINDOW_BITS, aLevel);
+    }
+
+protected:
+
+    // Type Definitions
+
+    /**
+     * The deflate contexts of one thread, created on first use.
+     */
+    struct Contexts : private boost::noncopyable
+    {
+        DeflateContext *gzip; ///< Context for gzip framing.
+        DeflateContext *zlib; ///< Context for zlib framing.
+        DeflateContext *raw; ///< Context for deflate without framing.
+
+        Contexts() :
+            gzip(NULL),
+            zlib(NULL),
+            raw(NULL)
+        {
+        }
+
+        ~Contexts()
+        {
+            delete gzip;
+            delete zlib;
+            delete raw;
+        }
+    };
+
+    // Methods
+
+    /**
+     * Gets the contexts of the calling thread. They are freed when the thread
+     * exits.
+     * @return The contexts.
+     */
+    static Contexts& contexts()
+    {
+        static boost::thread_specific_ptr<Contexts> threadContexts;
+
+        if (threadContexts.get() == NULL)
+        {
+            threadContexts.reset(new Contexts());
+        }
+
+        return *threadContexts;
+    }
+
+    /**
+     * Gets a context, creating it if needed.
+     * @param aContext The slot holding the context.
+     * @param aWindowBits The zlib window bits for a new context.
+     * @param aLevel The compression level for a new context.
+     * @return The context.
+     */
+    static DeflateContext& context(DeflateContext *&aContext,
+                                   const int &aWindowBits,
+                                   const int &aLevel)
+    {
+        if (aContext == NULL)
+        {
+            aContext = new DeflateContext(aWindowBits, aLevel);
+        }
+
+        return *aContext;
+    }
+};
+
+/**
+ * The fields at the start of every message from an appender, deflated once.
+ *
+ * The prefix is compressed as raw deflate blocks that end on a byte boundary.
+ * For each message only the rest is compressed, as a final block that may
+ * refer back into the prefix. The cached blocks and the new ones are framed
+ * as a single gzip or zlib stream, with the checksum of the whole message
+ * combined from the checksum of each part. The result is an ordinary stream
+ * that any decoder reads, so the receiver needs nothing from the sender.
+ */
+class CompressedPrefix : private boost::noncopyable
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor, which compresses the prefix.
+     * @param aPrefix The text every message starts with.
+     */
+    explicit CompressedPrefix(const string &aPrefix) :
+        m_prefix(aPrefix),
+        m_crc(crc32(crc32(0L, Z_NULL, 0), (const Bytef*) aPrefix.data(), (uInt) aPrefix.length())),
+        m_adler(adler32(adler32(0L, Z_NULL, 0), (const Bytef*) aPrefix.data(), (uInt) aPrefix.length()))
+    {
+        // Done once, so spend the time on the best compression
+        DeflateContext context(RAW_WINDOW_BITS, Z_BEST_COMPRESSION);
+
+        context.append(NULL, 0, aPrefix.data(), aPrefix.length(), Z_BEST_COMPRESSION,
+                       Z_SYNC_FLUSH, m_blocks);
+    }
+
+    // Methods
+
+    /**
+     * Gets the prefix.
+     * @return The prefix.
+     */
+    const string& prefix() const
+    {
+        return m_prefix;
+    }
+
+    /**
+     * Does the message start with the prefix?
+     * @param aMessage The message.
+     * @return True if it does.
+     */
+    bool matches(const string &aMessage) const
+    {
+        return aMessage.compare(0, m_prefix.length(), m_prefix) == 0;
+    }
+
+    /**
+     * Compresses a message that starts with the prefix.
+     * @param aCompression The framing, which must not be COMPRESSION_NONE.
+     * @param aMessage The message to compress.
+     * @param aCompressedMessage The compressed message.
+     * @param aLevel The compression level for the rest of the message.
+     */
+    void compress(const Compression &aCompression,
+                  const string &aMessage,
+                  string &aCompressedMessage,
+                  const int &aLevel = DEFAULT_COMPRESSION_LEVEL) const
+    {
+        if (!matches(aMessage))
+        {
+            Compressor::compress(aCompression, aMessage, aCompressedMessage, aLevel);
+
+            return;
+        }
+
+        const char *tail = aMessage.data() + m_prefix.length();
+        uInt tailLength = (uInt) (aMessage.length() - m_prefix.length());
+
+        aCompressedMessage.clear();
+
+        if (aCompression == COMPRESSION_ZLIB)
+        {
+            // Deflate with a 32K window, default level flags, no dictionary
+            static const char ZLIB_HEADER[] = {0x78, (char) 0x9c};
+
+            aCompressedMessage.append(ZLIB_HEADER, sizeof(ZLIB_HEADER));
+        }
+        else
+        {
+            // Deflate, no flags, no time, no extra flags, unknown OS
+            static const char GZIP_HEADER[] = {0x1f, (char) 0x8b, 8, 0, 0, 0, 0, 0, 0, (char) 0xff};
+
+            aCompressedMessage.append(GZIP_HEADER, sizeof(GZIP_HEADER));
+        }
+
+        aCompressedMessage.append(m_blocks);
+
+        Compressor::raw(aLevel).append(m_prefix.data(), m_prefix.length(),
+                                       tail, tailLength, aLevel, Z_FINISH, aCompressedMessage);
+
+        if (aCompression == COMPRESSION_ZLIB)
+        {
+            uLong adler = adler32_combine(m_adler,
+                                          adler32(adler32(0L, Z_NULL, 0), (const Bytef*) tail, tailLength),
+                                          (z_off_t) tailLength);
+
+            // The zlib trailer is big-endian
+            appendBytes(adler, 4, true, aCompressedMessage);
+        }
+        else
+        {
+            uLong crc = crc32_combine(m_crc,
+                                      crc32(crc32(0L, Z_NULL, 0), (const Bytef*) tail, tailLength),
+                                      (z_off_t) tailLength);
+
+            // The gzip trailer is little-endian: CRC and length modulo 2^32
+            appendBytes(crc, 4, false, aCompressedMessage);
+            appendBytes((uLong) aMessage.length(), 4, false, aCompressedMessage);
+        }
+    }
+
+protected:
+
+    // Attributes
+
+    string m_prefix; ///< The prefix.
+    string m_blocks; ///< The prefix as raw deflate blocks, ending on a byte.
+    uLong m_crc; ///< CRC-32 of the prefix.
+    uLong m_adler; ///< Adler-32 of the prefix.
+
+    // Methods
+
+    /**
+     * Appends the low bytes of a value to a buffer.
+     * @param aValue The value.
+     * @param aCount The number of bytes.
+     * @param aBigEndian True for the most significant byte first.
+     * @param aBuffer The buffer to append to.
+     */
+    static void appendBytes(const uLong &aValue,
+                            const size_t &aCount,
+                            const bool &aBigEndian,
+                            string &aBuffer)
+    {
+        for (size_t i = 0; i < aCount; ++i)
+        {
+            size_t shift = 8 * (aBigEndian ? aCount - 1 - i : i);
+
+            aBuffer.push_back((char) ((aValue >> shift) & 0xff));
+        }
+    }
+};
+
+} // namespace message
+} // namespace gelf4cplus
+
+#endif // #if !defined(COMPRESSOR_HPP)
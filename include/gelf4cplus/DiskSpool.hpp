@@ -0,0 +1,905 @@
+/*
+ * File:   DiskSpool.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(DISKSPOOL_HPP)
+#define DISKSPOOL_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Third-party Headers
+
+#include <zlib.h>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+using std::string;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t DEFAULT_SPOOL_SEGMENT_SIZE = 16 * 1024 * 1024; ///< Bytes per segment file.
+const uint64_t DEFAULT_SPOOL_DISK_BUDGET = 256 * 1024 * 1024; ///< Most bytes on disk.
+const size_t SPOOL_HEADER_SIZE = 64; ///< Bytes before the first record.
+const size_t SPOOL_RECORD_HEADER_SIZE = 8; ///< Length and CRC of a record.
+const uint32_t SPOOL_VERSION = 1; ///< Format of the segment files.
+const char SPOOL_MAGIC[8] = { 'G', 'E', 'L', 'F', 'S', 'P', 'O', 'L' }; ///< Marks a segment file.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A queue of messages kept on disk in fixed-size, memory-mapped segment files
+ * named spool-<sequence>.seg. Messages are appended to the newest segment and
+ * read from the oldest; a segment is deleted once it has been read, and a new
+ * one is only created while the segments fit in the disk budget. The space
+ * for a segment is allocated when it is created, so a full disk shows up as
+ * a dropped message rather than as SIGBUS on a write through the mapping.
+ *
+ * Each segment starts with a header holding its sequence number and how far
+ * it has been written and read. Each record is its length, the CRC-32 of its
+ * bytes and the bytes, padded to 8 bytes. A record is written before the
+ * header is moved past it, and a segment is checked record by record when it
+ * is opened again, so after a crash the spool resumes from the last record
+ * that made it to disk intact. A file that cannot be opened, mapped or
+ * recognized as a segment is left alone and counted. Messages already
+ * replayed before a crash may be sent again.
+ *
+ * A reader that cannot tell at once whether a message was delivered reads
+ * ahead with read(), and later removes what it read with confirm() or reads
+ * it again after rewind().
+ *
+ * All methods are thread-safe.
+ */
+class DiskSpool : private boost::noncopyable
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor, which picks up the segments left by an earlier run.
+     * @param aDirectory The directory for the segment files, which must exist.
+     * @param aSegmentSize The size of each segment file.
+     * @param aDiskBudget The most bytes the segment files may take up.
+     */
+    DiskSpool(const string &aDirectory,
+              const size_t &aSegmentSize = DEFAULT_SPOOL_SEGMENT_SIZE,
+              const uint64_t &aDiskBudget = DEFAULT_SPOOL_DISK_BUDGET) :
+        m_directory(aDirectory),
+        m_segmentSize(std::max(aSegmentSize, SPOOL_HEADER_SIZE + 4096)),
+        m_maxSegments(std::max<uint64_t>(1, aDiskBudget / m_segmentSize)),
+        m_nextSequence(0),
+        m_readSequence(0),
+        m_readOffset(0),
+        m_readMessages(0),
+        m_messages(0),
+        m_spooledMessages(0),
+        m_replayedMessages(0),
+        m_droppedMessages(0),
+        m_corruptSegments(0),
+        m_skippedSegments(0)
+    {
+        recover();
+    }
+
+    /**
+     * The destructor, which writes the segments out and unmaps them. They are
+     * picked up again by the next spool on the same directory.
+     */
+    ~DiskSpool()
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        for (size_t i = 0; i < m_segments.size(); ++i)
+        {
+            m_segments[i]->sync();
+        }
+    }
+
+    // Methods
+
+    /**
+     * Appends a message to the spool.
+     * @param aData The message bytes.
+     * @param aLength The number of bytes.
+     * @return False if the message was dropped because the disk budget is
+     * used up, the disk is full or the message is larger than a segment.
+     */
+    bool append(const char *aData, const size_t &aLength)
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        bool appended = !m_segments.empty() && m_segments.back()->append(aData, aLength);
+
+        if (!appended && m_segments.size() >= m_maxSegments)
+        {
+            // Segments replayed to the end give back their share of the
+            // budget, and the newest is emptied if it was the only one
+            removeReadSegments();
+
+            appended = !m_segments.empty() && m_segments.back()->append(aData, aLength);
+        }
+
+        if (!appended)
+        {
+            if (m_segments.size() >= m_maxSegments ||
+                recordSize(aLength) > m_segmentSize - SPOOL_HEADER_SIZE)
+            {
+                m_droppedMessages.fetch_add(1, boost::memory_order_relaxed);
+
+                return false;
+            }
+
+            try
+            {
+                m_segments.push_back(boost::shared_ptr<Segment>(
+                        Segment::create(segmentPath(m_nextSequence), m_nextSequence, m_segmentSize)));
+            }
+            catch (const std::exception&)
+            {
+                // Out of disk space or file handles; the budget is as good as used up
+                m_droppedMessages.fetch_add(1, boost::memory_order_relaxed);
+
+                return false;
+            }
+
+            ++m_nextSequence;
+
+            m_segments.back()->append(aData, aLength);
+        }
+
+        m_messages.fetch_add(1, boost::memory_order_relaxed);
+        m_spooledMessages.fetch_add(1, boost::memory_order_relaxed);
+
+        return true;
+    }
+
+    /**
+     * Copies the oldest message out of the spool without removing it.
+     * @param aMessage The string to copy the message into.
+     * @return False if the spool is empty.
+     */
+    bool front(string &aMessage)
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        if (!removeReadSegments())
+        {
+            return false;
+        }
+
+        uint64_t offset = m_segments.front()->readOffset();
+
+        return m_segments.front()->read(offset, aMessage);
+    }
+
+    /**
+     * Removes the oldest message.
+     */
+    void pop()
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        popLocked();
+    }
+
+    /**
+     * Copies the message after the last one read out of the spool, starting
+     * with the oldest, without removing it. Messages read are removed by
+     * confirm() once they are known to have been delivered, or read again
+     * after rewind().
+     * @param aMessage The string to copy the message into.
+     * @return False if every message has been read.
+     */
+    bool read(string &aMessage)
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        if (m_readMessages.load(boost::memory_order_relaxed) == 0)
+        {
+            if (!removeReadSegments())
+            {
+                return false;
+            }
+
+            m_readSequence = m_segments.front()->sequence();
+            m_readOffset = m_segments.front()->readOffset();
+        }
+
+        // Segments are few, and the one read from is near the front
+        for (size_t i = 0; i < m_segments.size(); ++i)
+        {
+            if (m_segments[i]->sequence() < m_readSequence)
+            {
+                continue;
+            }
+
+            if (m_segments[i]->sequence() > m_readSequence)
+            {
+                m_readSequence = m_segments[i]->sequence();
+                m_readOffset = m_segments[i]->readOffset();
+            }
+
+            if (m_segments[i]->read(m_readOffset, aMessage))
+            {
+                m_readMessages.fetch_add(1, boost::memory_order_relaxed);
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Removes the messages read since the last confirm() or rewind().
+     */
+    void confirm()
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        while (m_readMessages.load(boost::memory_order_relaxed) != 0 && popLocked())
+        {
+        }
+    }
+
+    /**
+     * Lets read() start again from the oldest message.
+     */
+    void rewind()
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        m_readMessages.store(0, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Is the spool empty?
+     * @return True if no message is waiting to be replayed.
+     */
+    bool empty() const
+    {
+        return m_messages.load(boost::memory_order_relaxed) == 0;
+    }
+
+    /**
+     * Gets the number of messages waiting to be replayed.
+     * @return The number of messages.
+     */
+    uint64_t size() const
+    {
+        return m_messages.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Has every message been read since the last rewind()?
+     * @return True if read() has nothing more to return.
+     */
+    bool allRead() const
+    {
+        return m_messages.load(boost::memory_order_relaxed) ==
+               m_readMessages.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of messages appended since the spool was opened.
+     * @return The number of spooled messages.
+     */
+    uint64_t spooledMessages() const
+    {
+        return m_spooledMessages.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of messages removed after being replayed.
+     * @return The number of replayed messages.
+     */
+    uint64_t replayedMessages() const
+    {
+        return m_replayedMessages.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of messages dropped because the disk budget was used up.
+     * @return The number of dropped messages.
+     */
+    uint64_t droppedMessages() const
+    {
+        return m_droppedMessages.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of segments found damaged when opened, and cut short
+     * at the first bad record.
+     * @return The number of damaged segments.
+     */
+    uint64_t corruptSegments() const
+    {
+        return m_corruptSegments.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of segment files left by an earlier run that could not
+     * be opened, mapped or recognized, and were left out of the spool.
+     * @return The number of skipped segments.
+     */
+    uint64_t skippedSegments() const
+    {
+        return m_skippedSegments.load(boost::memory_order_relaxed);
+    }
+
+protected:
+
+    // Type Definitions
+
+    /**
+     * The header at the start of each segment file.
+     */
+    struct SegmentHeader
+    {
+        char magic[8]; ///< SPOOL_MAGIC.
+        uint32_t version; ///< SPOOL_VERSION.
+        uint32_t reserved; ///< Zero.
+        uint64_t sequence; ///< Order of the segment in the spool.
+        uint64_t capacity; ///< Size of the file.
+        uint64_t writeOffset; ///< End of the last complete record.
+        uint64_t readOffset; ///< Start of the first record not yet replayed.
+    };
+
+    /**
+     * One memory-mapped segment file.
+     */
+    class Segment : private boost::noncopyable
+    {
+    public:
+
+        /**
+         * Creates a new, empty segment file, allocating all of its blocks so
+         * that writes through the mapping cannot run out of disk space.
+         * @param aPath The file name.
+         * @param aSequence The order of the segment in the spool.
+         * @param aSize The size of the file.
+         * @return The segment.
+         * @throws std::runtime_error If the file cannot be created, allocated
+         * or mapped; no file is left behind.
+         */
+        static Segment* create(const string &aPath, const uint64_t &aSequence, const size_t &aSize)
+        {
+            int fd = ::open(aPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+            if (fd < 0)
+            {
+                throw std::runtime_error("Cannot create spool segment " + aPath);
+            }
+
+            // Unlike ftruncate(), this fails now if the disk is full instead
+            // of leaving a sparse file
+            if (::posix_fallocate(fd, 0, aSize) != 0)
+            {
+                ::close(fd);
+                ::unlink(aPath.c_str());
+
+                throw std::runtime_error("Cannot allocate spool segment " + aPath);
+            }
+
+            Segment *segment;
+
+            try
+            {
+                segment = new Segment(aPath, fd, aSize);
+            }
+            catch (...)
+            {
+                ::unlink(aPath.c_str());
+
+                throw;
+            }
+            SegmentHeader *header = segment->header();
+
+            std::memcpy(header->magic, SPOOL_MAGIC, sizeof(SPOOL_MAGIC));
+            header->version = SPOOL_VERSION;
+            header->reserved = 0;
+            header->sequence = aSequence;
+            header->capacity = aSize;
+            header->writeOffset = SPOOL_HEADER_SIZE;
+            header->readOffset = SPOOL_HEADER_SIZE;
+
+            return segment;
+        }
+
+        /**
+         * Opens a segment file left by an earlier run, checking its records.
+         * @param aPath The file name.
+         * @param aCorrupt Set to true if the segment had to be cut short.
+         * @return The segment, or NULL if the file cannot be opened or mapped,
+         * or is not a valid segment.
+         */
+        static Segment* open(const string &aPath, bool &aCorrupt)
+        {
+            int fd = ::open(aPath.c_str(), O_RDWR);
+            struct stat status;
+
+            if (fd < 0)
+            {
+                return NULL;
+            }
+
+            if (::fstat(fd, &status) != 0 || (size_t) status.st_size < SPOOL_HEADER_SIZE)
+            {
+                ::close(fd);
+
+                return NULL;
+            }
+
+            Segment *segment;
+
+            try
+            {
+                // The constructor closes the file if it cannot map it
+                segment = new Segment(aPath, fd, status.st_size);
+            }
+            catch (const std::exception&)
+            {
+                return NULL;
+            }
+
+            SegmentHeader *header = segment->header();
+
+            if (std::memcmp(header->magic, SPOOL_MAGIC, sizeof(SPOOL_MAGIC)) != 0 ||
+                header->version != SPOOL_VERSION || header->capacity != (uint64_t) status.st_size)
+            {
+                delete segment;
+
+                return NULL;
+            }
+
+            aCorrupt = !segment->validate();
+
+            return segment;
+        }
+
+        /**
+         * The destructor, which unmaps the file.
+         */
+        ~Segment()
+        {
+            if (m_data != MAP_FAILED)
+            {
+                ::munmap(m_data, m_size);
+            }
+
+            if (m_fd >= 0)
+            {
+                ::close(m_fd);
+            }
+        }
+
+        /**
+         * Gets the order of the segment in the spool.
+         * @return The sequence number.
+         */
+        uint64_t sequence()
+        {
+            return header()->sequence;
+        }
+
+        /**
+         * Appends a record.
+         * @param aData The message bytes.
+         * @param aLength The number of bytes.
+         * @return False if the record does not fit.
+         */
+        bool append(const char *aData, const size_t &aLength)
+        {
+            SegmentHeader *header = this->header();
+            uint64_t offset = header->writeOffset;
+
+            if (offset + recordSize(aLength) > m_size)
+            {
+                return false;
+            }
+
+            uint32_t length = (uint32_t) aLength;
+            uint32_t crc = (uint32_t) crc32(0L, (const Bytef*) aData, (uInt) aLength);
+
+            std::memcpy(m_data + offset, &length, sizeof(length));
+            std::memcpy(m_data + offset + sizeof(length), &crc, sizeof(crc));
+            std::memcpy(m_data + offset + SPOOL_RECORD_HEADER_SIZE, aData, aLength);
+
+            // Only now is the record part of the segment
+            boost::atomic_thread_fence(boost::memory_order_release);
+            header->writeOffset = offset + recordSize(aLength);
+
+            return true;
+        }
+
+        /**
+         * Gets the start of the oldest unread record.
+         * @return The offset of the record.
+         */
+        uint64_t readOffset()
+        {
+            return header()->readOffset;
+        }
+
+        /**
+         * Gets the end of the last complete record.
+         * @return The offset past the record.
+         */
+        uint64_t writeOffset()
+        {
+            return header()->writeOffset;
+        }
+
+        /**
+         * Copies a record and moves past it.
+         * @param anOffset The start of the record, set to the start of the
+         * next one.
+         * @param aMessage The string to copy it into.
+         * @return False if there is no record at the offset.
+         */
+        bool read(uint64_t &anOffset, string &aMessage)
+        {
+            if (anOffset >= writeOffset())
+            {
+                return false;
+            }
+
+            uint32_t length;
+            std::memcpy(&length, m_data + anOffset, sizeof(length));
+
+            aMessage.assign(m_data + anOffset + SPOOL_RECORD_HEADER_SIZE, length);
+            anOffset += recordSize(length);
+
+            return true;
+        }
+
+        /**
+         * Marks the oldest unread record as read.
+         * @return False if every record had been read.
+         */
+        bool pop()
+        {
+            SegmentHeader *header = this->header();
+
+            if (header->readOffset >= header->writeOffset)
+            {
+                return false;
+            }
+
+            uint32_t length;
+            std::memcpy(&length, m_data + header->readOffset, sizeof(length));
+
+            header->readOffset += recordSize(length);
+
+            return true;
+        }
+
+        /**
+         * Counts the records not yet read.
+         * @return The number of unread records.
+         */
+        uint64_t unread()
+        {
+            SegmentHeader *header = this->header();
+            uint64_t count = 0;
+
+            for (uint64_t offset = header->readOffset; offset < header->writeOffset; ++count)
+            {
+                uint32_t length;
+                std::memcpy(&length, m_data + offset, sizeof(length));
+
+                offset += recordSize(length);
+            }
+
+            return count;
+        }
+
+        /**
+         * Empties a segment that has been read to the end, so that it can be
+         * written again from the start.
+         */
+        void rewind()
+        {
+            SegmentHeader *header = this->header();
+
+            header->readOffset = SPOOL_HEADER_SIZE;
+            header->writeOffset = SPOOL_HEADER_SIZE;
+        }
+
+        /**
+         * Writes the segment out to disk.
+         */
+        void sync()
+        {
+            ::msync(m_data, m_size, MS_SYNC);
+        }
+
+        /**
+         * Deletes the segment file. The mapping stays valid until destroyed.
+         */
+        void remove()
+        {
+            ::unlink(m_path.c_str());
+        }
+
+    protected:
+
+        // Attributes
+
+        string m_path; ///< The file name.
+        int m_fd; ///< The open file.
+        size_t m_size; ///< The size of the file and mapping.
+        char *m_data; ///< The mapping.
+
+        // Constructors & Destructor
+
+        /**
+         * The constructor, which maps the file.
+         * @param aPath The file name.
+         * @param aFd The open file, which the segment takes over.
+         * @param aSize The size of the file.
+         */
+        Segment(const string &aPath, const int &aFd, const size_t &aSize) :
+            m_path(aPath),
+            m_fd(aFd),
+            m_size(aSize),
+            m_data((char*) ::mmap(NULL, aSize, PROT_READ | PROT_WRITE, MAP_SHARED, aFd, 0))
+        {
+            if (m_data == MAP_FAILED)
+            {
+                ::close(m_fd);
+                m_fd = -1;
+
+                throw std::runtime_error("Cannot map spool segment " + aPath);
+            }
+        }
+
+        // Methods
+
+        /**
+         * Gets the header of the segment.
+         * @return The header.
+         */
+        SegmentHeader* header()
+        {
+            return reinterpret_cast<SegmentHeader*>(m_data);
+        }
+
+        /**
+         * Checks the records between the read and write offsets, cutting the
+         * segment short at the first one that is not intact.
+         * @return False if the segment had to be cut short.
+         */
+        bool validate()
+        {
+            SegmentHeader *header = this->header();
+
+            if (header->writeOffset > m_size || header->readOffset < SPOOL_HEADER_SIZE ||
+                header->readOffset > header->writeOffset || header->readOffset % 8 != 0)
+            {
+                header->readOffset = SPOOL_HEADER_SIZE;
+                header->writeOffset = SPOOL_HEADER_SIZE;
+
+                return false;
+            }
+
+            uint64_t offset = header->readOffset;
+
+            while (offset < header->writeOffset)
+            {
+                uint32_t length;
+                uint32_t crc;
+
+                if (offset + SPOOL_RECORD_HEADER_SIZE > header->writeOffset)
+                {
+                    header->writeOffset = offset;
+
+                    return false;
+                }
+
+                std::memcpy(&length, m_data + offset, sizeof(length));
+                std::memcpy(&crc, m_data + offset + sizeof(length), sizeof(crc));
+
+                if (offset + recordSize(length) > header->writeOffset ||
+                    crc != (uint32_t) crc32(0L, (const Bytef*) (m_data + offset + SPOOL_RECORD_HEADER_SIZE), length))
+                {
+                    header->writeOffset = offset;
+
+                    return false;
+                }
+
+                offset += recordSize(length);
+            }
+
+            return true;
+        }
+    };
+
+    // Attributes
+
+    const string m_directory; ///< Where the segment files are.
+    const size_t m_segmentSize; ///< Bytes per segment file.
+    const uint64_t m_maxSegments; ///< Segments that fit in the disk budget.
+    boost::mutex m_mutex; ///< Guards the segments.
+    std::deque< boost::shared_ptr<Segment> > m_segments; ///< Oldest first.
+    uint64_t m_nextSequence; ///< Sequence of the next new segment.
+    uint64_t m_readSequence; ///< Segment read() reads from next.
+    uint64_t m_readOffset; ///< Record read() reads next.
+    boost::atomic<uint64_t> m_readMessages; ///< Messages read but not yet confirmed.
+    boost::atomic<uint64_t> m_messages; ///< Messages not yet replayed.
+    boost::atomic<uint64_t> m_spooledMessages; ///< Messages appended.
+    boost::atomic<uint64_t> m_replayedMessages; ///< Messages replayed.
+    boost::atomic<uint64_t> m_droppedMessages; ///< Messages over the budget.
+    boost::atomic<uint64_t> m_corruptSegments; ///< Segments cut short on open.
+    boost::atomic<uint64_t> m_skippedSegments; ///< Segment files left out on open.
+
+    // Methods
+
+    /**
+     * Removes the oldest segments while every record in them has been read,
+     * keeping the newest for writing. Called with the mutex held.
+     * @return False if the spool is empty.
+     */
+    bool removeReadSegments()
+    {
+        while (!m_segments.empty())
+        {
+            if (m_segments.front()->readOffset() < m_segments.front()->writeOffset())
+            {
+                return true;
+            }
+
+            // Read to the end; the newest segment is kept for writing
+            if (m_segments.size() == 1)
+            {
+                m_segments.front()->rewind();
+
+                return false;
+            }
+
+            m_segments.front()->remove();
+            m_segments.pop_front();
+        }
+
+        return false;
+    }
+
+    /**
+     * Removes the oldest message. Called with the mutex held.
+     * @return False if the spool was empty.
+     */
+    bool popLocked()
+    {
+        if (!removeReadSegments() || !m_segments.front()->pop())
+        {
+            return false;
+        }
+
+        m_messages.fetch_sub(1, boost::memory_order_relaxed);
+        m_replayedMessages.fetch_add(1, boost::memory_order_relaxed);
+
+        if (m_readMessages.load(boost::memory_order_relaxed) != 0)
+        {
+            m_readMessages.fetch_sub(1, boost::memory_order_relaxed);
+        }
+
+        return true;
+    }
+
+    /**
+     * Opens the segments left by an earlier run, oldest first, and counts
+     * their unread messages.
+     */
+    void recover()
+    {
+        std::vector<string> names;
+
+        if (DIR *directory = ::opendir(m_directory.c_str()))
+        {
+            while (struct dirent *entry = ::readdir(directory))
+            {
+                string name(entry->d_name);
+
+                if (name.size() > 10 && name.compare(0, 6, "spool-") == 0 &&
+                    name.compare(name.size() - 4, 4, ".seg") == 0)
+                {
+                    names.push_back(name);
+                }
+            }
+
+            ::closedir(directory);
+        }
+
+        // The sequence is zero-padded hex, so names sort in spool order
+        std::sort(names.begin(), names.end());
+
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            bool corrupt = false;
+            boost::shared_ptr<Segment> segment;
+
+            try
+            {
+                segment.reset(Segment::open(m_directory + "/" + names[i], corrupt));
+            }
+            catch (const std::exception&)
+            {
+                // Out of memory; the rest of the spool is still usable
+            }
+
+            if (!segment)
+            {
+                m_skippedSegments.fetch_add(1, boost::memory_order_relaxed);
+
+                continue;
+            }
+
+            if (corrupt)
+            {
+                m_corruptSegments.fetch_add(1, boost::memory_order_relaxed);
+            }
+
+            m_nextSequence = std::max(m_nextSequence, segment->sequence() + 1);
+            m_messages.fetch_add(segment->unread(), boost::memory_order_relaxed);
+            m_segments.push_back(segment);
+        }
+    }
+
+    /**
+     * Gets the file name of a segment.
+     * @param aSequence The sequence number of the segment.
+     * @return The file name.
+     */
+    string segmentPath(const uint64_t &aSequence) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "spool-%016llx.seg", (unsigned long long) aSequence);
+
+        return m_directory + "/" + name;
+    }
+
+    /**
+     * Gets the space a record takes up in a segment.
+     * @param aLength The length of the message.
+     * @return The record size, padded to 8 bytes.
+     */
+    static size_t recordSize(const size_t &aLength)
+    {
+        return (SPOOL_RECORD_HEADER_SIZE + aLength + 7) & ~(size_t) 7;
+    }
+};
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(DISKSPOOL_HPP)
@@ -0,0 +1,297 @@
+/*
+ * File:   EventQueue.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(EVENTQUEUE_HPP)
+#define EVENTQUEUE_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Header Files
+
+#include <cstddef>
+#include <stdint.h>
+
+// Third-party Header Files
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+
+// Other Header Files
+
+#include "CapturedEvent.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace appender
+{
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t DEFAULT_QUEUE_SIZE = 8192; ///< The default async queue size.
+const size_t CACHE_LINE_SIZE = 64; ///< Used to keep hot counters apart.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A bounded, lock-free, multi-producer single-consumer ring of captured
+ * logging events. All slots are allocated up front; producers claim a slot
+ * with a single compare-and-swap and capture the event straight into it, and
+ * the consumer claims the oldest event the same way, processes it in place
+ * and hands the slot back. Producers may also claim the oldest event to drop
+ * it and make room. Each slot carries a sequence number that tells whether it
+ * is free for the current lap of the producers or holds an event.
+ */
+class EventQueue : private boost::noncopyable
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor.
+     * @param aCapacity The minimum number of events the queue can hold. It is
+     * rounded up to the next power of two.
+     */
+    explicit EventQueue(const size_t &aCapacity = DEFAULT_QUEUE_SIZE) :
+        m_capacity(roundUpToPowerOfTwo(aCapacity)),
+        m_mask(m_capacity - 1),
+        m_slots(new Slot[m_capacity]),
+        m_enqueuePosition(0),
+        m_dequeuePosition(0),
+        m_claimedPosition(0)
+    {
+        for (size_t i = 0; i < m_capacity; ++i)
+        {
+            m_slots[i].sequence.store(i, boost::memory_order_relaxed);
+        }
+    }
+
+    // Methods
+
+    /**
+     * Gets the number of slots in the queue.
+     * @return The capacity of the queue.
+     */
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    /**
+     * Gets the approximate number of queued events. Only exact when called
+     * from the consumer with no producer running.
+     * @return The number of queued events.
+     */
+    size_t size() const
+    {
+        size_t enqueued = m_enqueuePosition.load(boost::memory_order_relaxed);
+        size_t dequeued = m_dequeuePosition.load(boost::memory_order_relaxed);
+
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    /**
+     * Captures an event into the next free slot. Safe to call from any
+     * number of threads at once.
+     * @param anEvent The logging event to capture.
+     * @return True if the event was queued, false if the queue is full.
+     */
+    bool tryPush(const log4cplus::spi::InternalLoggingEvent &anEvent)
+    {
+        size_t position = m_enqueuePosition.load(boost::memory_order_relaxed);
+
+        for (;;)
+        {
+            Slot &slot = m_slots[position & m_mask];
+            size_t sequence = slot.sequence.load(boost::memory_order_acquire);
+            intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+
+            if (difference == 0)
+            {
+                // The slot is free for this lap, try to claim it
+                if (m_enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                            boost::memory_order_relaxed))
+                {
+                    slot.event.capture(anEvent);
+                    slot.sequence.store(position + 1, boost::memory_order_release);
+
+                    return true;
+                }
+            }
+            else if (difference < 0)
+            {
+                // The consumer has not released this slot from the last lap
+                return false;
+            }
+            else
+            {
+                // Another producer claimed the slot, start over
+                position = m_enqueuePosition.load(boost::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Claims the oldest queued event so that it can be processed in place.
+     * Must only be called from the single consumer, and each event claimed
+     * must be handed back with pop() before the next claim.
+     * @return The oldest event or NULL if the queue is empty.
+     */
+    CapturedEvent* claim()
+    {
+        size_t position;
+
+        if (!claimOldest(position))
+        {
+            return NULL;
+        }
+
+        m_claimedPosition = position;
+
+        return &m_slots[position & m_mask].event;
+    }
+
+    /**
+     * Hands the slot of the event returned by claim() back to the producers.
+     * Must only be called from the single consumer.
+     */
+    void pop()
+    {
+        release(m_claimedPosition);
+    }
+
+    /**
+     * Drops the oldest queued event to make room. Safe to call from any
+     * number of producers while the consumer runs.
+     * @param aLevel The level of the dropped event.
+     * @return True if an event was dropped, false if there was none to drop.
+     */
+    bool tryDropOldest(log4cplus::LogLevel &aLevel)
+    {
+        size_t position;
+
+        if (!claimOldest(position))
+        {
+            return false;
+        }
+
+        aLevel = m_slots[position & m_mask].event.getLogLevel();
+        release(position);
+
+        return true;
+    }
+
+    /**
+     * Is the queue empty?
+     * @return True if no event is waiting to be consumed.
+     */
+    bool empty() const
+    {
+        size_t position = m_dequeuePosition.load(boost::memory_order_relaxed);
+
+        return m_slots[position & m_mask].sequence.load(boost::memory_order_acquire) != position + 1;
+    }
+
+protected:
+
+    // Type Definitions
+
+    /**
+     * A slot in the ring.
+     */
+    struct Slot
+    {
+        boost::atomic<size_t> sequence; ///< The lap this slot belongs to.
+        CapturedEvent event; ///< The captured event.
+    };
+
+    // Attributes
+
+    const size_t m_capacity; ///< The number of slots.
+    const size_t m_mask; ///< Mask to turn a position into a slot index.
+    boost::scoped_array<Slot> m_slots; ///< The slots.
+    char m_padding0[CACHE_LINE_SIZE]; ///< Keeps the positions apart.
+    boost::atomic<size_t> m_enqueuePosition; ///< Next position to claim.
+    char m_padding1[CACHE_LINE_SIZE]; ///< Keeps the positions apart.
+    boost::atomic<size_t> m_dequeuePosition; ///< Next position to consume.
+    size_t m_claimedPosition; ///< The event the consumer is processing.
+
+    // Methods
+
+    /**
+     * Claims the oldest event that has been fully captured.
+     * @param aPosition The position of the claimed event.
+     * @return False if the queue is empty.
+     */
+    bool claimOldest(size_t &aPosition)
+    {
+        size_t position = m_dequeuePosition.load(boost::memory_order_relaxed);
+
+        for (;;)
+        {
+            const Slot &slot = m_slots[position & m_mask];
+            size_t sequence = slot.sequence.load(boost::memory_order_acquire);
+            intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+
+            if (difference == 0)
+            {
+                // The slot holds an event for this lap, try to claim it
+                if (m_dequeuePosition.compare_exchange_weak(position, position + 1,
+                                                            boost::memory_order_relaxed))
+                {
+                    aPosition = position;
+
+                    return true;
+                }
+            }
+            else if (difference < 0)
+            {
+                // Nothing has been captured here yet
+                return false;
+            }
+            else
+            {
+                // Someone else claimed the event, start over
+                position = m_dequeuePosition.load(boost::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Hands a claimed slot back to the producers for their next lap.
+     * @param aPosition The position of the claimed event.
+     */
+    void release(const size_t &aPosition)
+    {
+        m_slots[aPosition & m_mask].sequence.store(aPosition + m_capacity, boost::memory_order_release);
+    }
+
+    /**
+     * Rounds a value up to the next power of two.
+     * @param aValue The value to round.
+     * @return The smallest power of two not less than aValue.
+     */
+    static size_t roundUpToPowerOfTwo(const size_t &aValue)
+    {
+        size_t result = 1;
+
+        while (result < aValue)
+        {
+            result <<= 1;
+        }
+
+        return result;
+    }
+};
+
+} // namespace appender
+} // namespace gelf4cplus
+
+#endif // #if !defined(EVENTQUEUE_HPP)
@@ -14,27 +14,47 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <stdint.h>
 
 // Third-party Header Files
 
 #include <log4cplus/appender.h>
+#include <log4cplus/loglevel.h>
+#include <log4cplus/spi/filter.h>
 #include <log4cplus/syslogappender.h>
 #include <log4cplus/configurator.h>
 #include <log4cplus/helpers/stringhelper.h>
 #include <log4cplus/helpers/property.h>
+#include <log4cplus/helpers/loglog.h>
 #include <log4cplus/tstring.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/asio.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 // Other Header Files
 
 #include "ITransport.hpp"
 #include "GelfMessage.hpp"
+#include "GelfEncoder.hpp"
+#include "Compressor.hpp"
+#include "CompressionLevelController.hpp"
+#include "CapturedEvent.hpp"
+#include "ShardedEventQueue.hpp"
+#include "WaitStrategy.hpp"
+#include "WorkerPool.hpp"
 
 /*- NAMESPACES ---------------------------------------------------------------*/
 
@@ -46,8 +66,49 @@ namespace appender
 using transport::ITransport;
 using log4cplus::tstring;
 using log4cplus::helpers::Properties;
+using boost::lexical_cast;
 using std::string;
 
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const long SENDER_IDLE_WAIT_MS = 100; ///< Longest the sender parks unwoken.
+const size_t DEFAULT_COMPRESSION_MIN_BYTES = 512; ///< Smaller messages are sent plain.
+const size_t SENDER_BATCH_SIZE = 64; ///< Messages handed to the transport at once.
+const size_t LOG_LEVEL_COUNT = 6; ///< TRACE to FATAL, for the drop counters.
+const long BLOCKED_PRODUCER_WAIT_MS = 10; ///< Longest a blocked append sleeps unwoken.
+const size_t MAX_DROP_OLDEST_ATTEMPTS = 16; ///< Tries to make room before giving up.
+const int DEFAULT_PROTECTED_RESERVE_PERCENT = 25; ///< Queue kept for protected levels.
+const long DEFAULT_CLOSE_TIMEOUT_MS = 5000; ///< Longest close() spends sending.
+const long TRANSPORT_DRAIN_POLL_MS = 1; ///< How often pending sends are checked.
+
+/*- ENUMERATIONS -------------------------------------------------------------*/
+
+/**
+ * What an async append does when the queue is full.
+ */
+enum QueuePolicy
+{
+    QUEUE_BLOCK, ///< Wait for the sender thread to make room.
+    QUEUE_DROP_NEWEST, ///< Drop the event being appended.
+    QUEUE_DROP_OLDEST, ///< Drop the oldest queued event to make room.
+    QUEUE_DROP_BELOW_LEVEL ///< Keep part of the queue for the protected levels.
+};
+
+/**
+ * Standard fields normally written per message that the static fields hold
+ * instead, because they are configured or an additional field replaces them.
+ */
+enum PrefixField
+{
+    PREFIX_SHORT_MESSAGE = 1, ///< short_message.
+    PREFIX_FULL_MESSAGE = 2, ///< full_message.
+    PREFIX_TIMESTAMP = 4, ///< timestamp.
+    PREFIX_LEVEL = 8, ///< level.
+    PREFIX_FACILITY = 16, ///< facility.
+    PREFIX_FILE = 32, ///< file.
+    PREFIX_LINE = 64 ///< line.
+};
+
 /*- CLASSES ------------------------------------------------------------------*/
 
 /**
@@ -80,6 +141,17 @@ const SysLogLevel SYSLOG_LEVEL;
 /**
  * This class defines the GELF appender, which creates GELF messages and sends
  * them using the specified transport.
+ *
+ * In async mode append() only captures the event into a bounded queue, and a
+ * background sender thread builds, compresses and sends the GELF messages, or
+ * with workers hands the building and compressing to a pool of threads.
+ * What happens to events that arrive while the queue is full is set by the
+ * queue policy; every dropped event is counted by its level.
+ *
+ * log4cplus calls append() with the appender's mutex held, so all logging
+ * threads take turns even though append() only captures the event. Callers
+ * that can reach the appender directly may use appendLockFree() instead, and
+ * with a sharded queue the threads then share nothing on the way in.
  */
 
 class Gelf4CPlusAppender : public log4cplus::Appender
@@ -90,6 +162,24 @@ public:
 
     typedef boost::unordered_map<string, string> Dictionary;
 
+    /**
+     * The fields that are the same for every message, encoded once.
+     */
+    struct StaticFields
+    {
+        string json; ///< The encoded fields, an unfinished JSON object.
+        boost::scoped_ptr<message::CompressedPrefix> compressed; ///< Pre-compressed, or null.
+        unsigned int prefixFields; ///< PrefixField bits of the standard fields in json.
+        bool hasNdc; ///< Is an "ndc" additional field configured?
+        string ndc; ///< Its value, sent for events without an NDC.
+
+        StaticFields() :
+            prefixFields(0),
+            hasNdc(false)
+        {
+        }
+    };
+
     // Constructors and Destructor
 
     /**
@@ -99,8 +189,35 @@ public:
      */
     Gelf4CPlusAppender(ITransport *aTransport = NULL,
                        const Properties &properties = Properties()) :
-                       m_transport(aTransport)
+                       m_transport(aTransport),
+                       m_compression(message::COMPRESSION_GZIP),
+                       m_compressionMinBytes(DEFAULT_COMPRESSION_MIN_BYTES),
+                       m_compressionLevel(message::DEFAULT_COMPRESSION_LEVEL),
+                       m_precompressStaticFields(false),
+                       m_compressionLevelIncreases(0),
+                       m_compressionLevelDecreases(0),
+                       m_async(false),
+                       m_closed(false),
+                       m_queuePolicy(QUEUE_DROP_NEWEST),
+                       m_protectedLevel(log4cplus::WARN_LOG_LEVEL),
+                       m_protectedReservePercent(DEFAULT_PROTECTED_RESERVE_PERCENT),
+                       m_workerCount(0),
+                       m_orderedWorkers(true),
+                       m_running(false),
+                       m_abandonQueue(false),
+                       m_flushRequests(0),
+                       m_flushedRequests(0),
+                       m_closeTimeoutMs(DEFAULT_CLOSE_TIMEOUT_MS),
+                       m_lostOnClose(0),
+                       m_blockedProducers(0),
+                       m_droppedEvents(0),
+                       m_failedEvents(0)
     {
+        for (size_t i = 0; i < LOG_LEVEL_COUNT; ++i)
+        {
+            m_droppedEventsByLevel[i].store(0, boost::memory_order_relaxed);
+        }
+
         // Try to get the host name
         try
         {
@@ -122,6 +239,52 @@ public:
         // Parse the includeLocationInformation property
         m_includeLocationInformation =
                 log4cplus::helpers::toLower(includeLocationInformation)[0] == 't';
+
+        // Get the compression property: none, zlib or gzip
+        tstring compression =
+                log4cplus::helpers::toLower(properties.getProperty("compression", "gzip"));
+
+        if (compression == "none")
+        {
+            m_compression = message::COMPRESSION_NONE;
+        }
+        else if (compression == "zlib")
+        {
+            m_compression = message::COMPRESSION_ZLIB;
+        }
+
+        // Get the size below which messages are not compressed
+        m_compressionMinBytes = lexical_cast<size_t>(
+                properties.getProperty("compression.minBytes",
+                                       lexical_cast<tstring>(DEFAULT_COMPRESSION_MIN_BYTES)));
+
+        // Get the compression level, 0 (none) to 9 (best) or -1 for zlib's default
+        compressionLevel(lexical_cast<int>(
+                properties.getProperty("compression.level",
+                                       lexical_cast<tstring>(message::DEFAULT_COMPRESSION_LEVEL))));
+
+        // Get the adaptive compression properties, which only apply in async mode
+        tstring adaptive = properties.getProperty("compression.adaptive", "false");
+
+        if (log4cplus::helpers::toLower(adaptive)[0] == 't')
+        {
+            m_levelController.reset(new CompressionLevelController(
+                    lexical_cast<int>(properties.getProperty("compression.minLevel",
+                                                             lexical_cast<tstring>(DEFAULT_ADAPTIVE_MIN_LEVEL))),
+                    lexical_cast<int>(properties.getProperty("compression.maxLevel",
+                                                             lexical_cast<tstring>(DEFAULT_ADAPTIVE_MAX_LEVEL))),
+                    lexical_cast<int>(properties.getProperty("compression.cpuBudget",
+                                                             lexical_cast<tstring>(DEFAULT_CPU_BUDGET_PERCENT))),
+                    lexical_cast<long>(properties.getProperty("compression.adaptInterval",
+                                                              lexical_cast<tstring>(DEFAULT_ADAPT_INTERVAL_MS)))));
+
+            // Start from the configured level, with zlib's default being 6
+            int level = m_compressionLevel.load();
+            level = level < 0 ? 6 : level;
+
+            m_compressionLevel = std::max(m_levelController->minLevel(),
+                                          std::min(level, m_levelController->maxLevel()));
+        }
  
         // Get the subset of additional field properties
         Properties additionalFields = properties.getPropertySubset("additionalField.");
@@ -135,6 +298,109 @@ public:
             // Add an additional field
             additionalField(propertyName, additionalFields.getProperty(propertyName));
         }
+
+        // Get the property to deflate the static fields once instead of per message
+        tstring staticPrefix = properties.getProperty("compression.staticPrefix", "false");
+
+        m_precompressStaticFields = log4cplus::helpers::toLower(staticPrefix)[0] == 't';
+
+        // Encode the fields that are the same for every message
+        rebuildStaticFields();
+
+        // Get the longest time close() spends sending what is left
+        m_closeTimeoutMs = lexical_cast<long>(
+                properties.getProperty("closeTimeout",
+                                       lexical_cast<tstring>(DEFAULT_CLOSE_TIMEOUT_MS)));
+
+        // Get the async property
+        tstring async = properties.getProperty("async", "false");
+
+        // Get the size of the async queue
+        size_t queueSize = lexical_cast<size_t>(
+                properties.getProperty("async.queueSize",
+                                       lexical_cast<tstring>(DEFAULT_QUEUE_SIZE)));
+
+        // Get the property to give each logging thread its own queue
+        tstring sharded = properties.getProperty("async.sharded", "false");
+
+        bool isSharded = log4cplus::helpers::toLower(sharded)[0] == 't';
+
+        // A sharded queue holds async.shardSize events per thread
+        if (isSharded)
+        {
+            queueSize = lexical_cast<size_t>(
+                    properties.getProperty("async.shardSize",
+                                           lexical_cast<tstring>(DEFAULT_SHARD_SIZE)));
+        }
+
+        // Get the number of threads that build and compress messages, 0 for none
+        m_workerCount = lexical_cast<size_t>(properties.getProperty("async.workers", "0"));
+
+        // Get the property to send messages in queue order when using workers
+        tstring ordered = properties.getProperty("async.ordered", "true");
+
+        m_orderedWorkers = log4cplus::helpers::toLower(ordered)[0] == 't';
+
+        // Get how the sender waits for events: spin, yield, park or hybrid
+        tstring waitStrategy =
+                log4cplus::helpers::toLower(properties.getProperty("async.waitStrategy", "park"));
+        unsigned spinBudget = lexical_cast<unsigned>(
+                properties.getProperty("async.spinBudget",
+                                       lexical_cast<tstring>(DEFAULT_SPIN_BUDGET)));
+
+        if (waitStrategy == "spin")
+        {
+            m_waiter.strategy(WAIT_SPIN, spinBudget);
+        }
+        else if (waitStrategy == "yield")
+        {
+            m_waiter.strategy(WAIT_YIELD, spinBudget);
+        }
+        else if (waitStrategy == "hybrid")
+        {
+            m_waiter.strategy(WAIT_HYBRID, spinBudget);
+        }
+        else
+        {
+            m_waiter.strategy(WAIT_PARK, spinBudget);
+        }
+
+        // Get the policy for a full queue: block, drop_newest, drop_oldest or drop_below_level
+        tstring policy =
+                log4cplus::helpers::toLower(properties.getProperty("async.policy", "drop_newest"));
+
+        if (policy == "block")
+        {
+            m_queuePolicy = QUEUE_BLOCK;
+        }
+        else if (policy == "drop_oldest")
+        {
+            m_queuePolicy = QUEUE_DROP_OLDEST;
+        }
+        else if (policy == "drop_below_level")
+        {
+            m_queuePolicy = QUEUE_DROP_BELOW_LEVEL;
+        }
+
+        // Get the lowest level that drop_below_level protects
+        log4cplus::LogLevel protectedLevel = log4cplus::getLogLevelManager().fromString(
+                log4cplus::helpers::toUpper(properties.getProperty("async.protectedLevel", "WARN")));
+
+        if (protectedLevel != log4cplus::NOT_SET_LOG_LEVEL)
+        {
+            m_protectedLevel = protectedLevel;
+        }
+
+        // Get the share of the queue only protected levels may fill
+        protectedReservePercent(lexical_cast<int>(
+                properties.getProperty("async.protectedReserve",
+                                       lexical_cast<tstring>(DEFAULT_PROTECTED_RESERVE_PERCENT))));
+
+        // Parse the async property and start the sender if requested
+        if (log4cplus::helpers::toLower(async)[0] == 't')
+        {
+            this->async(queueSize, isSharded);
+        }
     }
 
     /**
@@ -179,6 +445,8 @@ public:
             // ...make sure we have exactly a key and value
             if (keyValue.size() != 2)
             {
+                rebuildStaticFields();
+
                 return false;
             }
 
@@ -190,6 +458,8 @@ public:
             m_additionalFields[keyValue[0]] = keyValue[1];
         }
 
+        rebuildStaticFields();
+
         return true;
     }
 
@@ -199,6 +469,8 @@ public:
     virtual void clearAdditionalFields()
     {
         m_additionalFields.clear();
+
+        rebuildStaticFields();
     }
 
     /**
@@ -209,6 +481,8 @@ public:
     virtual void additionalField(const string &aKey, const string &aValue)
     {
         m_additionalFields[aKey] = aValue;
+
+        rebuildStaticFields();
     }
 
     /**
@@ -230,123 +504,1425 @@ public:
     }
 
     /**
-     * Closes this appender.
+     * Gets how messages are compressed.
+     * @return The compression framing.
      */
-    virtual void close()
+    virtual message::Compression compression() const
     {
-        m_transport.reset();
+        return m_compression;
     }
 
     /**
-     * Sets the transport to a new transport.
-     * @param aValue The new transport value.
+     * Sets how messages are compressed.
+     * @param aValue The compression framing.
      */
-    virtual void transport(ITransport *aValue)
+    virtual void compression(const message::Compression &aValue)
     {
-        // Close the existing transport
-        close();
+        m_compression = aValue;
+    }
 
-        // Set the new transport
-        m_transport.reset(aValue);
+    /**
+     * Gets the size below which messages are sent uncompressed.
+     * @return The size in bytes.
+     */
+    virtual size_t compressionMinBytes() const
+    {
+        return m_compressionMinBytes;
     }
 
     /**
-     * Is this instance valid?
-     * @return True if valid, false if not.
+     * Sets the size below which messages are sent uncompressed. For small
+     * messages deflate costs more CPU than the bytes it saves are worth.
+     * @param aValue The size in bytes.
      */
-    virtual bool isValid() const
+    virtual void compressionMinBytes(const size_t &aValue)
     {
-        return m_transport != 0;
+        m_compressionMinBytes = aValue;
     }
 
-protected:
+    /**
+     * Gets the zlib compression level. With adaptive compression this is the
+     * level the sender thread is using now.
+     * @return The compression level.
+     */
+    virtual int compressionLevel() const
+    {
+        return m_compressionLevel.load(boost::memory_order_relaxed);
+    }
 
-    // Attributes
+    /**
+     * Sets the zlib compression level. With adaptive compression the sender
+     * thread carries on adjusting from here.
+     * @param aValue 0 (send uncompressed) to 9 (best), or -1 for zlib's
+     * default. Other values select the default.
+     */
+    virtual void compressionLevel(const int &aValue)
+    {
+        m_compressionLevel = (aValue >= 0 && aValue <= 9) ? aValue : message::DEFAULT_COMPRESSION_LEVEL;
+    }
 
-    boost::shared_ptr<ITransport> m_transport; ///< Shared pointer to transport.
-    string m_loggingHostName; ///< Name of this host.
-    string m_facility; ///< Facility for this appender.
-    bool m_includeLocationInformation; ///< Should we include file and line?
-    Dictionary m_additionalFields; ///< Dictionary of additional fields.
+    /**
+     * Are the static fields deflated once and reused by every message?
+     * @return True if the static fields are pre-compressed.
+     */
+    virtual bool precompressStaticFields() const
+    {
+        return m_precompressStaticFields;
+    }
 
-    // Methods
+    /**
+     * Sets whether the static fields are deflated once and reused by every
+     * message, so only the rest of each message has to be compressed. The
+     * messages are still single gzip or zlib streams.
+     * @param aValue True to pre-compress the static fields.
+     */
+    virtual void precompressStaticFields(const bool &aValue)
+    {
+        m_precompressStaticFields = aValue;
+
+        rebuildStaticFields();
+    }
 
     /**
-     * The overridden method for appending.
-     * @param anEvent The logging event to append.
+     * Does the sender thread adjust the compression level to its load?
+     * @return True if adaptive compression is on.
      */
-    virtual void append(const log4cplus::spi::InternalLoggingEvent &anEvent)
+    virtual bool adaptiveCompression() const
     {
-        // Can't append if not valid
-        if (!isValid())
+        return m_levelController.get() != NULL;
+    }
+
+    /**
+     * Gets the number of times adaptive compression raised the level.
+     * @return The number of increases.
+     */
+    virtual uint64_t compressionLevelIncreases() const
+    {
+        return m_compressionLevelIncreases.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of times adaptive compression lowered the level.
+     * @return The number of decreases.
+     */
+    virtual uint64_t compressionLevelDecreases() const
+    {
+        return m_compressionLevelDecreases.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Is this appender sending from a background thread?
+     * @return True if in async mode, false if not.
+     */
+    virtual bool async() const
+    {
+        return m_async;
+    }
+
+    /**
+     * Switches this appender to async mode and starts the sender thread.
+     * Does nothing if already in async mode.
+     * @param aQueueSize The number of events that can be queued, per thread
+     * if the queue is sharded.
+     * @param aSharded True to give each logging thread its own queue.
+     */
+    virtual void async(const size_t &aQueueSize, const bool &aSharded = false)
+    {
+        if (m_async)
         {
             return;
         }
 
-        // Get the compressed JSON
-        string gelfJsonString;
-        createGelfJsonFromLoggingEvent(anEvent, gelfJsonString);
+        m_queue.reset(new ShardedEventQueue(aQueueSize, aSharded));
+        m_async = true;
 
-        // Send the message using the transport
-        m_transport->send(gelfJsonString);
+        startSender();
     }
 
     /**
-     * Creates the JSON String for a given logging event.
-     * The short message of the GELF message is a maximum of 250 chars long.
-     * Message building and skipping of additional fields etc is based on
-     * https://github.com/Graylog2/graylog2-docs/wiki/GELF from May 21, 2012.
-     * @param anEvent The logging event to base the JSON creation on.
-     * @param anEvent GELF message as compressed JSON.
+     * Gets the number of threads that build and compress messages for the
+     * sender thread.
+     * @return The number of workers, 0 if the sender thread does it itself.
      */
-    virtual void createGelfJsonFromLoggingEvent(const log4cplus::spi::InternalLoggingEvent &anEvent,
-                                                string &aGelfJsonString) const
+    virtual size_t workers() const
     {
-        // Get the full message
-        tstring fullMessage = anEvent.getMessage();
+        return m_workerCount;
+    }
 
-        const log4cplus::helpers::Time &time = anEvent.getTimestamp();
+    /**
+     * Are messages built by workers still sent in queue order?
+     * @return True if ordered.
+     */
+    virtual bool orderedWorkers() const
+    {
+        return m_orderedWorkers;
+    }
 
-        // Create the basic GELF message
-        message::GelfMessage gelfMessage(fullMessage.substr(0, message::SHORT_MESSAGE_LENGTH - 1),
-                                         m_loggingHostName,
-                                         time.sec() + (time.usec() / 1000000.0),
-                                         fullMessage,
-                                         SYSLOG_LEVEL.getSysLogLevel(anEvent.getLogLevel()),
-                                         m_facility.empty() ? anEvent.getLoggerName() : m_facility);
+    /**
+     * Sets the number of threads that build and compress messages for the
+     * sender thread. Takes effect when the sender thread next starts.
+     * @param aCount The number of workers, 0 to let the sender do it.
+     * @param anOrdered True to send messages in queue order, which keeps the
+     * events of each thread in order; false to send each batch as soon as it
+     * is built.
+     */
+    virtual void workers(const size_t &aCount, const bool &anOrdered = true)
+    {
+        m_workerCount = aCount;
+        m_orderedWorkers = anOrdered;
+    }
 
-        // Only include location information if configured
-        if (m_includeLocationInformation)
+    /**
+     * Appends an event without taking the mutex that doAppend() holds around
+     * append(). The threshold and filters are applied as doAppend() would.
+     * Only async mode can do this safely, so in sync mode it calls doAppend().
+     * The transport and the filters must not be changed while events are
+     * appended this way.
+     * @param anEvent The logging event to append.
+     */
+    virtual void appendLockFree(const log4cplus::spi::InternalLoggingEvent &anEvent)
+    {
+        if (!m_async || m_closed.load())
         {
-            gelfMessage.file(anEvent.getFile());
-            gelfMessage.line(anEvent.getLine());
+            doAppend(anEvent);
+
+            return;
         }
 
-        // Add additional fields
-        BOOST_FOREACH(Dictionary::value_type field, m_additionalFields)
+        if (!isAsSevereAsThreshold(anEvent.getLogLevel()) ||
+            log4cplus::spi::checkFilter(filter.get(), anEvent) == log4cplus::spi::DENY)
         {
-            gelfMessage[field.first] = field.second;
+            return;
         }
 
-        // Add the event type
-        gelfMessage["type"] = (int64_t) anEvent.getType();
+        append(anEvent);
+    }
 
-        // Add the thread
-        gelfMessage["thread"] = anEvent.getThread();
+    /**
+     * Gets how the sender thread waits for events.
+     * @return The wait strategy.
+     */
+    virtual WaitStrategy waitStrategy() const
+    {
+        return m_waiter.strategy();
+    }
 
-        // Add the logger name
-        gelfMessage["logger_name"] = anEvent.getLoggerName();
+    /**
+     * Sets how the sender thread waits for events. WAIT_SPIN gives the lowest
+     * latency but keeps a core busy, so it belongs on an isolated core;
+     * WAIT_PARK uses no CPU while idle; WAIT_YIELD and WAIT_HYBRID poll for the
+     * spin budget first and then yield or park.
+     * @param aStrategy The wait strategy.
+     * @param aSpinBudget How many times to poll before yielding or parking.
+     */
+    virtual void waitStrategy(const WaitStrategy &aStrategy,
+                              const unsigned &aSpinBudget = DEFAULT_SPIN_BUDGET)
+    {
+        m_waiter.strategy(aStrategy, aSpinBudget);
+    }
 
-        // Add NDC properties
-        tstring ndc = anEvent.getNDC();
+    /**
+     * Gets what an async append does when the queue is full.
+     * @return The queue policy.
+     */
+    virtual QueuePolicy queuePolicy() const
+    {
+        return m_queuePolicy;
+    }
 
-        if (!ndc.empty())
+    /**
+     * Sets what an async append does when the queue is full. QUEUE_BLOCK
+     * makes the logging thread wait for the sender, so it trades latency for
+     * completeness; the others never block.
+     * @param aValue The queue policy.
+     */
+    virtual void queuePolicy(const QueuePolicy &aValue)
+    {
+        m_queuePolicy = aValue;
+    }
+
+    /**
+     * Gets the lowest level QUEUE_DROP_BELOW_LEVEL protects.
+     * @return The protected level.
+     */
+    virtual log4cplus::LogLevel protectedLevel() const
+    {
+        return m_protectedLevel;
+    }
+
+    /**
+     * Sets the lowest level QUEUE_DROP_BELOW_LEVEL protects. Events below it
+     * are dropped once the queue is filled up to the protected reserve.
+     * @param aValue The protected level.
+     */
+    virtual void protectedLevel(const log4cplus::LogLevel &aValue)
+    {
+        m_protectedLevel = aValue;
+    }
+
+    /**
+     * Gets the share of the queue only protected levels may fill.
+     * @return The reserve in percent of the queue size.
+     */
+    virtual int protectedReservePercent() const
+    {
+        return m_protectedReservePercent;
+    }
+
+    /**
+     * Sets the share of the queue only protected levels may fill.
+     * @param aValue The reserve in percent of the queue size, clamped to 0-100.
+     */
+    virtual void protectedReservePercent(const int &aValue)
+    {
+        m_protectedReservePercent = std::max(0, std::min(aValue, 100));
+    }
+
+    /**
+     * Gets the number of events dropped because the async queue was full.
+     * @return The number of dropped events.
+     */
+    virtual uint64_t droppedEvents() const
+    {
+        return m_droppedEvents.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of events of one level dropped because the async queue
+     * was full. Levels between the standard ones count with the one below.
+     * @param aLevel The log level.
+     * @return The number of dropped events.
+     */
+    virtual uint64_t droppedEvents(const log4cplus::LogLevel &aLevel) const
+    {
+        return m_droppedEventsByLevel[levelIndex(aLevel)].load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of events the sender thread failed to build or send.
+     * @return The number of failed events.
+     */
+    virtual uint64_t failedEvents() const
+    {
+        return m_failedEvents.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the longest time close() spends sending what is left.
+     * @return The timeout in ms.
+     */
+    virtual long closeTimeout() const
+    {
+        return m_closeTimeoutMs;
+    }
+
+    /**
+     * Sets the longest time close() spends sending what is left.
+     * @param aValue The timeout in ms.
+     */
+    virtual void closeTimeout(const long &aValue)
+    {
+        m_closeTimeoutMs = aValue;
+    }
+
+    /**
+     * Gets the number of events the last close() gave up on, either still
+     * queued or still being sent by the transport when the timeout passed.
+     * @return The number of lost events.
+     */
+    virtual uint64_t lostOnClose() const
+    {
+        return m_lostOnClose.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Waits until every event appended before the call has been sent, or the
+     * timeout passes. In async mode this waits for the sender thread to empty
+     * the queue and flush the transport; in both modes it then waits for the
+     * transport's asynchronous sends to complete.
+     * @param aTimeoutMs The longest time to wait in ms.
+     * @return True if everything was sent, false if the timeout passed.
+     */
+    virtual bool flush(const long &aTimeoutMs)
+    {
+        boost::posix_time::ptime deadline =
+                boost::posix_time::microsec_clock::universal_time() +
+                boost::posix_time::milliseconds(aTimeoutMs);
+
+        if (m_senderThread)
         {
-            gelfMessage["ndc"] = ndc;
+            uint64_t request = m_flushRequests.fetch_add(1) + 1;
+
+            m_waiter.wake();
+
+            boost::unique_lock<boost::mutex> lock(m_flushMutex);
+
+            while (m_flushedRequests.load() < request)
+            {
+                if (!m_flushCondition.timed_wait(lock, deadline))
+                {
+                    return false;
+                }
+            }
         }
 
-        // Serialize the message
-        gelfMessage.serialize(aGelfJsonString);
+        return waitForTransport(deadline);
+    }
+
+    /**
+     * Closes this appender. Queued events and sends still in flight get up
+     * to the close timeout to go out; whatever is left after that is counted
+     * as lost, reported through LogLog, and can be read from lostOnClose().
+     */
+    virtual void close()
+    {
+        closed = true;
+        m_closed.store(true);
+
+        boost::posix_time::ptime deadline =
+                boost::posix_time::microsec_clock::universal_time() +
+                boost::posix_time::milliseconds(m_closeTimeoutMs);
+
+        m_lostOnClose.store(0);
+
+        // Stop the sender even without a transport, so it never outlives us
+        stopSender(deadline);
+
+        if (!m_transport)
+        {
+            return;
+        }
+
+        waitForTransport(deadline);
+
+        // Whatever the transport has not sent yet goes with it
+        m_lostOnClose.fetch_add(m_transport->pendingMessages());
+
+        if (m_lostOnClose.load() != 0)
+        {
+            log4cplus::helpers::getLogLog().warn(
+                    "Gelf4CPlusAppender: " + lexical_cast<tstring>(m_lostOnClose.load()) +
+                    " events were not sent before the close timeout");
+        }
+
+        m_transport.reset();
+    }
+
+    /**
+     * Sets the transport to a new transport.
+     * @param aValue The new transport value.
+     */
+    virtual void transport(ITransport *aValue)
+    {
+        // Close the existing transport
+        close();
+
+        // Set the new transport
+        m_transport.reset(aValue);
+        closed = false;
+        m_closed.store(false);
+
+        // Restart the sender for the new transport
+        if (m_async)
+        {
+            startSender();
+        }
+    }
+
+    /**
+     * Is this instance valid?
+     * @return True if valid, false if not.
+     */
+    virtual bool isValid() const
+    {
+        return m_transport != 0;
+    }
+
+protected:
+
+    // Attributes
+
+    boost::shared_ptr<ITransport> m_transport; ///< Shared pointer to transport.
+    string m_loggingHostName; ///< Name of this host.
+    string m_facility; ///< Facility for this appender.
+    bool m_includeLocationInformation; ///< Should we include file and line?
+    Dictionary m_additionalFields; ///< Dictionary of additional fields.
+    boost::shared_ptr<const StaticFields> m_staticFields; ///< Encoded static fields.
+    mutable boost::mutex m_staticFieldsMutex; ///< Guards m_staticFields.
+    message::Compression m_compression; ///< How messages are compressed.
+    size_t m_compressionMinBytes; ///< Smaller messages are sent plain.
+    boost::atomic<int> m_compressionLevel; ///< The zlib compression level.
+    bool m_precompressStaticFields; ///< Deflate the static fields once?
+    boost::scoped_ptr<CompressionLevelController> m_levelController; ///< Adapts the level, or null.
+    boost::atomic<uint64_t> m_compressionLevelIncreases; ///< Adaptive raises.
+    boost::atomic<uint64_t> m_compressionLevelDecreases; ///< Adaptive drops.
+    bool m_async; ///< Are messages sent from the sender thread?
+    boost::atomic<bool> m_closed; ///< Mirrors closed, which appendLockFree() reads without the mutex.
+    boost::scoped_ptr<ShardedEventQueue> m_queue; ///< Queue of events to send.
+    QueuePolicy m_queuePolicy; ///< What to do when the queue is full.
+    log4cplus::LogLevel m_protectedLevel; ///< Lowest level drop_below_level keeps.
+    int m_protectedReservePercent; ///< Queue share only protected levels fill.
+    boost::scoped_ptr<boost::thread> m_senderThread; ///< The sender thread.
+    size_t m_workerCount; ///< Threads that build messages, or 0.
+    bool m_orderedWorkers; ///< Send built messages in queue order?
+    boost::scoped_ptr<WorkerPool> m_workers; ///< Builds messages, or null.
+    boost::atomic<bool> m_running; ///< Should the sender thread keep going?
+    boost::atomic<bool> m_abandonQueue; ///< Has close() run out of time?
+    boost::atomic<uint64_t> m_flushRequests; ///< Calls to flush() so far.
+    boost::atomic<uint64_t> m_flushedRequests; ///< Calls the sender has caught up with.
+    boost::mutex m_flushMutex; ///< Mutex for m_flushCondition.
+    boost::condition_variable m_flushCondition; ///< Wakes flush() callers.
+    long m_closeTimeoutMs; ///< Longest close() spends sending.
+    boost::atomic<uint64_t> m_lostOnClose; ///< Events the last close() gave up on.
+    Waiter m_waiter; ///< Where the sender thread waits for events.
+    boost::atomic<int> m_blockedProducers; ///< Appends waiting for room.
+    boost::mutex m_roomMutex; ///< Mutex for m_roomCondition.
+    boost::condition_variable m_roomCondition; ///< Wakes blocked appends.
+    boost::atomic<uint64_t> m_droppedEvents; ///< Events lost to a full queue.
+    boost::atomic<uint64_t> m_droppedEventsByLevel[LOG_LEVEL_COUNT]; ///< The same by level.
+    boost::atomic<uint64_t> m_failedEvents; ///< Events that failed to send.
+    mutable string m_jsonString; ///< JSON buffer for synchronous appends.
+    transport::Buffer m_gelfBuffer; ///< Message buffer for synchronous appends.
+
+    // Methods
+
+    /**
+     * The overridden method for appending.
+     * @param anEvent The logging event to append.
+     */
+    virtual void append(const log4cplus::spi::InternalLoggingEvent &anEvent)
+    {
+        // Can't append if not valid
+        if (!isValid())
+        {
+            return;
+        }
+
+        // In async mode just hand the event to the sender thread
+        if (m_async)
+        {
+            if (enqueue(anEvent))
+            {
+                wakeSender();
+            }
+            else if (!overflow(anEvent))
+            {
+                countDroppedEvent(anEvent.getLogLevel());
+            }
+
+            return;
+        }
+
+        // Get the compressed JSON
+        // The transport may still hold the last message, so start a fresh one
+        // about as large
+        m_gelfBuffer.prepare(m_gelfBuffer.length());
+        createGelfJsonFromLoggingEvent(anEvent, m_gelfBuffer.bytes());
+
+        // Send the message using the transport, which may take the bytes
+        m_transport->send(m_gelfBuffer);
+
+        // A batching transport may send the message later on its own
+        if (m_transport->needsFlush())
+        {
+            m_transport->flush();
+        }
+    }
+
+    /**
+     * Queues an event for the sender thread according to the queue policy.
+     * @param anEvent The logging event to queue.
+     * @return False if the event itself was dropped.
+     */
+    bool enqueue(const log4cplus::spi::InternalLoggingEvent &anEvent)
+    {
+        EventQueue &queue = m_queue->local();
+
+        switch (m_queuePolicy)
+        {
+        case QUEUE_BLOCK:
+            return enqueueBlocking(queue, anEvent);
+
+        case QUEUE_DROP_OLDEST:
+            for (size_t i = 0; i < MAX_DROP_OLDEST_ATTEMPTS; ++i)
+            {
+                if (queue.tryPush(anEvent))
+                {
+                    return true;
+                }
+
+                log4cplus::LogLevel droppedLevel;
+
+                if (queue.tryDropOldest(droppedLevel))
+                {
+                    countDroppedEvent(droppedLevel);
+                }
+            }
+
+            // Other appends keep taking the room we make
+            return false;
+
+        case QUEUE_DROP_BELOW_LEVEL:
+            if (anEvent.getLogLevel() < m_protectedLevel &&
+                queue.size() * 100 >= queue.capacity() * (100 - m_protectedReservePercent))
+            {
+                return false;
+            }
+
+            return queue.tryPush(anEvent);
+
+        default:
+            return queue.tryPush(anEvent);
+        }
+    }
+
+    /**
+     * Hands an event that could not be queued to the transport, if it keeps
+     * such events, building the message on the calling thread.
+     * @param anEvent The logging event.
+     * @return False if the event is lost.
+     */
+    bool overflow(const log4cplus::spi::InternalLoggingEvent &anEvent)
+    {
+        boost::shared_ptr<ITransport> transport = m_transport;
+
+        if (!transport || !transport->acceptsOverflow())
+        {
+            return false;
+        }
+
+        try
+        {
+            string jsonString;
+            string gelfJsonString;
+
+            createGelfJson(anEvent, *staticFields(), jsonString, gelfJsonString);
+
+            return transport->overflow(gelfJsonString);
+        }
+        catch (...)
+        {
+            return false;
+        }
+    }
+
+    /**
+     * Queues an event, waiting for the sender thread to make room if the
+     * queue is full.
+     * @param aQueue The queue of the calling thread.
+     * @param anEvent The logging event to queue.
+     * @return False if the sender stopped before there was room.
+     */
+    bool enqueueBlocking(EventQueue &aQueue, const log4cplus::spi::InternalLoggingEvent &anEvent)
+    {
+        if (aQueue.tryPush(anEvent))
+        {
+            return true;
+        }
+
+        m_blockedProducers.fetch_add(1);
+
+        bool queued = false;
+
+        {
+            boost::unique_lock<boost::mutex> lock(m_roomMutex);
+
+            while (m_running.load())
+            {
+                // Make sure the sender is not asleep on a full queue
+                wakeSender();
+
+                if (aQueue.tryPush(anEvent))
+                {
+                    queued = true;
+
+                    break;
+                }
+
+                m_roomCondition.timed_wait(lock, boost::posix_time::milliseconds(BLOCKED_PRODUCER_WAIT_MS));
+            }
+        }
+
+        m_blockedProducers.fetch_sub(1);
+
+        return queued;
+    }
+
+    /**
+     * Wakes appends that are waiting for room in the queue.
+     */
+    void wakeBlockedProducers()
+    {
+        // Order the released slots before the check of the waiting count
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+        if (m_blockedProducers.load(boost::memory_order_relaxed) != 0)
+        {
+            boost::lock_guard<boost::mutex> lock(m_roomMutex);
+            m_roomCondition.notify_all();
+        }
+    }
+
+    /**
+     * Counts an event dropped because the queue was full.
+     * @param aLevel The level of the dropped event.
+     */
+    void countDroppedEvent(const log4cplus::LogLevel &aLevel)
+    {
+        m_droppedEvents.fetch_add(1, boost::memory_order_relaxed);
+        m_droppedEventsByLevel[levelIndex(aLevel)].fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Maps a log level to its drop counter, TRACE being 0 and FATAL 5.
+     * @param aLevel The log level.
+     * @return The index of the counter.
+     */
+    static size_t levelIndex(const log4cplus::LogLevel &aLevel)
+    {
+        if (aLevel < log4cplus::DEBUG_LOG_LEVEL)
+        {
+            return 0;
+        }
+
+        return std::min((size_t) (aLevel / log4cplus::DEBUG_LOG_LEVEL), LOG_LEVEL_COUNT - 1);
+    }
+
+    /**
+     * Creates the JSON String for a given logging event.
+     * The short message of the GELF message is a maximum of 250 chars long.
+     * Message building and skipping of additional fields etc is based on
+     * https://github.com/Graylog2/graylog2-docs/wiki/GELF from May 21, 2012.
+     * @param anEvent The logging event to base the JSON creation on.
+     * @param anEvent GELF message as compressed JSON.
+     */
+    virtual void createGelfJsonFromLoggingEvent(const log4cplus::spi::InternalLoggingEvent &anEvent,
+                                                string &aGelfJsonString) const
+    {
+        createGelfJson(anEvent, *staticFields(), m_jsonString, aGelfJsonString);
+    }
+
+    /**
+     * Encodes the fields that are the same for every message: the version,
+     * host, facility if configured, and the additional fields. Called
+     * whenever one of them changes, so messages only have to copy the result.
+     *
+     * An additional field named like a standard field replaces it, and one
+     * named like a field added per message is replaced by it, as they were
+     * when messages were built with GelfMessage. No field is written twice.
+     */
+    virtual void rebuildStaticFields()
+    {
+        boost::shared_ptr<StaticFields> staticFields(new StaticFields());
+        message::GelfEncoder encoder(staticFields->json);
+
+        // Name the fields as sent; of two that end up with one name, the
+        // later one wins, as it did in a GelfMessage
+        std::map<string, string> fields;
+
+        BOOST_FOREACH(const Dictionary::value_type &field, m_additionalFields)
+        {
+            string key = message::GelfEncoder::makeKey(field.first);
+
+            if (!key.empty())
+            {
+                fields[key] = field.second;
+            }
+        }
+
+        encoder.field(message::VERSION, takeField(fields, message::VERSION, message::GELF_VERSION));
+        encoder.field(message::HOST, takeField(fields, message::HOST,
+                      m_loggingHostName.empty() ? message::UNKNOWN_HOST : m_loggingHostName));
+
+        // Without a configured facility the logger name is used per message
+        string facility = takeField(fields, message::FACILITY, m_facility);
+
+        if (!facility.empty())
+        {
+            encoder.field(message::FACILITY, facility);
+            staticFields->prefixFields |= PREFIX_FACILITY;
+        }
+
+        // Standard fields set per message, unless configured
+        const string *eventFields[] = {&message::SHORT_MESSAGE, &message::FULL_MESSAGE, &message::TIMESTAMP,
+                                       &message::LEVEL, &message::FILE, &message::LINE};
+        const unsigned int eventFieldBits[] = {PREFIX_SHORT_MESSAGE, PREFIX_FULL_MESSAGE, PREFIX_TIMESTAMP,
+                                               PREFIX_LEVEL, PREFIX_FILE, PREFIX_LINE};
+
+        for (size_t i = 0; i < sizeof(eventFields) / sizeof(eventFields[0]); ++i)
+        {
+            std::map<string, string>::iterator it = fields.find(*eventFields[i]);
+
+            if (it != fields.end())
+            {
+                encoder.field(it->first, it->second);
+                staticFields->prefixFields |= eventFieldBits[i];
+                fields.erase(it);
+            }
+        }
+
+        // Additional fields set per message win, but the NDC is only set
+        // for events that have one
+        fields.erase("_type");
+        fields.erase("_thread");
+        fields.erase("_logger_name");
+
+        std::map<string, string>::iterator ndc = fields.find("_ndc");
+
+        if (ndc != fields.end())
+        {
+            staticFields->hasNdc = true;
+            staticFields->ndc = ndc->second;
+            fields.erase(ndc);
+        }
+
+        for (std::map<string, string>::const_iterator it = fields.begin(); it != fields.end(); ++it)
+        {
+            encoder.field(it->first, it->second);
+        }
+
+        if (m_precompressStaticFields)
+        {
+            staticFields->compressed.reset(new message::CompressedPrefix(staticFields->json));
+        }
+
+        boost::lock_guard<boost::mutex> lock(m_staticFieldsMutex);
+        m_staticFields = staticFields;
+    }
+
+    /**
+     * Removes a field from a set of fields.
+     * @param aFields The fields.
+     * @param aKey The name of the field.
+     * @param aDefault The value if there is no such field.
+     * @return The value of the field.
+     */
+    static string takeField(std::map<string, string> &aFields, const string &aKey, const string &aDefault)
+    {
+        std::map<string, string>::iterator it = aFields.find(aKey);
+
+        if (it == aFields.end())
+        {
+            return aDefault;
+        }
+
+        string value = it->second;
+        aFields.erase(it);
+
+        return value;
+    }
+
+    /**
+     * Gets the encoded static fields.
+     * @return The static fields, which stay valid while the pointer is held.
+     */
+    boost::shared_ptr<const StaticFields> staticFields() const
+    {
+        boost::lock_guard<boost::mutex> lock(m_staticFieldsMutex);
+
+        return m_staticFields;
+    }
+
+    /**
+     * Creates the JSON String for a logging event or a captured copy of one,
+     * compressed if the compression policy and the transport allow it.
+     * @param anEvent The event to base the JSON creation on.
+     * @param aStaticFields The encoded static fields.
+     * @param aJsonString A buffer for the uncompressed JSON.
+     * @param aGelfJsonString GELF message as JSON, compressed or not.
+     */
+    template <typename Event>
+    void createGelfJson(const Event &anEvent,
+                        const StaticFields &aStaticFields,
+                        string &aJsonString,
+                        string &aGelfJsonString) const
+    {
+        int level = m_compressionLevel.load(boost::memory_order_relaxed);
+
+        if (m_compression == message::COMPRESSION_NONE || level == 0 ||
+            (m_transport && !m_transport->supportsCompression()))
+        {
+            encodeGelfJson(anEvent, aStaticFields, aGelfJsonString);
+
+            return;
+        }
+
+        encodeGelfJson(anEvent, aStaticFields, aJsonString);
+
+        // Small messages are sent as they are; copying keeps the pooled
+        // capacity in the pool
+        if (aJsonString.length() < m_compressionMinBytes)
+        {
+            aGelfJsonString.assign(aJsonString);
+
+            return;
+        }
+
+        if (aStaticFields.compressed)
+        {
+            aStaticFields.compressed->compress(m_compression, aJsonString, aGelfJsonString, level);
+        }
+        else
+        {
+            message::Compressor::compress(m_compression, aJsonString, aGelfJsonString, level);
+        }
+    }
+
+    /**
+     * Writes the uncompressed GELF JSON for a logging event or a captured copy
+     * of one.
+     * @param anEvent The event to base the JSON creation on.
+     * @param aStaticFields The encoded static fields.
+     * @param aJsonString The JSON output, reused between calls.
+     */
+    template <typename Event>
+    void encodeGelfJson(const Event &anEvent,
+                        const StaticFields &aStaticFields,
+                        string &aJsonString) const
+    {
+        // Start with a copy of the fields that never change
+        message::GelfEncoder encoder(aJsonString, aStaticFields.json);
+        unsigned int prefixFields = aStaticFields.prefixFields;
+
+        // Add the basic GELF fields the static fields do not replace
+        const tstring &fullMessage = anEvent.getMessage();
+
+        if ((prefixFields & (PREFIX_SHORT_MESSAGE | PREFIX_FULL_MESSAGE)) == 0 && !fullMessage.empty())
+        {
+            encoder.messageFields(message::SHORT_MESSAGE, message::SHORT_MESSAGE_LENGTH - 1,
+                                  message::FULL_MESSAGE, fullMessage);
+        }
+        else
+        {
+            if ((prefixFields & PREFIX_SHORT_MESSAGE) == 0 && fullMessage.empty())
+            {
+                encoder.field(message::SHORT_MESSAGE, message::DEFAULT_SHORT_MESSAGE);
+            }
+            else if ((prefixFields & PREFIX_SHORT_MESSAGE) == 0)
+            {
+                encoder.field(message::SHORT_MESSAGE, fullMessage.data(),
+                              std::min(fullMessage.length(), message::SHORT_MESSAGE_LENGTH - 1));
+            }
+
+            if ((prefixFields & PREFIX_FULL_MESSAGE) == 0 && !fullMessage.empty())
+            {
+                encoder.field(message::FULL_MESSAGE, fullMessage);
+            }
+        }
+
+        if ((prefixFields & PREFIX_TIMESTAMP) == 0)
+        {
+            const log4cplus::helpers::Time &time = anEvent.getTimestamp();
+            encoder.timestamp(message::TIMESTAMP, time.sec(), time.usec());
+        }
+
+        // The level must be between 0 and 7 inclusive according to syslog
+        int level = SYSLOG_LEVEL.getSysLogLevel(anEvent.getLogLevel());
+
+        if ((prefixFields & PREFIX_LEVEL) == 0 && level >= 0 && level <= 7)
+        {
+            encoder.field(message::LEVEL, (int64_t) level);
+        }
+
+        if ((prefixFields & PREFIX_FACILITY) == 0)
+        {
+            encoder.field(message::FACILITY, anEvent.getLoggerName());
+        }
+
+        // Only include location information if configured
+        if (m_includeLocationInformation)
+        {
+            if ((prefixFields & PREFIX_FILE) == 0 && !anEvent.getFile().empty())
+            {
+                encoder.field(message::FILE, anEvent.getFile());
+            }
+
+            if ((prefixFields & PREFIX_LINE) == 0 && anEvent.getLine() >= 0)
+            {
+                encoder.field(message::LINE, (int64_t) anEvent.getLine());
+            }
+        }
+
+        // Add the event type
+        encoder.additionalField("type", (int64_t) anEvent.getType());
+
+        // Add the thread
+        encoder.additionalField("thread", anEvent.getThread());
+
+        // Add the logger name
+        encoder.additionalField("logger_name", anEvent.getLoggerName());
+
+        // Add NDC properties
+        const tstring &ndc = anEvent.getNDC();
+
+        if (!ndc.empty())
+        {
+            encoder.additionalField("ndc", ndc);
+        }
+        else if (aStaticFields.hasNdc)
+        {
+            encoder.additionalField("ndc", aStaticFields.ndc);
+        }
+
+        encoder.finish();
+    }
+
+    /**
+     * Starts the sender thread if it is not running.
+     */
+    virtual void startSender()
+    {
+        if (m_senderThread)
+        {
+            return;
+        }
+
+        if (m_workerCount != 0)
+        {
+            m_workers.reset(new WorkerPool(m_workerCount, m_orderedWorkers, SENDER_BATCH_SIZE,
+                                           boost::bind(&Gelf4CPlusAppender::buildJob, this, _1, _2),
+                                           boost::bind(&Gelf4CPlusAppender::sendJob, this, _1),
+                                           boost::bind(&Gelf4CPlusAppender::flushJobs, this)));
+        }
+
+        m_running.store(true);
+        m_senderThread.reset(new boost::thread(boost::bind(&Gelf4CPlusAppender::senderLoop, this)));
+    }
+
+    /**
+     * Stops the sender thread after it has sent all queued events, or has
+     * given up on them at the deadline.
+     * @param aDeadline When to give up on the queued events.
+     */
+    virtual void stopSender(const boost::posix_time::ptime &aDeadline = boost::posix_time::pos_infin)
+    {
+        if (!m_senderThread)
+        {
+            return;
+        }
+
+        m_running.store(false);
+        m_waiter.wake();
+
+        // Blocked appends give up once the sender has stopped
+        {
+            boost::lock_guard<boost::mutex> lock(m_roomMutex);
+            m_roomCondition.notify_all();
+        }
+
+        if (!m_senderThread->timed_join(aDeadline))
+        {
+            // Out of time; the sender finishes its batch and counts the rest
+            m_abandonQueue.store(true);
+            m_waiter.wake();
+
+            m_senderThread->join();
+        }
+
+        m_senderThread.reset();
+        m_abandonQueue.store(false);
+
+        // The sender has already waited for the workers to finish
+        m_workers.reset();
+    }
+
+    /**
+     * Wakes the sender thread if it is parked waiting for events.
+     */
+    void wakeSender()
+    {
+        m_waiter.notify();
+    }
+
+    /**
+     * The body of the sender thread. Sends queued events until stopped and
+     * then sends whatever is left in the queue.
+     */
+    virtual void senderLoop()
+    {
+        string jsonString;
+        std::vector<transport::Buffer> batch(SENDER_BATCH_SIZE);
+        boost::shared_ptr<const StaticFields> staticFields;
+
+        for (;;)
+        {
+            // Read the flags first so nothing queued before a stop or a flush
+            // is missed
+            bool running = m_running.load();
+            uint64_t flushRequests = m_flushRequests.load();
+
+            if (m_abandonQueue.load())
+            {
+                discardQueuedEvents();
+
+                break;
+            }
+
+            size_t count;
+
+            if (m_workers)
+            {
+                count = dispatchQueuedEvents();
+            }
+            else
+            {
+                staticFields = this->staticFields();
+                count = sendQueuedEvents(*staticFields, jsonString, batch);
+            }
+
+            if (count == 0)
+            {
+                // The workers send on their own; wait for them only when
+                // asked to flush or stop
+                if (m_workers && (!running || flushRequests != m_flushedRequests.load()))
+                {
+                    m_workers->drain();
+                }
+
+                // Everything queued before the flush requests has been sent
+                acknowledgeFlush(flushRequests);
+
+                if (!running)
+                {
+                    break;
+                }
+
+                waitForEvents();
+            }
+        }
+    }
+
+    /**
+     * Tells flush() callers that the sender has caught up with their request.
+     * @param aFlushRequests The number of requests read before the queue was
+     * found empty.
+     */
+    void acknowledgeFlush(const uint64_t &aFlushRequests)
+    {
+        if (m_flushedRequests.load() == aFlushRequests)
+        {
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(m_flushMutex);
+        m_flushedRequests.store(aFlushRequests);
+        m_flushCondition.notify_all();
+    }
+
+    /**
+     * Takes the events close() gave up on off the queue and counts them as
+     * dropped and lost. Stops after one queue's worth so that threads still
+     * logging can't keep the sender going.
+     */
+    void discardQueuedEvents()
+    {
+        size_t limit = m_queue->capacity();
+
+        for (size_t i = 0; i < limit; ++i)
+        {
+            const CapturedEvent *event = m_queue->claim();
+
+            if (event == NULL)
+            {
+                break;
+            }
+
+            countDroppedEvent(event->getLogLevel());
+            m_lostOnClose.fetch_add(1, boost::memory_order_relaxed);
+
+            m_queue->pop();
+        }
+    }
+
+    /**
+     * Waits for the transport's asynchronous sends to complete.
+     * @param aDeadline When to stop waiting.
+     * @return True if nothing is pending, false if the deadline passed.
+     */
+    bool waitForTransport(const boost::posix_time::ptime &aDeadline) const
+    {
+        boost::shared_ptr<ITransport> transport = m_transport;
+
+        if (!transport)
+        {
+            return true;
+        }
+
+        while (transport->pendingMessages() != 0)
+        {
+            if (boost::posix_time::microsec_clock::universal_time() >= aDeadline)
+            {
+                return false;
+            }
+
+            boost::this_thread::sleep(boost::posix_time::milliseconds(TRANSPORT_DRAIN_POLL_MS));
+        }
+
+        return true;
+    }
+
+    /**
+     * Builds every event in the queue and hands the messages to the transport
+     * a batch at a time, then flushes the transport so that it can send them
+     * all at once.
+     * @param aStaticFields The encoded static fields.
+     * @param aJsonString A buffer to reuse for the uncompressed JSON.
+     * @param aBatch Buffers to reuse for the GELF messages.
+     * @return The number of events taken off the queue.
+     */
+    virtual size_t sendQueuedEvents(const StaticFields &aStaticFields,
+                                    string &aJsonString,
+                                    std::vector<transport::Buffer> &aBatch)
+    {
+        size_t count = 0;
+        size_t built = 0;
+
+        while (const CapturedEvent *event = m_queue->claim())
+        {
+            try
+            {
+                // The transport may still hold the last message, so start a fresh one
+                // about as large
+                aBatch[built].prepare(aBatch[built].length());
+                createGelfJson(*event, aStaticFields, aJsonString, aBatch[built].bytes());
+                ++built;
+            }
+            catch (...)
+            {
+                // The sender thread must survive a bad event
+                m_failedEvents.fetch_add(1, boost::memory_order_relaxed);
+            }
+
+            m_queue->pop();
+            ++count;
+
+            // close() has run out of time; leave the rest to be discarded
+            if (m_abandonQueue.load(boost::memory_order_relaxed))
+            {
+                break;
+            }
+
+            if (built == aBatch.size())
+            {
+                sendBatch(aBatch, built);
+                built = 0;
+
+                adaptCompressionLevel();
+                wakeBlockedProducers();
+            }
+        }
+
+        sendBatch(aBatch, built);
+        adaptCompressionLevel();
+        wakeBlockedProducers();
+
+        if (count != 0)
+        {
+            try
+            {
+                m_transport->flush();
+            }
+            catch (...)
+            {
+            }
+        }
+
+        return count;
+    }
+
+    /**
+     * Moves every event in the queue into jobs for the workers, which send
+     * them and flush the transport without the sender thread waiting.
+     * @return The number of events taken off the queue.
+     */
+    virtual size_t dispatchQueuedEvents()
+    {
+        size_t count = 0;
+        SenderJob *job = NULL;
+
+        while (CapturedEvent *event = m_queue->claim())
+        {
+            if (job == NULL)
+            {
+                job = m_workers->acquire();
+            }
+
+            // Take the event's strings and leave the slot the job's old ones
+            job->events[job->count++].swap(*event);
+
+            m_queue->pop();
+            ++count;
+
+            // close() has run out of time; leave the rest to be discarded
+            if (m_abandonQueue.load(boost::memory_order_relaxed))
+            {
+                break;
+            }
+
+            if (job->count == job->events.size())
+            {
+                m_workers->submit(job);
+                job = NULL;
+
+                adaptCompressionLevel();
+                wakeBlockedProducers();
+            }
+        }
+
+        if (job != NULL)
+        {
+            m_workers->submit(job);
+        }
+
+        if (count != 0)
+        {
+            adaptCompressionLevel();
+            wakeBlockedProducers();
+        }
+
+        return count;
+    }
+
+    /**
+     * Builds the messages of a job. Called on a worker thread.
+     * @param aJob The job.
+     * @param aJsonString A buffer to reuse for the uncompressed JSON.
+     */
+    void buildJob(SenderJob &aJob, string &aJsonString)
+    {
+        boost::shared_ptr<const StaticFields> staticFields = this->staticFields();
+
+        for (size_t i = 0; i < aJob.count; ++i)
+        {
+            try
+            {
+                // The transport may still hold the last message, so start a fresh one
+                // about as large
+                aJob.messages[aJob.built].prepare(aJob.messages[aJob.built].length());
+                createGelfJson(aJob.events[i], *staticFields, aJsonString, aJob.messages[aJob.built].bytes());
+
+                // Keep the events of the built messages at the same indexes
+                if (i != aJob.built)
+                {
+                    aJob.events[aJob.built].swap(aJob.events[i]);
+                }
+
+                ++aJob.built;
+            }
+            catch (...)
+            {
+                // The worker must survive a bad event
+                m_failedEvents.fetch_add(1, boost::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Sends the messages of a job. Called on a worker thread, one at a time.
+     * @param aJob The job.
+     */
+    void sendJob(SenderJob &aJob)
+    {
+        // close() has run out of time
+        if (m_abandonQueue.load(boost::memory_order_relaxed))
+        {
+            for (size_t i = 0; i < aJob.built; ++i)
+            {
+                countDroppedEvent(aJob.events[i].getLogLevel());
+            }
+
+            m_lostOnClose.fetch_add(aJob.built, boost::memory_order_relaxed);
+
+            return;
+        }
+
+        sendBatch(aJob.messages, aJob.built);
+    }
+
+    /**
+     * Flushes the transport once the workers have sent every job. Called on a
+     * worker thread, never together with sendJob().
+     */
+    void flushJobs()
+    {
+        m_transport->flush();
+    }
+
+    /**
+     * Hands built messages to the transport, which may take their bytes.
+     * @param aBatch The messages.
+     * @param aCount The number of messages to send.
+     */
+    void sendBatch(std::vector<transport::Buffer> &aBatch, const size_t &aCount)
+    {
+        if (aCount == 0)
+        {
+            return;
+        }
+
+        try
+        {
+            m_transport->sendBatch(&aBatch[0], aCount);
+        }
+        catch (...)
+        {
+            // The sender thread must survive a failed send
+            m_failedEvents.fetch_add(aCount, boost::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Lets the controller adjust the compression level to the backlog and the
+     * CPU time of the threads that compress: the workers if there are any,
+     * otherwise the sender thread. Does nothing without adaptive compression.
+     */
+    void adaptCompressionLevel()
+    {
+        if (!m_levelController)
+        {
+            return;
+        }
+
+        // zlib's default level is 6
+        int level = m_compressionLevel.load(boost::memory_order_relaxed);
+        level = level < 0 ? 6 : level;
+
+        double backlog = (double) m_queue->size() / (double) m_queue->capacity();
+        int newLevel = m_workers ?
+                m_levelController->update(level, backlog, m_workers->cpuMicroseconds(), m_workers->workers()) :
+                m_levelController->update(level, backlog);
+
+        if (newLevel > level)
+        {
+            m_compressionLevelIncreases.fetch_add(1, boost::memory_order_relaxed);
+        }
+        else if (newLevel < level)
+        {
+            m_compressionLevelDecreases.fetch_add(1, boost::memory_order_relaxed);
+        }
+
+        m_compressionLevel.store(newLevel, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Waits, as the wait strategy says, until an event is queued, the sender
+     * is stopped, or a parked sender has slept for SENDER_IDLE_WAIT_MS.
+     */
+    void waitForEvents()
+    {
+        m_waiter.wait(boost::bind(&Gelf4CPlusAppender::senderHasWork, this), SENDER_IDLE_WAIT_MS);
+    }
+
+    /**
+     * Does the sender thread have anything to do?
+     * @return True if an event is queued, the sender is being stopped or a
+     * flush() is waiting.
+     */
+    bool senderHasWork() const
+    {
+        return !m_queue->empty() || !m_running.load(boost::memory_order_relaxed) ||
+               m_flushRequests.load(boost::memory_order_relaxed) !=
+               m_flushedRequests.load(boost::memory_order_relaxed);
     }
 };
 
@@ -10,6 +10,12 @@
 
 /*- HEADER FILES -------------------------------------------------------------*/
 
+// System Header Files
+
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
 // Third-party Header Files
 
 #include <log4cplus/spi/appenderattachable.h>
@@ -20,6 +26,10 @@
 
 #include "Gelf4CPlusAppender.hpp"
 #include "UdpTransport.hpp"
+#include "TcpTransport.hpp"
+#include "SpoolingTransport.hpp"
+#include "MultiEndpointTransport.hpp"
+#include "HybridTransport.hpp"
 
 /*- NAMESPACES ---------------------------------------------------------------*/
 
@@ -51,9 +61,76 @@ public:
 
     log4cplus::SharedAppenderPtr createObject(const Properties &properties)
     {
-        // Currently unused
-        tstring transport = properties.getProperty("transport", "UDP");
+        // Get the transport type
+        tstring transport = log4cplus::helpers::toLower(
+                properties.getProperty("transport", "UDP"));
+
+        // Create and return the appender
+        return log4cplus::SharedAppenderPtr(
+                new gelf4cplus::appender::Gelf4CPlusAppender(
+                    createSpoolingTransport(createTransport(transport, properties), properties),
+                    properties));
+    }
+
+    tstring getTypeName()
+    {
+        return "log4cplus::Gelf4CPlusAppender";
+    }
+
+protected:
+
+    // Type Definitions
+
+    typedef std::vector< std::pair<tstring, int> > Endpoints; ///< Hosts and ports.
+
+    // Methods
+
+    /**
+     * Creates the transport named by the "transport" property.
+     * @param aType The transport type: "udp", "tcp" or "hybrid".
+     * @param properties The appender properties.
+     * @return A new transport.
+     */
+    virtual transport::ITransport* createTransport(const tstring &aType, const Properties &properties)
+    {
+        if (aType == "tcp")
+        {
+            return createTcpTransport(properties);
+        }
+
+        if (aType == "hybrid")
+        {
+            return createHybridTransport(properties);
+        }
+
+        return createUdpTransport(properties);
+    }
+
+    /**
+     * Creates a transport that sends over UDP from the "udp." properties, and
+     * messages too large for UDP over TCP from the "tcp." properties.
+     * @param properties The appender properties.
+     * @return A new hybrid transport.
+     */
+    virtual transport::ITransport* createHybridTransport(const Properties &properties)
+    {
+        // Get the size above which messages go over TCP, 0 for what UDP can't carry
+        size_t threshold = lexical_cast<size_t>(
+                properties.getPropertySubset("hybrid.").getProperty(
+                    "threshold", lexical_cast<std::string>(transport::HYBRID_UDP_LIMIT)));
 
+        return new transport::HybridTransport(createUdpTransport(properties),
+                                              createTcpTransport(properties),
+                                              threshold);
+    }
+
+    /**
+     * Creates a UDP transport from the "udp." properties.
+     * @param properties The appender properties.
+     * @return A new UDP transport.
+     */
+    virtual transport::ITransport* createUdpTransport(const Properties &properties)
+    {
         // Get the subset of UDP properties
         Properties udpProperties = properties.getPropertySubset("udp.");
 
@@ -65,14 +142,238 @@ public:
         int port = lexical_cast<int>(
                 udpProperties.getProperty("port", lexical_cast<std::string>(transport::DEFAULT_GRAYLOG2_PORT)));
 
-        // Create and return the appender
-        return log4cplus::SharedAppenderPtr(
-                new gelf4cplus::appender::Gelf4CPlusAppender(new transport::UdpTransport(host, port), properties));
+        // Get the chunk payload size, or "auto" to follow the path MTU
+        tstring chunkSizeProperty = log4cplus::helpers::toLower(
+                udpProperties.getProperty("chunkSize", lexical_cast<std::string>(transport::DEFAULT_CHUNK_SIZE)));
+        uint16_t chunkSize = chunkSizeProperty == "auto" ?
+                transport::AUTO_CHUNK_SIZE : lexical_cast<uint16_t>(chunkSizeProperty);
+
+        // Get the time in ms between path MTU probes
+        long mtuProbeInterval = lexical_cast<long>(
+                udpProperties.getProperty("mtuProbeInterval", lexical_cast<std::string>(transport::DEFAULT_MTU_PROBE_INTERVAL_MS)));
+
+        // Get the number of datagrams to send at once
+        size_t batchSize = lexical_cast<size_t>(
+                udpProperties.getProperty("batchSize", lexical_cast<std::string>(transport::DEFAULT_UDP_BATCH_SIZE)));
+
+        // Get the longest time in ms a datagram may wait for its batch
+        long flushInterval = lexical_cast<long>(
+                udpProperties.getProperty("flushInterval", lexical_cast<std::string>(transport::DEFAULT_UDP_FLUSH_INTERVAL_MS)));
+
+        // Get the time in ms between resolutions of the host names
+        long dnsRefresh = lexical_cast<long>(
+                udpProperties.getProperty("dnsRefresh", lexical_cast<std::string>(transport::DEFAULT_DNS_REFRESH_MS)));
+
+        // Get the Graylog inputs to spread messages over, if more than one
+        Endpoints endpoints = parseEndpoints(udpProperties.getProperty("endpoints"), port);
+
+        if (endpoints.empty())
+        {
+            transport::UdpTransport *udpTransport =
+                    new transport::UdpTransport(host, port, chunkSize, batchSize, flushInterval, dnsRefresh);
+            udpTransport->mtuProbeInterval(mtuProbeInterval);
+
+            // Let refused datagrams show up as errors, so the spool notices
+            // that the destination is down
+            if (!properties.getProperty("spool.directory").empty())
+            {
+                udpTransport->connectSocket();
+            }
+
+            return udpTransport;
+        }
+
+        transport::MultiEndpointTransport::Transports transports;
+
+        for (size_t i = 0; i < endpoints.size(); ++i)
+        {
+            boost::shared_ptr<transport::UdpTransport> udpTransport(
+                    new transport::UdpTransport(endpoints[i].first, endpoints[i].second,
+                                                chunkSize, batchSize, flushInterval, dnsRefresh));
+            udpTransport->mtuProbeInterval(mtuProbeInterval);
+
+            // Let refused datagrams show up as errors, so the endpoint is ejected
+            udpTransport->connectSocket();
+            transports.push_back(udpTransport);
+        }
+
+        return new transport::MultiEndpointTransport(transports,
+                                                     parseBalancePolicy(udpProperties.getProperty("balance")));
     }
 
-    tstring getTypeName()
+    /**
+     * Creates a TCP transport from the "tcp." properties.
+     * @param properties The appender properties.
+     * @return A new TCP transport.
+     */
+    virtual transport::ITransport* createTcpTransport(const Properties &properties)
     {
-        return "log4cplus::Gelf4CPlusAppender";
+        // Get the subset of TCP properties
+        Properties tcpProperties = properties.getPropertySubset("tcp.");
+
+        // Get the TCP host
+        tstring host = tcpProperties.getProperty("host",
+                                                 transport::DEFAULT_GRAYLOG2_HOST);
+
+        // Get the TCP port
+        int port = lexical_cast<int>(
+                tcpProperties.getProperty("port", lexical_cast<std::string>(transport::DEFAULT_GRAYLOG2_PORT)));
+
+        // Get the number of frames to write at once
+        size_t batchSize = lexical_cast<size_t>(
+                tcpProperties.getProperty("batchSize", lexical_cast<std::string>(transport::DEFAULT_TCP_BATCH_SIZE)));
+
+        // Get the most bytes to buffer while disconnected
+        size_t maxPendingBytes = lexical_cast<size_t>(
+                tcpProperties.getProperty("maxPendingBytes", lexical_cast<std::string>(transport::DEFAULT_TCP_MAX_PENDING_BYTES)));
+
+        // Get the time in ms between resolutions of the host names
+        long dnsRefresh = lexical_cast<long>(
+                tcpProperties.getProperty("dnsRefresh", lexical_cast<std::string>(transport::DEFAULT_DNS_REFRESH_MS)));
+
+        // Get the longest times in ms a connect and a write may take
+        long connectTimeout = lexical_cast<long>(
+                tcpProperties.getProperty("connectTimeout", lexical_cast<std::string>(transport::DEFAULT_TCP_CONNECT_TIMEOUT_MS)));
+        long writeTimeout = lexical_cast<long>(
+                tcpProperties.getProperty("writeTimeout", lexical_cast<std::string>(transport::DEFAULT_TCP_WRITE_TIMEOUT_MS)));
+
+        // Get the Graylog inputs to spread messages over, if more than one
+        Endpoints endpoints = parseEndpoints(tcpProperties.getProperty("endpoints"), port);
+
+        if (endpoints.empty())
+        {
+            transport::TcpTransport *tcpTransport =
+                    new transport::TcpTransport(host, port, batchSize, maxPendingBytes, dnsRefresh);
+            tcpTransport->connectTimeout(connectTimeout);
+            tcpTransport->writeTimeout(writeTimeout);
+
+            return tcpTransport;
+        }
+
+        transport::MultiEndpointTransport::Transports transports;
+
+        for (size_t i = 0; i < endpoints.size(); ++i)
+        {
+            boost::shared_ptr<transport::TcpTransport> tcpTransport(
+                    new transport::TcpTransport(endpoints[i].first, endpoints[i].second,
+                                                batchSize, maxPendingBytes, dnsRefresh));
+            tcpTransport->connectTimeout(connectTimeout);
+            tcpTransport->writeTimeout(writeTimeout);
+            transports.push_back(tcpTransport);
+        }
+
+        return new transport::MultiEndpointTransport(transports,
+                                                     parseBalancePolicy(tcpProperties.getProperty("balance")));
+    }
+
+    /**
+     * Parses a comma-separated list of endpoints, each host or host:port.
+     * @param aList The list.
+     * @param aDefaultPort The port of endpoints that don't give one.
+     * @return The endpoints, or none if the list is empty.
+     */
+    static Endpoints parseEndpoints(const tstring &aList, const int &aDefaultPort)
+    {
+        Endpoints endpoints;
+        size_t begin = 0;
+
+        while (begin < aList.size())
+        {
+            size_t end = aList.find(',', begin);
+            end = end == tstring::npos ? aList.size() : end;
+
+            // Skip the blanks around the entry
+            size_t first = aList.find_first_not_of(" \t", begin);
+            size_t last = aList.find_last_not_of(" \t", end - 1);
+
+            if (first < end && last != tstring::npos && last >= first)
+            {
+                tstring endpoint = aList.substr(first, last - first + 1);
+                size_t colon = endpoint.rfind(':');
+
+                endpoints.push_back(std::make_pair(
+                        endpoint.substr(0, colon),
+                        colon == tstring::npos ? aDefaultPort : lexical_cast<int>(endpoint.substr(colon + 1))));
+            }
+
+            begin = end + 1;
+        }
+
+        return endpoints;
+    }
+
+    /**
+     * Parses a balance policy: failover, round_robin, least_outstanding or
+     * hash.
+     * @param aName The name of the policy.
+     * @return The policy, round-robin if the name is empty or unknown.
+     */
+    static transport::BalancePolicy parseBalancePolicy(const tstring &aName)
+    {
+        tstring name = log4cplus::helpers::toLower(aName);
+
+        if (name == "failover")
+        {
+            return transport::BALANCE_FAILOVER;
+        }
+        else if (name == "least_outstanding")
+        {
+            return transport::BALANCE_LEAST_OUTSTANDING;
+        }
+        else if (name == "hash")
+        {
+            return transport::BALANCE_HASH;
+        }
+
+        return transport::BALANCE_ROUND_ROBIN;
+    }
+
+    /**
+     * Wraps a transport in a disk spool if the "spool." properties name a
+     * spool directory.
+     * @param aTransport The transport to wrap.
+     * @param properties The appender properties.
+     * @return The spooling transport, or aTransport if no spool is configured.
+     */
+    virtual transport::ITransport* createSpoolingTransport(transport::ITransport *aTransport,
+                                                           const Properties &properties)
+    {
+        // Get the subset of spool properties
+        Properties spoolProperties = properties.getPropertySubset("spool.");
+
+        // Get the spool directory, without which there is no spool
+        tstring directory = spoolProperties.getProperty("directory");
+
+        if (directory.empty())
+        {
+            return aTransport;
+        }
+
+        // Get the size of each segment file
+        size_t segmentSize = lexical_cast<size_t>(
+                spoolProperties.getProperty("segmentSize", lexical_cast<std::string>(transport::DEFAULT_SPOOL_SEGMENT_SIZE)));
+
+        // Get the most bytes the spool may take up on disk
+        uint64_t budget = lexical_cast<uint64_t>(
+                spoolProperties.getProperty("budget", lexical_cast<std::string>(transport::DEFAULT_SPOOL_DISK_BUDGET)));
+
+        // Get the most spooled messages to replay per second
+        double replayRate = lexical_cast<double>(
+                spoolProperties.getProperty("replayRate", lexical_cast<std::string>(transport::DEFAULT_SPOOL_REPLAY_RATE)));
+
+        // Get the host and port to probe, as host:port
+        tstring healthCheck = spoolProperties.getProperty("healthCheck");
+        tstring healthCheckHost = healthCheck.substr(0, healthCheck.rfind(':'));
+        int healthCheckPort = healthCheck.rfind(':') == tstring::npos ?
+                transport::DEFAULT_GRAYLOG2_PORT :
+                lexical_cast<int>(healthCheck.substr(healthCheck.rfind(':') + 1));
+
+        // Get the time in ms between health checks
+        long healthInterval = lexical_cast<long>(
+                spoolProperties.getProperty("healthInterval", lexical_cast<std::string>(transport::DEFAULT_SPOOL_HEALTH_INTERVAL_MS)));
+
+        return new transport::SpoolingTransport(aTransport, directory, segmentSize, budget, replayRate,
+                                                healthCheckHost, healthCheckPort, healthInterval);
     }
 };
 
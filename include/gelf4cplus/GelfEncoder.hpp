@@ -0,0 +1,365 @@
+/*
+ * File:   GelfEncoder.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(GELFENCODER_HPP)
+#define GELFENCODER_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Header Files
+
+#include <string>
+#include <algorithm>
+#include <ctime>
+#include <stdint.h>
+
+// Other Header Files
+
+#include "JsonEscaper.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace message
+{
+
+using std::string;
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * Writes a GELF message as JSON straight into a string in one pass, without
+ * building a JSON object first. This is the fast path used by the appender;
+ * GelfMessage remains for code that wants to build and inspect a message.
+ *
+ * Fields are written in the order they are added, and the caller is
+ * responsible for not adding a field twice, including an additional field
+ * named like a standard one. Bytes of 0x80 and above are
+ * copied as they are, so UTF-8 text passes through unchanged.
+ */
+class GelfEncoder
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor, which starts a JSON object in the buffer.
+     * @param aBuffer The buffer to write to. Its contents are replaced but its
+     * capacity is kept, so a reused buffer stops allocating.
+     */
+    explicit GelfEncoder(string &aBuffer) :
+        m_buffer(aBuffer),
+        m_first(true)
+    {
+        m_buffer.clear();
+        m_buffer.push_back('{');
+    }
+
+    /**
+     * A constructor that starts the JSON object with fields encoded earlier,
+     * such as those that are the same for every message.
+     * @param aBuffer The buffer to write to. Its contents are replaced but its
+     * capacity is kept, so a reused buffer stops allocating.
+     * @param aPrefix The output of an earlier encoder that was not finished.
+     */
+    GelfEncoder(string &aBuffer, const string &aPrefix) :
+        m_buffer(aBuffer),
+        m_first(aPrefix.length() <= 1)
+    {
+        m_buffer.assign(aPrefix);
+    }
+
+    // Methods
+
+    /**
+     * Adds a string field.
+     * @param aKey The field name, written as is.
+     * @param aValue The field value.
+     */
+    void field(const string &aKey, const string &aValue)
+    {
+        field(aKey, aValue.data(), aValue.length());
+    }
+
+    /**
+     * Adds a string field.
+     * @param aKey The field name, written as is.
+     * @param aValue The field value.
+     * @param aLength The length of the field value.
+     */
+    void field(const string &aKey, const char *aValue, const size_t &aLength)
+    {
+        key(aKey);
+        m_buffer.push_back('"');
+        escape(aValue, aLength, m_buffer);
+        m_buffer.push_back('"');
+    }
+
+    /**
+     * Adds a full message field and a short message field that holds the
+     * start of it. The text is escaped only once: the short message is
+     * copied from the escaped start of the full message.
+     * @param aShortKey The short message field name, written as is.
+     * @param aShortLength The number of characters in the short message.
+     * @param aFullKey The full message field name, written as is.
+     * @param aFullMessage The full message.
+     */
+    void messageFields(const string &aShortKey,
+                       const size_t &aShortLength,
+                       const string &aFullKey,
+                       const string &aFullMessage)
+    {
+        size_t shortLength = std::min(aShortLength, aFullMessage.length());
+
+        key(aFullKey);
+        m_buffer.push_back('"');
+
+        // Escape the full message in two parts, noting where the first ends
+        size_t shortStart = m_buffer.length();
+        escape(aFullMessage.data(), shortLength, m_buffer);
+        size_t shortEnd = m_buffer.length();
+        escape(aFullMessage.data() + shortLength, aFullMessage.length() - shortLength, m_buffer);
+        m_buffer.push_back('"');
+
+        key(aShortKey);
+        m_buffer.push_back('"');
+
+        // Make room first so the copy from our own buffer stays valid
+        m_buffer.reserve(m_buffer.length() + (shortEnd - shortStart) + 1);
+        m_buffer.append(m_buffer.data() + shortStart, shortEnd - shortStart);
+        m_buffer.push_back('"');
+    }
+
+    /**
+     * Adds an integer field.
+     * @param aKey The field name, written as is.
+     * @param aValue The field value.
+     */
+    void field(const string &aKey, const int64_t &aValue)
+    {
+        key(aKey);
+        appendInteger(aValue, m_buffer);
+    }
+
+    /**
+     * Adds a timestamp field as seconds since the epoch with a fractional
+     * part that has no trailing zeros.
+     * @param aKey The field name, written as is.
+     * @param aSeconds Seconds since the epoch.
+     * @param aMicroseconds Microseconds into the second.
+     */
+    void timestamp(const string &aKey, const time_t &aSeconds, const long &aMicroseconds)
+    {
+        key(aKey);
+        appendInteger((int64_t) aSeconds, m_buffer);
+
+        if (aMicroseconds <= 0 || aMicroseconds >= 1000000)
+        {
+            return;
+        }
+
+        // Six digits of fraction, then drop the trailing zeros
+        char fraction[7] = {'.', '0', '0', '0', '0', '0', '0'};
+        long value = aMicroseconds;
+
+        for (int i = 6; i > 0; --i)
+        {
+            fraction[i] = (char) ('0' + value % 10);
+            value /= 10;
+        }
+
+        size_t length = 7;
+
+        while (fraction[length - 1] == '0')
+        {
+            --length;
+        }
+
+        m_buffer.append(fraction, length);
+    }
+
+    /**
+     * Adds an additional field, named as makeKey() names it. The reserved
+     * "_id" is skipped.
+     * @param aKey The field name.
+     * @param aValue The field value.
+     */
+    void additionalField(const string &aKey, const string &aValue)
+    {
+        if (!beginAdditionalKey(aKey))
+        {
+            return;
+        }
+
+        m_buffer.push_back('"');
+        escape(aValue.data(), aValue.length(), m_buffer);
+        m_buffer.push_back('"');
+    }
+
+    /**
+     * Adds an integer additional field, named as makeKey() names it. The
+     * reserved "_id" is skipped.
+     * @param aKey The field name.
+     * @param aValue The field value.
+     */
+    void additionalField(const string &aKey, const int64_t &aValue)
+    {
+        if (!beginAdditionalKey(aKey))
+        {
+            return;
+        }
+
+        appendInteger(aValue, m_buffer);
+    }
+
+    /**
+     * Ends the JSON object. Nothing may be added afterwards.
+     */
+    void finish()
+    {
+        m_buffer.push_back('}');
+    }
+
+    /**
+     * Is the field a standard field in GELF?
+     * @param aKey A key to a field.
+     * @return True if the field is a standard GELF field.
+     */
+    static bool isStandardField(const string &aKey)
+    {
+        return aKey == "version" ||
+               aKey == "host" ||
+               aKey == "short_message" ||
+               aKey == "timestamp" ||
+               aKey == "full_message" ||
+               aKey == "level" ||
+               aKey == "facility" ||
+               aKey == "file" ||
+               aKey == "line";
+    }
+
+    /**
+     * Gets the name an additional field is sent under, as GelfMessage names
+     * it: a standard field keeps its name, so that it replaces the standard
+     * field, and any other name is given the '_' prefix GELF requires.
+     * @param aKey A key to a field.
+     * @return The key as sent, or empty if the field is not allowed.
+     */
+    static string makeKey(const string &aKey)
+    {
+        if (aKey.empty() || aKey == "_id" || aKey == "id")
+        {
+            return string();
+        }
+
+        return (isStandardField(aKey) || aKey[0] == '_') ? aKey : '_' + aKey;
+    }
+
+    /**
+     * Appends a string to a buffer with the characters JSON does not allow in
+     * a string escaped.
+     * @param aValue The string to escape.
+     * @param aLength The length of the string.
+     * @param aBuffer The buffer to append to.
+     */
+    static void escape(const char *aValue, const size_t &aLength, string &aBuffer)
+    {
+        JsonEscaper::escape(aValue, aLength, aBuffer);
+    }
+
+    /**
+     * Appends an integer to a buffer in decimal.
+     * @param aValue The integer.
+     * @param aBuffer The buffer to append to.
+     */
+    static void appendInteger(const int64_t &aValue, string &aBuffer)
+    {
+        char digits[20];
+        char *it = digits + sizeof(digits);
+        uint64_t value = aValue < 0 ? 0 - (uint64_t) aValue : (uint64_t) aValue;
+
+        do
+        {
+            *--it = (char) ('0' + value % 10);
+            value /= 10;
+        }
+        while (value != 0);
+
+        if (aValue < 0)
+        {
+            aBuffer.push_back('-');
+        }
+
+        aBuffer.append(it, digits + sizeof(digits) - it);
+    }
+
+protected:
+
+    // Attributes
+
+    string &m_buffer; ///< The buffer being written.
+    bool m_first; ///< Is the next field the first one?
+
+    // Methods
+
+    /**
+     * Writes the separator and quoted name of a field.
+     * @param aKey The field name.
+     */
+    void key(const string &aKey)
+    {
+        if (!m_first)
+        {
+            m_buffer.push_back(',');
+        }
+
+        m_first = false;
+
+        m_buffer.push_back('"');
+        escape(aKey.data(), aKey.length(), m_buffer);
+        m_buffer.append("\":", 2);
+    }
+
+    /**
+     * Writes the separator and name of an additional field.
+     * @param aKey The field name.
+     * @return False if the field is not allowed and nothing was written.
+     */
+    bool beginAdditionalKey(const string &aKey)
+    {
+        if (aKey.empty() || aKey == "_id" || aKey == "id")
+        {
+            return false;
+        }
+
+        if (!m_first)
+        {
+            m_buffer.push_back(',');
+        }
+
+        m_first = false;
+
+        m_buffer.push_back('"');
+
+        if (aKey[0] != '_' && !isStandardField(aKey))
+        {
+            m_buffer.push_back('_');
+        }
+
+        escape(aKey.data(), aKey.length(), m_buffer);
+        m_buffer.append("\":", 2);
+
+        return true;
+    }
+};
+
+} // namespace message
+} // namespace gelf4cplus
+
+#endif // #if !defined(GELFENCODER_HPP)
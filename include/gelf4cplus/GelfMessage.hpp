@@ -20,12 +20,11 @@
 
 // Third-party Header Files
 
-#define BOOST_IOSTREAM_NO_LIB
-
 #include "json_spirit/json_spirit_writer_template.h"
-#include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
+
+// Other Header Files
+
+#include "Compressor.hpp"
 
 /*- NAMESPACES ---------------------------------------------------------------*/
 
@@ -392,8 +391,18 @@ public:
     virtual void serialize(string &aSerializedString) const
     {
         // Get the JSON, compress it, and set it to the output buffer
-        compress(json_spirit::write_string((Value) m_object, json_spirit::remove_trailing_zeros),
-                 aSerializedString);
+        string jsonString;
+        toJson(jsonString);
+        compress(jsonString, aSerializedString);
+    }
+
+    /**
+     * Serialize this object using JSON without compression.
+     * @param aJsonString The JSON for this object.
+     */
+    virtual void toJson(string &aJsonString) const
+    {
+        aJsonString = json_spirit::write_string((Value) m_object, json_spirit::remove_trailing_zeros);
     }
 
     /**
@@ -509,15 +518,23 @@ protected:
     virtual void compress(const string &aMessage,
                           string &aCompressedMessage) const
     {
-        std::istringstream ss(aMessage);
-        boost::iostreams::filtering_istream in;
-        in.push(boost::iostreams::gzip_compressor());
-        in.push(ss);
-        std::ostringstream out;
-        boost::iostreams::copy(in, out);
-        aCompressedMessage = out.str();
+        gzip(aMessage, aCompressedMessage);
     }
 
+public:
+
+    /**
+     * Compress a message with gzip.
+     * @param aMessage The input message.
+     * @param aCompressedMessage The compressed output message.
+     */
+    static void gzip(const string &aMessage, string &aCompressedMessage)
+    {
+        Compressor::gzip(aMessage, aCompressedMessage);
+    }
+
+protected:
+
     /**
      * Is the field a required field in GELF?
      * @param aKey A key to a field.
@@ -0,0 +1,345 @@
+/*
+ * File:   HandlerAllocator.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(HANDLERALLOCATOR_HPP)
+#define HANDLERALLOCATOR_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <vector>
+#include <new>
+#include <cstddef>
+
+// Third-party Headers
+
+#include <boost/asio/version.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t HANDLER_BLOCK_SIZE = 256; ///< Room for one asio operation.
+const size_t MAX_POOLED_HANDLER_BLOCKS = 1024; ///< Idle blocks kept around.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A pool of fixed-size blocks for the operations Boost.Asio allocates for
+ * each post() and each asynchronous send. Asio's own recycling only works
+ * when an operation is freed on the thread that allocated it, which is not
+ * the case for work handed to an I/O thread. Larger requests go to the heap.
+ */
+class HandlerMemory : private boost::noncopyable
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The destructor, which frees the idle blocks.
+     */
+    ~HandlerMemory()
+    {
+        for (size_t i = 0; i < m_blocks.size(); ++i)
+        {
+            ::operator delete(m_blocks[i]);
+        }
+    }
+
+    // Methods
+
+    /**
+     * Allocates memory for a handler.
+     * @param aSize The number of bytes.
+     * @return The memory.
+     */
+    void* allocate(const size_t &aSize)
+    {
+        if (aSize <= HANDLER_BLOCK_SIZE)
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+
+            if (!m_blocks.empty())
+            {
+                void *block = m_blocks.back();
+                m_blocks.pop_back();
+
+                return block;
+            }
+        }
+
+        return ::operator new(aSize <= HANDLER_BLOCK_SIZE ? HANDLER_BLOCK_SIZE : aSize);
+    }
+
+    /**
+     * Frees memory from allocate().
+     * @param aPointer The memory.
+     * @param aSize The number of bytes asked for.
+     */
+    void deallocate(void *aPointer, const size_t &aSize)
+    {
+        if (aSize <= HANDLER_BLOCK_SIZE)
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+
+            if (m_blocks.size() < MAX_POOLED_HANDLER_BLOCKS)
+            {
+                m_blocks.push_back(aPointer);
+
+                return;
+            }
+        }
+
+        ::operator delete(aPointer);
+    }
+
+protected:
+
+    // Attributes
+
+    boost::mutex m_mutex; ///< Guards m_blocks.
+    std::vector<void*> m_blocks; ///< Idle blocks.
+};
+
+/**
+ * A standard allocator that takes its memory from a HandlerMemory, which asio
+ * finds as the associated allocator of an AllocatingHandler.
+ */
+template <typename T>
+class HandlerAllocator
+{
+public:
+
+    // Type Definitions
+
+    typedef T value_type; ///< The type allocated.
+
+    /**
+     * The same allocator for another type, for C++03.
+     */
+    template <typename U>
+    struct rebind
+    {
+        typedef HandlerAllocator<U> other; ///< The allocator for U.
+    };
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor.
+     * @param aMemory The memory to allocate from.
+     */
+    explicit HandlerAllocator(HandlerMemory &aMemory) :
+        m_memory(&aMemory)
+    {
+    }
+
+    /**
+     * Converts an allocator for another type.
+     * @param anOther The allocator to take the memory of.
+     */
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U> &anOther) :
+        m_memory(anOther.memory())
+    {
+    }
+
+    // Methods
+
+    /**
+     * Allocates memory for objects.
+     * @param aCount The number of objects.
+     * @return The memory.
+     */
+    T* allocate(const std::size_t &aCount) const
+    {
+        return static_cast<T*>(m_memory->allocate(sizeof(T) * aCount));
+    }
+
+    /**
+     * Frees memory from allocate().
+     * @param aPointer The memory.
+     * @param aCount The number of objects asked for.
+     */
+    void deallocate(T *aPointer, const std::size_t &aCount) const
+    {
+        m_memory->deallocate(aPointer, sizeof(T) * aCount);
+    }
+
+    /**
+     * Gets the memory allocated from.
+     * @return The memory.
+     */
+    HandlerMemory* memory() const
+    {
+        return m_memory;
+    }
+
+    // Operators
+
+    /**
+     * Can memory from one allocator be freed by the other?
+     * @param anOther The other allocator.
+     * @return True if both use the same memory.
+     */
+    template <typename U>
+    bool operator==(const HandlerAllocator<U> &anOther) const
+    {
+        return m_memory == anOther.memory();
+    }
+
+    /**
+     * Must memory from one allocator be freed by that one?
+     * @param anOther The other allocator.
+     * @return True if they use different memory.
+     */
+    template <typename U>
+    bool operator!=(const HandlerAllocator<U> &anOther) const
+    {
+        return m_memory != anOther.memory();
+    }
+
+protected:
+
+    // Attributes
+
+    HandlerMemory *m_memory; ///< Where objects are allocated.
+};
+
+/**
+ * Wraps a completion handler so that asio allocates its operation from a
+ * HandlerMemory. Asio finds the memory through get_allocator(), the
+ * associated allocator, and older versions through the allocation hooks.
+ * Wrap the innermost handler and bind it to a strand with bind_executor(),
+ * which passes the allocator on; strand.wrap() hides it from asio, which then
+ * only reaches the memory through the hooks.
+ */
+template <typename Handler>
+class AllocatingHandler
+{
+public:
+
+    // Type Definitions
+
+    typedef HandlerAllocator<void> allocator_type; ///< The associated allocator.
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor.
+     * @param aMemory The memory to allocate from.
+     * @param aHandler The handler to call.
+     */
+    AllocatingHandler(HandlerMemory &aMemory, const Handler &aHandler) :
+        m_memory(&aMemory),
+        m_handler(aHandler)
+    {
+    }
+
+    // Methods
+
+    /**
+     * Gets the allocator asio allocates the handler's operations with.
+     * @return The allocator.
+     */
+    allocator_type get_allocator() const
+    {
+        return allocator_type(*m_memory);
+    }
+
+    // Operators
+
+    /**
+     * Calls the handler.
+     */
+    void operator()()
+    {
+        m_handler();
+    }
+
+    /**
+     * Calls the handler.
+     * @param anArgument1 The first argument.
+     */
+    template <typename Argument1>
+    void operator()(const Argument1 &anArgument1)
+    {
+        m_handler(anArgument1);
+    }
+
+    /**
+     * Calls the handler.
+     * @param anArgument1 The first argument.
+     * @param anArgument2 The second argument.
+     */
+    template <typename Argument1, typename Argument2>
+    void operator()(const Argument1 &anArgument1, const Argument2 &anArgument2)
+    {
+        m_handler(anArgument1, anArgument2);
+    }
+
+#if !defined(BOOST_ASIO_NO_DEPRECATED)
+    // Friends
+
+    /**
+     * The asio allocation hook, for versions without associated allocators.
+     * @param aSize The number of bytes.
+     * @param aHandler The handler the memory is for.
+     * @return The memory.
+     */
+    friend void* asio_handler_allocate(std::size_t aSize, AllocatingHandler *aHandler)
+    {
+        return aHandler->m_memory->allocate(aSize);
+    }
+
+    /**
+     * The asio deallocation hook.
+     * @param aPointer The memory.
+     * @param aSize The number of bytes.
+     * @param aHandler The handler the memory was for.
+     */
+    friend void asio_handler_deallocate(void *aPointer, std::size_t aSize, AllocatingHandler *aHandler)
+    {
+        aHandler->m_memory->deallocate(aPointer, aSize);
+    }
+#endif
+
+protected:
+
+    // Attributes
+
+    HandlerMemory *m_memory; ///< Where operations are allocated.
+    Handler m_handler; ///< The wrapped handler.
+};
+
+/**
+ * Wraps a completion handler so that asio allocates its operation from a
+ * HandlerMemory.
+ * @param aMemory The memory to allocate from.
+ * @param aHandler The handler to call.
+ * @return The wrapped handler.
+ */
+template <typename Handler>
+inline AllocatingHandler<Handler> makeAllocatingHandler(HandlerMemory &aMemory, const Handler &aHandler)
+{
+    return AllocatingHandler<Handler>(aMemory, aHandler);
+}
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(HANDLERALLOCATOR_HPP)
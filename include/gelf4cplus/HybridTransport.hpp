@@ -0,0 +1,319 @@
+/*
+ * File:   HybridTransport.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(HYBRIDTRANSPORT_HPP)
+#define HYBRIDTRANSPORT_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+
+// Third-party Headers
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+
+// Other Headers
+
+#include "ITransport.hpp"
+#include "Compressor.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+using std::string;
+using gelf4cplus::message::Compressor;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t HYBRID_UDP_LIMIT = 0; ///< Threshold that leaves the limit to UDP.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A transport that sends messages over UDP, except for messages too large
+ * for it, which go over a persistent TCP connection instead.
+ *
+ * A message goes over TCP when it is larger than the UDP transport's
+ * maxMessageSize(), which for chunked UDP is the chunk size times
+ * MAX_CHUNK_COUNT, or larger than a configured threshold below that. GELF
+ * over TCP cannot carry compressed messages, so a compressed message routed
+ * to TCP is decompressed first. This costs some CPU, but only for the rare
+ * message that would otherwise be lost.
+ *
+ * The methods must not be called from more than one thread at once, except
+ * for the counters, pendingMessages() and healthy().
+ */
+class HybridTransport : public ITransport
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor.
+     * @param anUdpTransport The transport for most messages, which this one
+     * takes over.
+     * @param aTcpTransport The transport for large messages, which this one
+     * takes over.
+     * @param aThreshold Messages larger than this go over TCP, or
+     * HYBRID_UDP_LIMIT to send over TCP only what UDP cannot carry.
+     */
+    HybridTransport(ITransport *anUdpTransport,
+                    ITransport *aTcpTransport,
+                    const size_t &aThreshold = HYBRID_UDP_LIMIT) :
+                    m_udpTransport(anUdpTransport),
+                    m_tcpTransport(aTcpTransport),
+                    m_threshold(aThreshold),
+                    m_udpMessages(0),
+                    m_tcpMessages(0),
+                    m_decompressedMessages(0)
+    {
+    }
+
+    /**
+     * A virtual destructor in case someone wants to derive from this class.
+     */
+    virtual ~HybridTransport()
+    {
+    }
+
+    // Methods
+
+    using ITransport::send;
+
+    /**
+     * Sends a message over UDP, or over TCP if it is too large.
+     * @param aMessage The message to send.
+     */
+    virtual void send(const string &aMessage)
+    {
+        if (!oversized(aMessage.length()))
+        {
+            sendUdp(aMessage);
+
+            return;
+        }
+
+        sendTcp(aMessage.data(), aMessage.length(), aMessage);
+    }
+
+    /**
+     * Sends a message over UDP, or over TCP if it is too large, letting the
+     * transport take or share its bytes.
+     * @param aMessage The message to send.
+     */
+    virtual void send(Buffer &aMessage)
+    {
+        if (!oversized(aMessage.length()))
+        {
+            sendUdp(aMessage);
+
+            return;
+        }
+
+        sendTcp(aMessage.data(), aMessage.length(), aMessage);
+    }
+
+    /**
+     * Sends a message made up of several fragments over UDP, or over TCP if
+     * it is too large.
+     * @param aMessage The fragments of the message to send.
+     */
+    virtual void send(const Fragments &aMessage)
+    {
+        if (!oversized(aMessage.length()))
+        {
+            sendUdp(aMessage);
+
+            return;
+        }
+
+        string message;
+        aMessage.copyTo(message);
+
+        sendTcp(message.data(), message.length(), message);
+    }
+
+    /**
+     * Flushes both transports.
+     */
+    virtual void flush()
+    {
+        m_udpTransport->flush();
+        m_tcpTransport->flush();
+    }
+
+    /**
+     * Must flush() be called for what was sent to go out?
+     * @return True if either transport needs flushing.
+     */
+    virtual bool needsFlush() const
+    {
+        return m_udpTransport->needsFlush() || m_tcpTransport->needsFlush();
+    }
+
+    /**
+     * Gets the number of messages pending in both transports.
+     * @return The number of messages still pending.
+     */
+    virtual size_t pendingMessages() const
+    {
+        return m_udpTransport->pendingMessages() + m_tcpTransport->pendingMessages();
+    }
+
+    /**
+     * Are both transports healthy?
+     * @return False if either transport reports a problem.
+     */
+    virtual bool healthy() const
+    {
+        // Ask both, since asking may reset what a transport reports next time
+        bool udpHealthy = m_udpTransport->healthy();
+        bool tcpHealthy = m_tcpTransport->healthy();
+
+        return udpHealthy && tcpHealthy;
+    }
+
+    /**
+     * Can the UDP transport carry compressed GELF messages? Compressed
+     * messages routed to TCP are decompressed.
+     * @return True if messages should be compressed before sending.
+     */
+    virtual bool supportsCompression() const
+    {
+        return m_udpTransport->supportsCompression();
+    }
+
+    /**
+     * Gets the size above which messages go over TCP.
+     * @return The size in bytes.
+     */
+    virtual size_t udpLimit() const
+    {
+        size_t limit = m_udpTransport->maxMessageSize();
+
+        return m_threshold == HYBRID_UDP_LIMIT ? limit : std::min(m_threshold, limit);
+    }
+
+    /**
+     * Gets the number of messages sent over UDP.
+     * @return The number of messages.
+     */
+    virtual uint64_t udpMessages() const
+    {
+        return m_udpMessages.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of messages sent over TCP.
+     * @return The number of messages.
+     */
+    virtual uint64_t tcpMessages() const
+    {
+        return m_tcpMessages.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of compressed messages decompressed for TCP.
+     * @return The number of messages.
+     */
+    virtual uint64_t decompressedMessages() const
+    {
+        return m_decompressedMessages.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the UDP transport.
+     * @return The transport.
+     */
+    virtual ITransport& udpTransport()
+    {
+        return *m_udpTransport;
+    }
+
+    /**
+     * Gets the TCP transport.
+     * @return The transport.
+     */
+    virtual ITransport& tcpTransport()
+    {
+        return *m_tcpTransport;
+    }
+
+protected:
+
+    // Members
+
+    boost::scoped_ptr<ITransport> m_udpTransport; ///< Sends most messages.
+    boost::scoped_ptr<ITransport> m_tcpTransport; ///< Sends large messages.
+    size_t m_threshold; ///< Messages larger than this go over TCP.
+    boost::atomic<uint64_t> m_udpMessages; ///< Messages sent over UDP.
+    boost::atomic<uint64_t> m_tcpMessages; ///< Messages sent over TCP.
+    boost::atomic<uint64_t> m_decompressedMessages; ///< Inflated for TCP.
+    string m_decompressedMessage; ///< Reused for decompressing.
+
+    // Methods
+
+    /**
+     * Is a message too large for UDP?
+     * @param aLength The length of the message.
+     * @return True if the message should go over TCP.
+     */
+    bool oversized(const size_t &aLength) const
+    {
+        return aLength > udpLimit();
+    }
+
+    /**
+     * Sends a message over UDP.
+     * @param aMessage The message to send: a string, a Buffer or Fragments.
+     */
+    template <typename Message>
+    void sendUdp(Message &aMessage)
+    {
+        m_udpTransport->send(aMessage);
+        m_udpMessages.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Sends a message over TCP, decompressing it first if need be.
+     * @param aData The bytes of the message.
+     * @param aLength The length of the message.
+     * @param aMessage The message to send as is when not compressed: a string
+     * or a Buffer.
+     */
+    template <typename Message>
+    void sendTcp(const char *aData, const size_t &aLength, Message &aMessage)
+    {
+        if (Compressor::compressed(aData, aLength))
+        {
+            Compressor::decompress(aData, aLength, m_decompressedMessage);
+            m_decompressedMessages.fetch_add(1, boost::memory_order_relaxed);
+            m_tcpTransport->send(m_decompressedMessage);
+        }
+        else
+        {
+            m_tcpTransport->send(aMessage);
+        }
+
+        m_tcpMessages.fetch_add(1, boost::memory_order_relaxed);
+    }
+};
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(HYBRIDTRANSPORT_HPP)
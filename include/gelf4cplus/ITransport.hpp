@@ -14,6 +14,10 @@
 
 #include <string>
 
+// Other Headers
+
+#include "Buffer.hpp"
+
 /*- NAMESPACES ---------------------------------------------------------------*/
 
 namespace gelf4cplus
@@ -21,10 +25,19 @@ namespace gelf4cplus
 namespace transport
 {
 
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const int DEFAULT_GRAYLOG2_PORT = 12201; ///< The default Graylog2 port.
+const std::string DEFAULT_GRAYLOG2_HOST = "localhost"; ///< The default Graylog2 host.
+
 /*- CLASSES ------------------------------------------------------------------*/
 
 /**
  * An interface to create a new transport type.
+ *
+ * Only send(const std::string&) must be implemented; the other sends adapt to
+ * it. A transport that overrides only some of the send overloads should bring
+ * the rest into scope with "using ITransport::send;".
  */
 class ITransport
 {
@@ -46,6 +59,124 @@ public:
      * @param aMessage The message to send.
      */
     virtual void send(const std::string &aMessage) = 0;
+
+    /**
+     * Sends a message, letting the transport take or share its bytes.
+     * @param aMessage The message to send. Its contents afterwards are
+     * unspecified.
+     */
+    virtual void send(Buffer &aMessage)
+    {
+        send(aMessage.bytes());
+    }
+
+    /**
+     * Sends a message made up of several fragments.
+     * @param aMessage The fragments of the message to send.
+     */
+    virtual void send(const Fragments &aMessage)
+    {
+        std::string message;
+        aMessage.copyTo(message);
+
+        send(message);
+    }
+
+    /**
+     * Sends several messages, letting the transport take or share their bytes.
+     * @param aMessages The messages to send. Their contents afterwards are
+     * unspecified.
+     * @param aCount The number of messages.
+     */
+    virtual void sendBatch(Buffer *aMessages, const size_t &aCount)
+    {
+        for (size_t i = 0; i < aCount; ++i)
+        {
+            send(aMessages[i]);
+        }
+    }
+
+    /**
+     * Sends any messages the transport has buffered. Transports that send
+     * each message right away do not need to override this.
+     */
+    virtual void flush()
+    {
+    }
+
+    /**
+     * Must flush() be called after sending for the messages to go out in
+     * good time? Transports that send buffered messages on their own can say
+     * no, so that a caller sending one message at a time does not have to
+     * flush after each.
+     * @return True unless the transport flushes itself.
+     */
+    virtual bool needsFlush() const
+    {
+        return true;
+    }
+
+    /**
+     * Gets the number of messages that were handed to the transport and
+     * flushed but have not left it yet, such as asynchronous sends that have
+     * not completed. May be called from any thread.
+     * @return The number of messages still pending.
+     */
+    virtual size_t pendingMessages() const
+    {
+        return 0;
+    }
+
+    /**
+     * Can the transport reach its destination, as far as it can tell? May be
+     * called from any thread.
+     * @return True unless the transport has seen its sends fail.
+     */
+    virtual bool healthy() const
+    {
+        return true;
+    }
+
+    /**
+     * Does the transport keep messages the appender could not queue, so that
+     * overflow() is worth calling?
+     * @return True if overflow() may accept messages.
+     */
+    virtual bool acceptsOverflow() const
+    {
+        return false;
+    }
+
+    /**
+     * Takes a message the appender had to drop because its queue was full.
+     * Called from the logging threads, so it must be thread-safe.
+     * @param aMessage The message, built as for send().
+     * @return True if the message was kept.
+     */
+    virtual bool overflow(const std::string &aMessage)
+    {
+        (void) aMessage;
+
+        return false;
+    }
+
+    /**
+     * Gets the size of the largest message the transport can carry.
+     * @return The largest message size in bytes.
+     */
+    virtual size_t maxMessageSize() const
+    {
+        return (size_t) -1;
+    }
+
+    /**
+     * Can this transport carry compressed GELF messages?
+     * @return True if messages should be compressed before sending.
+     */
+    virtual bool supportsCompression() const
+    {
+        return true;
+    }
 };
 
 } // namespace transport
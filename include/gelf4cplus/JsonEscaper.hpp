@@ -0,0 +1,243 @@
+/*
+ * File:   JsonEscaper.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(JSONESCAPER_HPP)
+#define JSONESCAPER_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Header Files
+
+#include <string>
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define GELF4CPLUS_SIMD_ESCAPE
+#include <immintrin.h>
+#endif
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace message
+{
+
+using std::string;
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * Escapes text for use in a JSON string. Only '"', '\\' and control
+ * characters need escaping, so the escaper looks for them 16 bytes at a time
+ * with SSE2, or 32 at a time with AVX2 when the CPU has it, and copies the
+ * clean runs between them in bulk. Other compilers and CPUs use a plain loop.
+ */
+class JsonEscaper
+{
+public:
+
+    // Methods
+
+    /**
+     * Appends a string to a buffer with the characters JSON does not allow in
+     * a string escaped.
+     * @param aValue The string to escape.
+     * @param aLength The length of the string.
+     * @param aBuffer The buffer to append to.
+     */
+    static void escape(const char *aValue, const size_t &aLength, string &aBuffer)
+    {
+        static const char HEX_DIGITS[] = "0123456789abcdef";
+
+        FindFunction find = findFunction();
+        const char *end = aValue + aLength;
+
+        // Clean text needs no more room than it has, so only grow once
+        aBuffer.reserve(aBuffer.length() + aLength);
+
+        for (const char *it = aValue; it != end; )
+        {
+            const char *special = find(it, end);
+
+            // Copy the clean run before the next special character in one go
+            aBuffer.append(it, special - it);
+
+            if (special == end)
+            {
+                break;
+            }
+
+            unsigned char c = (unsigned char) *special;
+            it = special + 1;
+
+            switch (c)
+            {
+            case '"': aBuffer.append("\\\"", 2); break;
+            case '\\': aBuffer.append("\\\\", 2); break;
+            case '\b': aBuffer.append("\\b", 2); break;
+            case '\f': aBuffer.append("\\f", 2); break;
+            case '\n': aBuffer.append("\\n", 2); break;
+            case '\r': aBuffer.append("\\r", 2); break;
+            case '\t': aBuffer.append("\\t", 2); break;
+            default:
+                {
+                    char unicode[6] = {'\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0x0f]};
+                    aBuffer.append(unicode, sizeof(unicode));
+                }
+            }
+        }
+    }
+
+    /**
+     * Finds the first character that must be escaped, one byte at a time.
+     * @param aBegin The start of the text.
+     * @param anEnd The end of the text.
+     * @return The first special character or anEnd if there is none.
+     */
+    static const char* findScalar(const char *aBegin, const char *anEnd)
+    {
+        for (const char *it = aBegin; it != anEnd; ++it)
+        {
+            if (isSpecial((unsigned char) *it))
+            {
+                return it;
+            }
+        }
+
+        return anEnd;
+    }
+
+#if defined(GELF4CPLUS_SIMD_ESCAPE)
+
+    /**
+     * Finds the first character that must be escaped, 16 bytes at a time.
+     * @param aBegin The start of the text.
+     * @param anEnd The end of the text.
+     * @return The first special character or anEnd if there is none.
+     */
+    static const char* findSse2(const char *aBegin, const char *anEnd)
+    {
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i lastControl = _mm_set1_epi8(0x1f);
+        const __m128i zero = _mm_setzero_si128();
+
+        const char *it = aBegin;
+
+        for (; anEnd - it >= 16; it += 16)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i*) it);
+
+            // A saturating subtract of 0x1f leaves zero for control characters
+            __m128i special = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+                    _mm_cmpeq_epi8(_mm_subs_epu8(chunk, lastControl), zero));
+
+            int mask = _mm_movemask_epi8(special);
+
+            if (mask != 0)
+            {
+                return it + __builtin_ctz(mask);
+            }
+        }
+
+        return findScalar(it, anEnd);
+    }
+
+    /**
+     * Finds the first character that must be escaped, 32 bytes at a time.
+     * Only called when the CPU supports AVX2.
+     * @param aBegin The start of the text.
+     * @param anEnd The end of the text.
+     * @return The first special character or anEnd if there is none.
+     */
+    __attribute__((target("avx2")))
+    static const char* findAvx2(const char *aBegin, const char *anEnd)
+    {
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i lastControl = _mm256_set1_epi8(0x1f);
+        const __m256i zero = _mm256_setzero_si256();
+
+        const char *it = aBegin;
+
+        for (; anEnd - it >= 32; it += 32)
+        {
+            __m256i chunk = _mm256_loadu_si256((const __m256i*) it);
+
+            // A saturating subtract of 0x1f leaves zero for control characters
+            __m256i special = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+                    _mm256_cmpeq_epi8(_mm256_subs_epu8(chunk, lastControl), zero));
+
+            unsigned mask = (unsigned) _mm256_movemask_epi8(special);
+
+            if (mask != 0)
+            {
+                return it + __builtin_ctz(mask);
+            }
+        }
+
+        return findSse2(it, anEnd);
+    }
+
+#endif // #if defined(GELF4CPLUS_SIMD_ESCAPE)
+
+protected:
+
+    // Type Definitions
+
+    typedef const char* (*FindFunction)(const char*, const char*); ///< Finder
+
+    // Methods
+
+    /**
+     * Must the character be escaped in a JSON string?
+     * @param aCharacter The character.
+     * @return True if the character must be escaped.
+     */
+    static bool isSpecial(const unsigned char &aCharacter)
+    {
+        return aCharacter < 0x20 || aCharacter == '"' || aCharacter == '\\';
+    }
+
+    /**
+     * Gets the fastest finder this CPU supports, choosing it on first use.
+     * @return The finder.
+     */
+    static FindFunction findFunction()
+    {
+        static FindFunction find = selectFindFunction();
+
+        return find;
+    }
+
+    /**
+     * Chooses the fastest finder this CPU supports.
+     * @return The finder.
+     */
+    static FindFunction selectFindFunction()
+    {
+#if defined(GELF4CPLUS_SIMD_ESCAPE)
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return &findAvx2;
+        }
+
+        return &findSse2;
+#else
+        return &findScalar;
+#endif
+    }
+};
+
+} // namespace message
+} // namespace gelf4cplus
+
+#endif // #if !defined(JSONESCAPER_HPP)
@@ -0,0 +1,218 @@
+/*
+ * File:   MessageIdGenerator.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(MESSAGEIDGENERATOR_HPP)
+#define MESSAGEIDGENERATOR_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <fstream>
+#include <ctime>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+// Third-party Headers
+
+#include <boost/atomic.hpp>
+
+/*- MACROS -------------------------------------------------------------------*/
+
+#if defined(_MSC_VER)
+#define GELF4CPLUS_THREAD_LOCAL __declspec(thread)
+#else
+#define GELF4CPLUS_THREAD_LOCAL __thread
+#endif
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * Generates the 8-byte IDs of chunked GELF messages.
+ *
+ * Each thread numbers its messages with a plain counter, and each thread gets
+ * its own range of counter values. The counter value plus a random seed drawn
+ * once per process is scrambled with a bijective 64-bit mixer. IDs therefore
+ * never repeat within a process (for up to 2^24 threads and 2^40 messages per
+ * thread) and are random across processes. The seed is drawn again in the
+ * child after a fork(). Generating an ID takes no lock and does not allocate.
+ */
+class MessageIdGenerator
+{
+public:
+
+    // Methods
+
+    /**
+     * Generates a new message ID.
+     * @return The message ID.
+     */
+    static uint64_t next()
+    {
+        ThreadState &state = threadState();
+        uint32_t currentGeneration = generation().load(boost::memory_order_relaxed);
+
+        if (state.generation != currentGeneration)
+        {
+            // First call on this thread or first call after a fork
+            state.base = seed() + (nextThreadIndex() << THREAD_INDEX_SHIFT);
+            state.counter = 0;
+            state.generation = currentGeneration;
+        }
+
+        return mix(state.base + state.counter++);
+    }
+
+    /**
+     * Generates a new message ID as 8 raw bytes.
+     * @param aMessageId The resultant message ID.
+     */
+    static void next(std::string &aMessageId)
+    {
+        uint64_t id = next();
+
+        aMessageId.assign((const char*) &id, sizeof(id));
+    }
+
+protected:
+
+    // Type Definitions
+
+    /**
+     * The per-thread part of the generator.
+     */
+    struct ThreadState
+    {
+        uint64_t base; ///< Seed plus this thread's range.
+        uint64_t counter; ///< Messages numbered by this thread.
+        uint32_t generation; ///< Seed generation the base was built from.
+    };
+
+    // Constant Static Members
+
+    static const unsigned THREAD_INDEX_SHIFT = 40; ///< Bits per thread range.
+
+    // Methods
+
+    /**
+     * Gets the state of the calling thread.
+     * @return The thread state.
+     */
+    static ThreadState& threadState()
+    {
+        // Zero initialized, so the first call sees generation 0
+        static GELF4CPLUS_THREAD_LOCAL ThreadState state;
+
+        return state;
+    }
+
+    /**
+     * The current seed generation. Starts at 1 so that a new thread always
+     * builds its state, and changes in the child after a fork.
+     * @return The seed generation.
+     */
+    static boost::atomic<uint32_t>& generation()
+    {
+        static boost::atomic<uint32_t> generation(1);
+
+        return generation;
+    }
+
+    /**
+     * Hands out thread indexes.
+     * @return The next thread index.
+     */
+    static uint64_t nextThreadIndex()
+    {
+        static boost::atomic<uint64_t> threadIndex(0);
+
+        return threadIndex.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the random per-process seed, drawing it on first use.
+     * @return The seed.
+     */
+    static uint64_t& seed()
+    {
+        static uint64_t value = drawSeed();
+
+        return value;
+    }
+
+    /**
+     * Draws a random seed from the OS, mixed with the process ID and time in
+     * case the OS has no random device.
+     * @return A random seed.
+     */
+    static uint64_t drawSeed()
+    {
+        uint64_t random = 0;
+        std::ifstream urandom("/dev/urandom", std::ios::in | std::ios::binary);
+
+        if (urandom)
+        {
+            urandom.read((char*) &random, sizeof(random));
+        }
+
+#if defined(_WIN32)
+        uint64_t pid = (uint64_t) _getpid();
+#else
+        uint64_t pid = (uint64_t) getpid();
+
+        // Only register the fork handler once
+        static bool registered = (pthread_atfork(NULL, NULL, &afterFork) == 0);
+        (void) registered;
+#endif
+
+        return mix(random ^ (pid << 32) ^ (uint64_t) std::time(NULL) ^ (uint64_t) clock());
+    }
+
+    /**
+     * Draws a new seed in the child after a fork, so parent and child do not
+     * hand out the same IDs.
+     */
+    static void afterFork()
+    {
+        seed() = drawSeed();
+        generation().fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    /**
+     * A bijective 64-bit mixer (the SplitMix64 finalizer), so distinct inputs
+     * give distinct outputs.
+     * @param aValue The value to mix.
+     * @return The mixed value.
+     */
+    static uint64_t mix(uint64_t aValue)
+    {
+        aValue += 0x9e3779b97f4a7c15ULL;
+        aValue = (aValue ^ (aValue >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        aValue = (aValue ^ (aValue >> 27)) * 0x94d049bb133111ebULL;
+
+        return aValue ^ (aValue >> 31);
+    }
+};
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(MESSAGEIDGENERATOR_HPP)
@@ -0,0 +1,695 @@
+/*
+ * File:   MultiEndpointTransport.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(MULTIENDPOINTTRANSPORT_HPP)
+#define MULTIENDPOINTTRANSPORT_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+// Third-party Headers
+
+#include <boost/asio/buffer.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Other Headers
+
+#include "ITransport.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+using std::string;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const long ENDPOINT_MIN_EJECTION_MS = 500; ///< First ejection of an endpoint.
+const long ENDPOINT_MAX_EJECTION_MS = 30000; ///< Longest ejection of an endpoint.
+const size_t HASH_KEY_LENGTH = 32; ///< Bytes at each end of a message, and spread over it, that BALANCE_HASH hashes.
+
+/*- ENUMERATIONS -------------------------------------------------------------*/
+
+/**
+ * How messages are spread over the endpoints.
+ */
+enum BalancePolicy
+{
+    BALANCE_FAILOVER, ///< The first live endpoint, in configured order.
+    BALANCE_ROUND_ROBIN, ///< Each live endpoint in turn.
+    BALANCE_LEAST_OUTSTANDING, ///< The live endpoint with the fewest pending messages.
+    BALANCE_HASH ///< An endpoint picked by a hash of the ends of the message.
+};
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A transport that spreads messages over several Graylog inputs, each reached
+ * through a transport of its own. A message always goes whole to one of them,
+ * so the chunks of a chunked message never end up on different nodes.
+ *
+ * An endpoint whose transport reports itself unhealthy after a send or flush,
+ * such as a TCP connection that was refused or a connected UDP socket that
+ * saw ECONNREFUSED, is ejected and gets no messages until its ejection time
+ * is up. It is then tried again; ejected again straight away, its ejection
+ * time doubles up to ENDPOINT_MAX_EJECTION_MS. While every endpoint is
+ * ejected, messages go to the one due back first.
+ *
+ * BALANCE_HASH hashes the length of a message, HASH_KEY_LENGTH bytes at each
+ * end of it and HASH_KEY_LENGTH bytes spread evenly over it, so it costs the
+ * same for any message size and copies nothing. The ends alone would do for
+ * a compressed message, which carries the checksum of the whole at its end,
+ * but an uncompressed one starts with the same static fields every time and
+ * mostly ends with the same per-event ones; the spread bytes fall in its
+ * message text and timestamp. Uncompressed messages that differ in only a
+ * few bytes may still share an endpoint. A message picks the same endpoint
+ * whether it is sent whole or in fragments.
+ *
+ * Apart from pendingMessages() and healthy(), the methods must not be called
+ * concurrently, as for any transport.
+ */
+class MultiEndpointTransport : public ITransport
+{
+public:
+
+    // Type Definitions
+
+    typedef std::vector< boost::shared_ptr<ITransport> > Transports; ///< One per endpoint.
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor.
+     * @param aTransports The transports of the endpoints, in order of
+     * preference.
+     * @param aPolicy How to spread messages over the endpoints.
+     */
+    MultiEndpointTransport(const Transports &aTransports,
+                           const BalancePolicy &aPolicy = BALANCE_ROUND_ROBIN) :
+        m_policy(aPolicy),
+        m_endpoints(aTransports.size()),
+        m_next(0),
+        m_ejectedCount(0),
+        m_liveEndpoints(aTransports.size())
+    {
+        for (size_t i = 0; i < aTransports.size(); ++i)
+        {
+            m_endpoints[i].transport = aTransports[i];
+        }
+    }
+
+    /**
+     * A virtual destructor in case someone wants to derive from this class.
+     */
+    virtual ~MultiEndpointTransport()
+    {
+    }
+
+    // Methods
+
+    /**
+     * Sends a message to the endpoint the policy picks.
+     * @param aMessage The message to send.
+     */
+    virtual void send(const string &aMessage)
+    {
+        route(aMessage);
+    }
+
+    /**
+     * Sends a message to the endpoint the policy picks, letting its transport
+     * take the bytes.
+     * @param aMessage The message to send.
+     */
+    virtual void send(Buffer &aMessage)
+    {
+        route(aMessage);
+    }
+
+    /**
+     * Sends a message made up of several fragments to the endpoint the
+     * policy picks.
+     * @param aMessage The fragments of the message to send.
+     */
+    virtual void send(const Fragments &aMessage)
+    {
+        route(aMessage);
+    }
+
+    /**
+     * Flushes every endpoint, including ejected ones so that they can
+     * reconnect, and ejects those that turn out to be unhealthy.
+     */
+    virtual void flush()
+    {
+        for (size_t i = 0; i < m_endpoints.size(); ++i)
+        {
+            Endpoint &endpoint = m_endpoints[i];
+
+            try
+            {
+                endpoint.transport->flush();
+            }
+            catch (...)
+            {
+                eject(i);
+
+                continue;
+            }
+
+            if (!endpoint.ejected)
+            {
+                if (!endpoint.transport->healthy())
+                {
+                    eject(i);
+                }
+                else if (endpoint.probation)
+                {
+                    // It survived its return, so start over with short ejections
+                    endpoint.probation = false;
+                    endpoint.ejection = boost::posix_time::milliseconds(ENDPOINT_MIN_EJECTION_MS);
+                }
+            }
+        }
+    }
+
+    /**
+     * Must flush() be called for what was sent to go out? Ejected endpoints
+     * only reconnect when flushed, so they count as needing it.
+     * @return True if any endpoint needs flushing or is ejected.
+     */
+    virtual bool needsFlush() const
+    {
+        if (m_liveEndpoints.load(boost::memory_order_relaxed) != m_endpoints.size())
+        {
+            return true;
+        }
+
+        for (size_t i = 0; i < m_endpoints.size(); ++i)
+        {
+            if (m_endpoints[i].transport->needsFlush())
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Gets the number of messages pending in all endpoints.
+     * @return The number of messages still pending.
+     */
+    virtual size_t pendingMessages() const
+    {
+        size_t pending = 0;
+
+        for (size_t i = 0; i < m_endpoints.size(); ++i)
+        {
+            pending += m_endpoints[i].transport->pendingMessages();
+        }
+
+        return pending;
+    }
+
+    /**
+     * Is at least one endpoint live?
+     * @return False if every endpoint is ejected.
+     */
+    virtual bool healthy() const
+    {
+        return m_liveEndpoints.load(boost::memory_order_relaxed) != 0;
+    }
+
+    /**
+     * Gets the size of the largest message every endpoint can carry.
+     * @return The largest message size in bytes.
+     */
+    virtual size_t maxMessageSize() const
+    {
+        size_t size = (size_t) -1;
+
+        for (size_t i = 0; i < m_endpoints.size(); ++i)
+        {
+            size = std::min(size, m_endpoints[i].transport->maxMessageSize());
+        }
+
+        return size;
+    }
+
+    /**
+     * Can every endpoint carry compressed GELF messages?
+     * @return True if messages should be compressed before sending.
+     */
+    virtual bool supportsCompression() const
+    {
+        for (size_t i = 0; i < m_endpoints.size(); ++i)
+        {
+            if (!m_endpoints[i].transport->supportsCompression())
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Gets how messages are spread over the endpoints.
+     * @return The balance policy.
+     */
+    virtual BalancePolicy policy() const
+    {
+        return m_policy;
+    }
+
+    /**
+     * Gets the number of endpoints.
+     * @return The number of endpoints.
+     */
+    virtual size_t endpointCount() const
+    {
+        return m_endpoints.size();
+    }
+
+    /**
+     * Gets the number of endpoints not ejected.
+     * @return The number of live endpoints.
+     */
+    virtual size_t liveEndpoints() const
+    {
+        return m_liveEndpoints.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the transport of an endpoint.
+     * @param anIndex The endpoint, in configured order.
+     * @return The transport.
+     */
+    virtual ITransport& endpoint(const size_t &anIndex)
+    {
+        return *m_endpoints[anIndex].transport;
+    }
+
+    /**
+     * Gets the number of messages sent to an endpoint.
+     * @param anIndex The endpoint, in configured order.
+     * @return The number of messages.
+     */
+    virtual uint64_t sentMessages(const size_t &anIndex) const
+    {
+        return m_endpoints[anIndex].sentMessages;
+    }
+
+    /**
+     * Gets the number of times an endpoint was ejected.
+     * @param anIndex The endpoint, in configured order.
+     * @return The number of ejections.
+     */
+    virtual uint64_t ejections(const size_t &anIndex) const
+    {
+        return m_endpoints[anIndex].ejections;
+    }
+
+protected:
+
+    // Type Definitions
+
+    /**
+     * An endpoint and its health.
+     */
+    struct Endpoint
+    {
+        boost::shared_ptr<ITransport> transport; ///< Sends to the endpoint.
+        bool ejected; ///< Is it out of the rotation?
+        bool probation; ///< Has it come back without proving itself yet?
+        boost::posix_time::ptime returnTime; ///< When an ejected endpoint is tried again.
+        boost::posix_time::time_duration ejection; ///< How long the next ejection lasts.
+        uint64_t sentMessages; ///< Messages sent to it.
+        uint64_t ejections; ///< Times it was ejected.
+
+        Endpoint() :
+            ejected(false),
+            probation(false),
+            ejection(boost::posix_time::milliseconds(ENDPOINT_MIN_EJECTION_MS)),
+            sentMessages(0),
+            ejections(0)
+        {
+        }
+    };
+
+    // Members
+
+    BalancePolicy m_policy; ///< How messages are spread.
+    std::vector<Endpoint> m_endpoints; ///< The endpoints, in configured order.
+    size_t m_next; ///< Where the round-robin goes next.
+    size_t m_ejectedCount; ///< Endpoints out of the rotation.
+    boost::atomic<size_t> m_liveEndpoints; ///< Endpoints in the rotation.
+
+    // Methods
+
+    /**
+     * Sends a message to the endpoint the policy picks.
+     * @param aMessage The message to send: a string, a Buffer or Fragments.
+     */
+    template <typename Message>
+    void route(Message &aMessage)
+    {
+        size_t index = select(m_policy == BALANCE_HASH ? hashKey(aMessage) : 0);
+
+        m_endpoints[index].transport->send(aMessage);
+        sent(index);
+    }
+
+    /**
+     * Picks the endpoint for a message, first bringing back ejected endpoints
+     * whose time is up.
+     * @param aHash The hash of the message key, only needed for BALANCE_HASH.
+     * @return The index of the endpoint.
+     */
+    virtual size_t select(const uint32_t &aHash)
+    {
+        if (m_ejectedCount != 0)
+        {
+            readmit();
+        }
+
+        size_t count = m_endpoints.size();
+
+        if (m_ejectedCount == count)
+        {
+            return dueFirst();
+        }
+
+        size_t start;
+
+        switch (m_policy)
+        {
+        case BALANCE_FAILOVER:
+            start = 0;
+            break;
+
+        case BALANCE_HASH:
+            start = aHash % count;
+            break;
+
+        case BALANCE_LEAST_OUTSTANDING:
+            return leastOutstanding();
+
+        default:
+            start = m_next;
+            break;
+        }
+
+        // The first live endpoint from the start
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t index = (start + i) % count;
+
+            if (!m_endpoints[index].ejected)
+            {
+                // Carry on after it, so that the live endpoints get equal shares
+                if (m_policy == BALANCE_ROUND_ROBIN)
+                {
+                    m_next = (index + 1) % count;
+                }
+
+                return index;
+            }
+        }
+
+        return start;
+    }
+
+    /**
+     * Picks the live endpoint with the fewest pending messages. Ties are
+     * broken round-robin, so that transports that send right away and never
+     * have messages pending still share the load.
+     * @return The index of the endpoint.
+     */
+    size_t leastOutstanding()
+    {
+        size_t count = m_endpoints.size();
+        size_t best = count;
+        size_t bestPending = 0;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t index = (m_next + i) % count;
+
+            if (m_endpoints[index].ejected)
+            {
+                continue;
+            }
+
+            size_t pending = m_endpoints[index].transport->pendingMessages();
+
+            if (best == count || pending < bestPending)
+            {
+                best = index;
+                bestPending = pending;
+            }
+        }
+
+        m_next = (m_next + 1) % count;
+
+        return best;
+    }
+
+    /**
+     * Picks the ejected endpoint due back first.
+     * @return The index of the endpoint.
+     */
+    size_t dueFirst() const
+    {
+        size_t first = 0;
+
+        for (size_t i = 1; i < m_endpoints.size(); ++i)
+        {
+            if (m_endpoints[i].returnTime < m_endpoints[first].returnTime)
+            {
+                first = i;
+            }
+        }
+
+        return first;
+    }
+
+    /**
+     * Counts a message sent to an endpoint, and ejects the endpoint if the
+     * send showed it to be unhealthy.
+     * @param anIndex The endpoint.
+     */
+    void sent(const size_t &anIndex)
+    {
+        Endpoint &endpoint = m_endpoints[anIndex];
+
+        ++endpoint.sentMessages;
+
+        if (!endpoint.ejected && !endpoint.transport->healthy())
+        {
+            eject(anIndex);
+        }
+    }
+
+    /**
+     * Takes an endpoint out of the rotation until its ejection time is up,
+     * and doubles its next ejection time.
+     * @param anIndex The endpoint.
+     */
+    void eject(const size_t &anIndex)
+    {
+        Endpoint &endpoint = m_endpoints[anIndex];
+
+        if (endpoint.ejected)
+        {
+            return;
+        }
+
+        endpoint.ejected = true;
+        endpoint.probation = false;
+        endpoint.returnTime = boost::posix_time::microsec_clock::universal_time() + endpoint.ejection;
+        endpoint.ejection = std::min(endpoint.ejection * 2,
+                                     boost::posix_time::time_duration(
+                                         boost::posix_time::milliseconds(ENDPOINT_MAX_EJECTION_MS)));
+        ++endpoint.ejections;
+
+        ++m_ejectedCount;
+        m_liveEndpoints.fetch_sub(1, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Brings back the ejected endpoints whose ejection time is up.
+     */
+    void readmit()
+    {
+        boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+        for (size_t i = 0; i < m_endpoints.size(); ++i)
+        {
+            Endpoint &endpoint = m_endpoints[i];
+
+            if (endpoint.ejected && now >= endpoint.returnTime)
+            {
+                endpoint.ejected = false;
+                endpoint.probation = true;
+
+                --m_ejectedCount;
+                m_liveEndpoints.fetch_add(1, boost::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Hashes the key of a message: its length, HASH_KEY_LENGTH bytes at each
+     * end of it and HASH_KEY_LENGTH bytes spread over it.
+     * @param aMessage The message.
+     * @return The hash.
+     */
+    static uint32_t hashKey(const string &aMessage)
+    {
+        Fragment fragment = boost::asio::buffer(aMessage.data(), aMessage.length());
+
+        return hashKey(Fragments(&fragment, 1));
+    }
+
+    /**
+     * Hashes the key of a message: its length, HASH_KEY_LENGTH bytes at each
+     * end of it and HASH_KEY_LENGTH bytes spread over it.
+     * @param aMessage The message.
+     * @return The hash.
+     */
+    static uint32_t hashKey(const Buffer &aMessage)
+    {
+        Fragment fragment = boost::asio::buffer(aMessage.data(), aMessage.length());
+
+        return hashKey(Fragments(&fragment, 1));
+    }
+
+    /**
+     * Hashes the key of a message in fragments, without putting them
+     * together: its length, HASH_KEY_LENGTH bytes at each end of it and
+     * HASH_KEY_LENGTH bytes spread over it.
+     * @param aMessage The fragments of the message.
+     * @return The hash, the same as for the whole message.
+     */
+    static uint32_t hashKey(const Fragments &aMessage)
+    {
+        uint64_t length = aMessage.length();
+        uint32_t hashed = hash(2166136261u, reinterpret_cast<const char*>(&length), sizeof(length));
+
+        // A short message is hashed whole
+        if (length <= 3 * HASH_KEY_LENGTH)
+        {
+            return hash(hashed, aMessage, 0, length);
+        }
+
+        hashed = hash(hashed, aMessage, 0, HASH_KEY_LENGTH);
+        hashed = sample(hashed, aMessage, length / HASH_KEY_LENGTH);
+
+        return hash(hashed, aMessage, length - HASH_KEY_LENGTH, length);
+    }
+
+    /**
+     * Adds HASH_KEY_LENGTH bytes of a message in fragments to a hash, one in
+     * the middle of each stride.
+     * @param aHash The hash so far.
+     * @param aMessage The fragments of the message.
+     * @param aStride The distance between the bytes, at least 1.
+     * @return The hash.
+     */
+    static uint32_t sample(uint32_t aHash, const Fragments &aMessage, const size_t &aStride)
+    {
+        size_t offset = aStride / 2;
+        size_t samples = 0;
+
+        for (size_t i = 0; i < aMessage.count() && samples < HASH_KEY_LENGTH; ++i)
+        {
+            const Fragment &fragment = aMessage.fragments()[i];
+            const char *data = boost::asio::buffer_cast<const char*>(fragment);
+            size_t size = boost::asio::buffer_size(fragment);
+
+            for (; offset < size && samples < HASH_KEY_LENGTH; offset += aStride, ++samples)
+            {
+                aHash = hash(aHash, data + offset, 1);
+            }
+
+            // Offset into the next fragment
+            offset -= std::min(offset, size);
+        }
+
+        return aHash;
+    }
+
+    /**
+     * Adds a range of the bytes of a message in fragments to a hash.
+     * @param aHash The hash so far.
+     * @param aMessage The fragments of the message.
+     * @param aBegin The offset of the first byte.
+     * @param anEnd The offset after the last byte.
+     * @return The hash.
+     */
+    static uint32_t hash(uint32_t aHash, const Fragments &aMessage, size_t aBegin, size_t anEnd)
+    {
+        for (size_t i = 0; i < aMessage.count(); ++i)
+        {
+            const Fragment &fragment = aMessage.fragments()[i];
+            size_t size = boost::asio::buffer_size(fragment);
+
+            if (aBegin < size)
+            {
+                size_t end = std::min(size, anEnd);
+                aHash = hash(aHash, boost::asio::buffer_cast<const char*>(fragment) + aBegin, end - aBegin);
+                aBegin = end;
+            }
+
+            if (anEnd <= size)
+            {
+                break;
+            }
+
+            // Offsets into the next fragment
+            aBegin -= size;
+            anEnd -= size;
+        }
+
+        return aHash;
+    }
+
+    /**
+     * Adds bytes to a 32-bit FNV-1a hash.
+     * @param aHash The hash so far.
+     * @param aData The bytes.
+     * @param aLength The number of bytes.
+     * @return The hash.
+     */
+    static uint32_t hash(uint32_t aHash, const char *aData, const size_t &aLength)
+    {
+        for (size_t i = 0; i < aLength; ++i)
+        {
+            aHash = (aHash ^ (unsigned char) aData[i]) * 16777619u;
+        }
+
+        return aHash;
+    }
+};
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(MULTIENDPOINTTRANSPORT_HPP)
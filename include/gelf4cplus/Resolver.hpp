@@ -0,0 +1,338 @@
+/*
+ * File:   Resolver.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(RESOLVER_HPP)
+#define RESOLVER_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+// Third-party Headers
+
+#define BOOST_SYSTEM_NO_LIB
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+using std::string;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const long DEFAULT_DNS_REFRESH_MS = 30000; ///< Time between resolutions.
+const long DNS_RETRY_MS = 1000; ///< Time before retrying a failed resolution.
+const long RESOLVER_STOP_WAIT_MS = 100; ///< Longest the destructor waits for a lookup.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * Resolves a host name in the background and keeps the addresses, so that
+ * transports never wait on DNS.
+ *
+ * A host given as an IP address is taken as is. Otherwise a thread looks the
+ * name up straight away and again every refresh interval, or sooner when a
+ * transport asks for it because the address it uses has stopped working. A
+ * failed lookup keeps the last addresses and is retried after DNS_RETRY_MS.
+ * The generation goes up whenever the addresses change, so that transports
+ * can tell cheaply when to pick a new one.
+ *
+ * All methods are thread-safe.
+ */
+class Resolver : private boost::noncopyable
+{
+public:
+
+    // Type Definitions
+
+    typedef std::vector<boost::asio::ip::address> Addresses; ///< Resolved addresses.
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor, which starts resolving in the background.
+     * @param aHost A host name or IP address.
+     * @param aPort The port the addresses are used with.
+     * @param anIpv4Only True to keep only IPv4 addresses.
+     * @param aRefreshMs Time in ms between resolutions.
+     */
+    Resolver(const string &aHost,
+             const int &aPort,
+             const bool &anIpv4Only = false,
+             const long &aRefreshMs = DEFAULT_DNS_REFRESH_MS) :
+        m_state(new State(aHost, aPort, anIpv4Only, aRefreshMs))
+    {
+        boost::system::error_code error;
+        boost::asio::ip::address address = boost::asio::ip::address::from_string(aHost, error);
+
+        if (!error && (address.is_v4() || !anIpv4Only))
+        {
+            m_state->addresses.push_back(address);
+            m_state->generation.store(1);
+
+            return;
+        }
+
+        m_thread.reset(new boost::thread(boost::bind(&Resolver::resolveLoop, m_state)));
+    }
+
+    /**
+     * The destructor, which stops the background thread. A lookup still
+     * running after RESOLVER_STOP_WAIT_MS is left to finish on its own.
+     */
+    ~Resolver()
+    {
+        if (!m_thread)
+        {
+            return;
+        }
+
+        {
+            boost::lock_guard<boost::mutex> lock(m_state->mutex);
+            m_state->stopping = true;
+            m_state->condition.notify_all();
+        }
+
+        if (!m_thread->timed_join(boost::posix_time::milliseconds(RESOLVER_STOP_WAIT_MS)))
+        {
+            m_thread->detach();
+        }
+    }
+
+    // Methods
+
+    /**
+     * Gets the host being resolved.
+     * @return The host name or IP address.
+     */
+    const string& host() const
+    {
+        return m_state->host;
+    }
+
+    /**
+     * Gets the port the addresses are used with.
+     * @return The port.
+     */
+    int port() const
+    {
+        return m_state->port;
+    }
+
+    /**
+     * Has the host been resolved at least once?
+     * @return True if addresses() is not empty.
+     */
+    bool resolved() const
+    {
+        return generation() != 0;
+    }
+
+    /**
+     * Gets the number of times the addresses have changed, zero until the
+     * host has been resolved.
+     * @return The generation of the addresses.
+     */
+    uint64_t generation() const
+    {
+        return m_state->generation.load(boost::memory_order_acquire);
+    }
+
+    /**
+     * Gets the addresses the host last resolved to.
+     * @return The addresses, in the order the lookup gave them.
+     */
+    Addresses addresses() const
+    {
+        boost::lock_guard<boost::mutex> lock(m_state->mutex);
+
+        return m_state->addresses;
+    }
+
+    /**
+     * Gets the number of lookups that failed.
+     * @return The number of failures.
+     */
+    uint64_t failures() const
+    {
+        return m_state->failures.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Asks for the host to be resolved again now rather than at the next
+     * refresh. Does not wait for the result.
+     */
+    void refresh()
+    {
+        if (!m_thread)
+        {
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(m_state->mutex);
+        m_state->refreshRequested = true;
+        m_state->condition.notify_all();
+    }
+
+    /**
+     * Waits until the host has been resolved at least once.
+     * @param aTimeoutMs The longest to wait.
+     * @return True if resolved.
+     */
+    bool waitUntilResolved(const long &aTimeoutMs) const
+    {
+        boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() +
+                boost::posix_time::milliseconds(aTimeoutMs);
+        boost::unique_lock<boost::mutex> lock(m_state->mutex);
+
+        while (!resolved())
+        {
+            if (!m_state->condition.timed_wait(lock, deadline))
+            {
+                return resolved();
+            }
+        }
+
+        return true;
+    }
+
+protected:
+
+    // Type Definitions
+
+    /**
+     * What the resolver shares with its thread, which may outlive it.
+     */
+    struct State : private boost::noncopyable
+    {
+        const string host; ///< The host to resolve.
+        const int port; ///< The port the addresses are used with.
+        const bool ipv4Only; ///< Keep only IPv4 addresses?
+        const boost::posix_time::time_duration refreshInterval; ///< Between lookups.
+        mutable boost::mutex mutex; ///< Guards the members below.
+        boost::condition_variable condition; ///< Wakes the thread and waiters.
+        Addresses addresses; ///< The last addresses resolved.
+        bool stopping; ///< Should the thread exit?
+        bool refreshRequested; ///< Should the thread resolve now?
+        boost::atomic<uint64_t> generation; ///< Bumped when the addresses change.
+        boost::atomic<uint64_t> failures; ///< Lookups that failed.
+
+        State(const string &aHost, const int &aPort, const bool &anIpv4Only, const long &aRefreshMs) :
+            host(aHost),
+            port(aPort),
+            ipv4Only(anIpv4Only),
+            refreshInterval(boost::posix_time::milliseconds(aRefreshMs)),
+            stopping(false),
+            refreshRequested(false),
+            generation(0),
+            failures(0)
+        {
+        }
+    };
+
+    // Attributes
+
+    boost::shared_ptr<State> m_state; ///< Shared with the thread.
+    boost::scoped_ptr<boost::thread> m_thread; ///< Resolves host names.
+
+    // Methods
+
+    /**
+     * The body of the thread. Resolves the host, then sleeps until the next
+     * refresh, a refresh request or the resolver is destroyed.
+     * @param aState The resolver's state.
+     */
+    static void resolveLoop(const boost::shared_ptr<State> &aState)
+    {
+        boost::asio::io_service service;
+        boost::asio::ip::tcp::resolver resolver(service);
+        boost::asio::ip::tcp::resolver::query query(aState->host,
+                                                    boost::lexical_cast<string>(aState->port));
+
+        boost::unique_lock<boost::mutex> lock(aState->mutex);
+
+        while (!aState->stopping)
+        {
+            aState->refreshRequested = false;
+            lock.unlock();
+
+            // The lookup may take a while, so don't hold the lock
+            Addresses addresses;
+            boost::system::error_code error;
+            boost::asio::ip::tcp::resolver::iterator entry = resolver.resolve(query, error);
+
+            for (; !error && entry != boost::asio::ip::tcp::resolver::iterator(); ++entry)
+            {
+                boost::asio::ip::address address = entry->endpoint().address();
+
+                if ((address.is_v4() || !aState->ipv4Only) &&
+                    std::find(addresses.begin(), addresses.end(), address) == addresses.end())
+                {
+                    addresses.push_back(address);
+                }
+            }
+
+            lock.lock();
+
+            bool succeeded = !addresses.empty();
+
+            if (!succeeded)
+            {
+                aState->failures.fetch_add(1, boost::memory_order_relaxed);
+            }
+            else if (addresses != aState->addresses)
+            {
+                aState->addresses.swap(addresses);
+                aState->generation.fetch_add(1, boost::memory_order_release);
+                aState->condition.notify_all();
+            }
+
+            // Requests to resolve sooner wait at least DNS_RETRY_MS, so that
+            // a transport failing on every send does not flood the DNS server
+            boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+            boost::posix_time::ptime earliest = now + boost::posix_time::milliseconds(DNS_RETRY_MS);
+            boost::posix_time::ptime deadline = succeeded ? now + aState->refreshInterval : earliest;
+
+            while (!aState->stopping)
+            {
+                boost::posix_time::ptime wakeup = aState->refreshRequested ? std::min(earliest, deadline) : deadline;
+
+                if (boost::posix_time::microsec_clock::universal_time() >= wakeup)
+                {
+                    break;
+                }
+
+                aState->condition.timed_wait(lock, wakeup);
+            }
+        }
+    }
+};
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(RESOLVER_HPP)
@@ -0,0 +1,380 @@
+/*
+ * File:   ShardedEventQueue.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(SHARDEDEVENTQUEUE_HPP)
+#define SHARDEDEVENTQUEUE_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Header Files
+
+#include <cstddef>
+#include <vector>
+
+// Third-party Header Files
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+// Other Header Files
+
+#include "EventQueue.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace appender
+{
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t DEFAULT_SHARD_SIZE = 1024; ///< The default per-thread queue size.
+const size_t SHARD_BURST = 64; ///< Events taken from a shard before the next.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * The queue between the logging threads and the sender thread. Unsharded it
+ * is a single EventQueue that every thread pushes into. Sharded, each logging
+ * thread gets its own EventQueue the first time it logs, so producers never
+ * touch the same cache lines, and the single consumer takes up to SHARD_BURST
+ * events from each shard in turn. Events of one thread stay in order; events
+ * of different threads are only ordered by their timestamps.
+ *
+ * A thread's shard is retired when the thread exits and dropped once the
+ * consumer has emptied it.
+ */
+class ShardedEventQueue : private boost::noncopyable
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor.
+     * @param aCapacity The size of the queue, or of each shard.
+     * @param aSharded True to give each logging thread its own queue.
+     */
+    ShardedEventQueue(const size_t &aCapacity, const bool &aSharded) :
+        m_capacity(aCapacity),
+        m_sharded(aSharded),
+        m_id(nextId()),
+        m_generation(0),
+        m_retiredShards(new boost::atomic<size_t>(0)),
+        m_seenGeneration(0),
+        m_current(0),
+        m_burst(0),
+        m_claimed(NULL)
+    {
+        if (!m_sharded)
+        {
+            m_shards.push_back(boost::shared_ptr<Shard>(new Shard(m_capacity)));
+            m_snapshot = m_shards;
+        }
+    }
+
+    // Methods
+
+    /**
+     * Is each logging thread given its own queue?
+     * @return True if sharded.
+     */
+    bool sharded() const
+    {
+        return m_sharded;
+    }
+
+    /**
+     * Gets the queue the calling thread pushes into, creating its shard the
+     * first time the thread logs.
+     * @return The queue.
+     */
+    EventQueue& local()
+    {
+        if (!m_sharded)
+        {
+            return m_shards.front()->queue;
+        }
+
+        LocalShard *local = m_local.get();
+
+        // A shard left by an earlier queue at the same address is not ours
+        if (local == NULL || local->owner != m_id)
+        {
+            local = new LocalShard(m_id, boost::shared_ptr<Shard>(new Shard(m_capacity)),
+                                   m_retiredShards);
+
+            {
+                boost::lock_guard<boost::mutex> lock(m_mutex);
+                m_shards.push_back(local->shard);
+            }
+
+            m_generation.fetch_add(1, boost::memory_order_release);
+            m_local.reset(local);
+        }
+
+        return local->shard->queue;
+    }
+
+    /**
+     * Claims the next event to process. Must only be called from the single
+     * consumer, and each event claimed must be handed back with pop() before
+     * the next claim.
+     * @return The event or NULL if every shard is empty.
+     */
+    CapturedEvent* claim()
+    {
+        refresh();
+
+        if (m_snapshot.empty())
+        {
+            return NULL;
+        }
+
+        // One more step than there are shards, so the shard whose burst ran
+        // out is tried again after all the others
+        for (size_t i = 0; i <= m_snapshot.size(); ++i)
+        {
+            if (m_burst < SHARD_BURST)
+            {
+                EventQueue &queue = m_snapshot[m_current]->queue;
+
+                if (CapturedEvent *event = queue.claim())
+                {
+                    ++m_burst;
+                    m_claimed = &queue;
+
+                    return event;
+                }
+            }
+
+            m_current = (m_current + 1) % m_snapshot.size();
+            m_burst = 0;
+        }
+
+        pruneRetiredShards();
+
+        return NULL;
+    }
+
+    /**
+     * Hands the event returned by claim() back. Must only be called from the
+     * single consumer.
+     */
+    void pop()
+    {
+        m_claimed->pop();
+    }
+
+    /**
+     * Is every shard empty? Must only be called from the single consumer.
+     * @return True if no event is waiting to be consumed.
+     */
+    bool empty()
+    {
+        refresh();
+
+        for (size_t i = 0; i < m_snapshot.size(); ++i)
+        {
+            if (!m_snapshot[i]->queue.empty())
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Gets the approximate number of queued events in all shards. Must only
+     * be called from the single consumer.
+     * @return The number of queued events.
+     */
+    size_t size()
+    {
+        refresh();
+
+        size_t size = 0;
+
+        for (size_t i = 0; i < m_snapshot.size(); ++i)
+        {
+            size += m_snapshot[i]->queue.size();
+        }
+
+        return size;
+    }
+
+    /**
+     * Gets the number of slots in all shards. Must only be called from the
+     * single consumer.
+     * @return The capacity.
+     */
+    size_t capacity()
+    {
+        refresh();
+
+        size_t capacity = 0;
+
+        for (size_t i = 0; i < m_snapshot.size(); ++i)
+        {
+            capacity += m_snapshot[i]->queue.capacity();
+        }
+
+        // Never zero, since it is used as a divisor
+        return capacity == 0 ? 1 : capacity;
+    }
+
+protected:
+
+    // Type Definitions
+
+    /**
+     * The queue of one logging thread.
+     */
+    struct Shard : private boost::noncopyable
+    {
+        EventQueue queue; ///< The events.
+        boost::atomic<bool> retired; ///< Has the thread exited?
+
+        explicit Shard(const size_t &aCapacity) :
+            queue(aCapacity),
+            retired(false)
+        {
+        }
+    };
+
+    /**
+     * What a logging thread keeps of its shard. Destroyed when the thread
+     * exits, which retires the shard; the shard itself lives on until the
+     * consumer has emptied it.
+     */
+    struct LocalShard : private boost::noncopyable
+    {
+        uint64_t owner; ///< The id of the queue the shard belongs to.
+        boost::shared_ptr<Shard> shard; ///< The shard.
+        boost::shared_ptr< boost::atomic<size_t> > retiredShards; ///< The owner's count.
+
+        LocalShard(const uint64_t &anOwner,
+                   const boost::shared_ptr<Shard> &aShard,
+                   const boost::shared_ptr< boost::atomic<size_t> > &aRetiredShards) :
+            owner(anOwner),
+            shard(aShard),
+            retiredShards(aRetiredShards)
+        {
+        }
+
+        ~LocalShard()
+        {
+            shard->retired.store(true, boost::memory_order_release);
+            retiredShards->fetch_add(1, boost::memory_order_release);
+        }
+    };
+
+    typedef std::vector< boost::shared_ptr<Shard> > Shards;
+
+    // Attributes
+
+    const size_t m_capacity; ///< The size of each shard.
+    const bool m_sharded; ///< One shard per thread?
+    const uint64_t m_id; ///< Tells this queue's shards from an earlier one's.
+    boost::thread_specific_ptr<LocalShard> m_local; ///< The calling thread's shard.
+    boost::mutex m_mutex; ///< Guards m_shards.
+    Shards m_shards; ///< Every live shard.
+    boost::atomic<uint64_t> m_generation; ///< Bumped whenever m_shards changes.
+    boost::shared_ptr< boost::atomic<size_t> > m_retiredShards; ///< Shards to prune.
+
+    // Consumer Attributes
+
+    Shards m_snapshot; ///< The consumer's copy of m_shards.
+    uint64_t m_seenGeneration; ///< The generation of m_snapshot.
+    size_t m_current; ///< The shard being drained.
+    size_t m_burst; ///< Events taken from it in a row.
+    EventQueue *m_claimed; ///< The queue of the claimed event.
+
+    // Methods
+
+    /**
+     * Picks up shards added since the consumer last looked.
+     */
+    void refresh()
+    {
+        uint64_t generation = m_generation.load(boost::memory_order_acquire);
+
+        if (generation == m_seenGeneration)
+        {
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        m_snapshot = m_shards;
+        m_seenGeneration = generation;
+
+        if (m_current >= m_snapshot.size())
+        {
+            m_current = 0;
+            m_burst = 0;
+        }
+    }
+
+    /**
+     * Drops the shards of exited threads once they are empty.
+     */
+    void pruneRetiredShards()
+    {
+        if (m_retiredShards->load(boost::memory_order_acquire) == 0)
+        {
+            return;
+        }
+
+        size_t pruned = 0;
+
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+
+            for (Shards::iterator shard = m_shards.begin(); shard != m_shards.end();)
+            {
+                if ((*shard)->retired.load(boost::memory_order_acquire) && (*shard)->queue.empty())
+                {
+                    shard = m_shards.erase(shard);
+                    ++pruned;
+                }
+                else
+                {
+                    ++shard;
+                }
+            }
+        }
+
+        if (pruned != 0)
+        {
+            m_retiredShards->fetch_sub(pruned, boost::memory_order_relaxed);
+            m_generation.fetch_add(1, boost::memory_order_release);
+        }
+    }
+
+    /**
+     * Draws an id that no other queue in the process has.
+     * @return The id.
+     */
+    static uint64_t nextId()
+    {
+        static boost::atomic<uint64_t> id(0);
+
+        return id.fetch_add(1, boost::memory_order_relaxed) + 1;
+    }
+};
+
+} // namespace appender
+} // namespace gelf4cplus
+
+#endif // #if !defined(SHARDEDEVENTQUEUE_HPP)
@@ -0,0 +1,481 @@
+/*
+ * File:   SpoolingTransport.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(SPOOLINGTRANSPORT_HPP)
+#define SPOOLINGTRANSPORT_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+
+// Third-party Headers
+
+#define BOOST_SYSTEM_NO_LIB
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Other Headers
+
+#include "ITransport.hpp"
+#include "DiskSpool.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+using std::string;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const double DEFAULT_SPOOL_REPLAY_RATE = 1000; ///< Messages replayed per second.
+const long DEFAULT_SPOOL_HEALTH_INTERVAL_MS = 1000; ///< Time between health checks.
+const long SPOOL_REPLAY_TICK_MS = 10; ///< Time between replay bursts.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A transport that keeps messages in a DiskSpool while the transport it wraps
+ * cannot deliver them, and replays them once it can.
+ *
+ * Messages go straight to the wrapped transport while it is healthy and the
+ * spool has been replayed. Once the wrapped transport reports itself
+ * unhealthy, or an optional TCP probe of the destination fails, messages are
+ * appended to the spool instead, as are messages the appender could not queue.
+ * A thread checks the health every health interval, giving the wrapped
+ * transport a chance to reconnect, and while healthy replays the spool oldest
+ * first at a steady rate so that a recovering server is not flooded. New
+ * messages keep going to the spool until all of it has been replayed, so they
+ * are not sent ahead of older ones.
+ *
+ * A replayed message stays in the spool until the next health check passes.
+ * A UDP transport only learns of an outage from ICMP rejections of datagrams
+ * already sent, so a burst replayed into an outage is replayed again rather
+ * than lost; its socket must be connected for the rejections to be reported.
+ * Messages may therefore be delivered twice.
+ *
+ * Spooled messages survive a restart; pendingMessages() does not count them.
+ */
+class SpoolingTransport : public ITransport
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor, which replays anything spooled by an earlier run.
+     * @param aTransport The transport to wrap, which this one takes over.
+     * @param aDirectory The directory for the segment files, which must exist.
+     * @param aSegmentSize The size of each segment file.
+     * @param aDiskBudget The most bytes the segment files may take up.
+     * @param aReplayRate The most spooled messages to replay per second.
+     * @param aHealthCheckHost A host to probe with a TCP connect, or empty to
+     * rely on the wrapped transport's own health.
+     * @param aHealthCheckPort The port to probe.
+     * @param aHealthIntervalMs Time in ms between health checks.
+     */
+    SpoolingTransport(ITransport *aTransport,
+                      const string &aDirectory,
+                      const size_t &aSegmentSize = DEFAULT_SPOOL_SEGMENT_SIZE,
+                      const uint64_t &aDiskBudget = DEFAULT_SPOOL_DISK_BUDGET,
+                      const double &aReplayRate = DEFAULT_SPOOL_REPLAY_RATE,
+                      const string &aHealthCheckHost = "",
+                      const int &aHealthCheckPort = DEFAULT_GRAYLOG2_PORT,
+                      const long &aHealthIntervalMs = DEFAULT_SPOOL_HEALTH_INTERVAL_MS) :
+                      m_transport(aTransport),
+                      m_spool(aDirectory, aSegmentSize, aDiskBudget),
+                      m_replayRate(aReplayRate > 0 ? aReplayRate : DEFAULT_SPOOL_REPLAY_RATE),
+                      m_healthCheckHost(aHealthCheckHost),
+                      m_healthCheckPort(boost::lexical_cast<string>(aHealthCheckPort)),
+                      m_healthInterval(boost::posix_time::milliseconds(aHealthIntervalMs)),
+                      m_healthy(true),
+                      m_running(true)
+    {
+        m_replayThread.reset(new boost::thread(
+                boost::bind(&SpoolingTransport::replayLoop, this)));
+    }
+
+    /**
+     * A virtual destructor in case someone wants to derive from this class.
+     * Stops replaying; whatever is still spooled is replayed by the next run.
+     */
+    virtual ~SpoolingTransport()
+    {
+        m_running.store(false);
+        m_replayThread->interrupt();
+        m_replayThread->join();
+    }
+
+    // Methods
+
+    using ITransport::send;
+
+    /**
+     * Sends a message, or spools it if it cannot be delivered now.
+     * @param aMessage The message to send.
+     */
+    virtual void send(const string &aMessage)
+    {
+        if (spooling())
+        {
+            m_spool.append(aMessage.data(), aMessage.length());
+
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_transport->send(aMessage);
+    }
+
+    /**
+     * Sends a message, letting the wrapped transport take its bytes, or spools
+     * it if it cannot be delivered now.
+     * @param aMessage The message to send.
+     */
+    virtual void send(Buffer &aMessage)
+    {
+        if (spooling())
+        {
+            m_spool.append(aMessage.data(), aMessage.length());
+
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_transport->send(aMessage);
+    }
+
+    /**
+     * Sends several messages, or spools them if they cannot be delivered now.
+     * @param aMessages The messages to send.
+     * @param aCount The number of messages.
+     */
+    virtual void sendBatch(Buffer *aMessages, const size_t &aCount)
+    {
+        if (spooling())
+        {
+            for (size_t i = 0; i < aCount; ++i)
+            {
+                m_spool.append(aMessages[i].data(), aMessages[i].length());
+            }
+
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_transport->sendBatch(aMessages, aCount);
+    }
+
+    /**
+     * Flushes the wrapped transport, and starts spooling if that showed it to
+     * be unhealthy.
+     */
+    virtual void flush()
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_transport->flush();
+
+        if (!m_transport->healthy())
+        {
+            m_healthy.store(false);
+            m_spool.rewind();
+        }
+    }
+
+    /**
+     * Must flush() be called for what was sent to go out? Spooled messages
+     * are on disk already, so only the wrapped transport can need it.
+     * @return True if the wrapped transport needs flushing.
+     */
+    virtual bool needsFlush() const
+    {
+        return m_transport->needsFlush();
+    }
+
+    /**
+     * Gets the number of messages pending in the wrapped transport. Spooled
+     * messages are not counted, since they are kept on disk.
+     * @return The number of messages still pending.
+     */
+    virtual size_t pendingMessages() const
+    {
+        return m_transport->pendingMessages();
+    }
+
+    /**
+     * Is the destination reachable, as of the last health check?
+     * @return True if messages are not being spooled for lack of health.
+     */
+    virtual bool healthy() const
+    {
+        return m_healthy.load();
+    }
+
+    /**
+     * Messages the appender could not queue are spooled.
+     * @return True.
+     */
+    virtual bool acceptsOverflow() const
+    {
+        return true;
+    }
+
+    /**
+     * Spools a message the appender could not queue. Thread-safe.
+     * @param aMessage The message.
+     * @return False if the disk budget is used up.
+     */
+    virtual bool overflow(const string &aMessage)
+    {
+        return m_spool.append(aMessage.data(), aMessage.length());
+    }
+
+    /**
+     * Gets the size of the largest message the wrapped transport can carry.
+     * @return The largest message size in bytes.
+     */
+    virtual size_t maxMessageSize() const
+    {
+        return m_transport->maxMessageSize();
+    }
+
+    /**
+     * Can the wrapped transport carry compressed GELF messages?
+     * @return True if messages should be compressed before sending.
+     */
+    virtual bool supportsCompression() const
+    {
+        return m_transport->supportsCompression();
+    }
+
+    /**
+     * Are messages being spooled rather than sent?
+     * @return True while the destination is unhealthy or the spool has not
+     * all been replayed.
+     */
+    virtual bool spooling() const
+    {
+        return !m_healthy.load() || !m_spool.allRead();
+    }
+
+    /**
+     * Gets the spool, for its counters.
+     * @return The spool.
+     */
+    const DiskSpool& spool() const
+    {
+        return m_spool;
+    }
+
+protected:
+
+    // Members
+
+    boost::scoped_ptr<ITransport> m_transport; ///< The wrapped transport.
+    DiskSpool m_spool; ///< Messages waiting for the destination.
+    double m_replayRate; ///< Messages replayed per second.
+    string m_healthCheckHost; ///< Host to probe, or empty.
+    string m_healthCheckPort; ///< Port to probe.
+    boost::posix_time::time_duration m_healthInterval; ///< Between health checks.
+    boost::mutex m_mutex; ///< Serializes use of the wrapped transport.
+    boost::atomic<bool> m_healthy; ///< Result of the last health check.
+    boost::atomic<bool> m_running; ///< Should the replay thread go on?
+    string m_replayMessage; ///< The spooled message being replayed.
+    boost::scoped_ptr<boost::thread> m_replayThread; ///< Checks health and replays.
+
+    // Methods
+
+    /**
+     * The body of the replay thread. Checks the health every health interval
+     * and replays the spool a tick's worth of messages at a time.
+     */
+    virtual void replayLoop()
+    {
+        using boost::posix_time::ptime;
+        using boost::posix_time::microsec_clock;
+
+        ptime lastCheck = boost::posix_time::min_date_time;
+        ptime lastTick = microsec_clock::universal_time();
+        double tokens = 0;
+
+        // A tick's worth, but at least one message per tick
+        const double burst = std::max(1.0, m_replayRate * SPOOL_REPLAY_TICK_MS / 1000.0);
+
+        try
+        {
+            while (m_running.load())
+            {
+                ptime now = microsec_clock::universal_time();
+
+                if (now - lastCheck >= m_healthInterval)
+                {
+                    lastCheck = now;
+                    m_healthy.store(checkHealth());
+
+                    // What was replayed since the last check has arrived,
+                    // or is replayed again
+                    if (m_healthy.load())
+                    {
+                        m_spool.confirm();
+                    }
+                    else
+                    {
+                        m_spool.rewind();
+                    }
+                }
+
+                tokens = std::min(burst, tokens + m_replayRate *
+                                  (now - lastTick).total_microseconds() / 1000000.0);
+                lastTick = now;
+
+                // Leave a tick before each check for rejections to come back
+                if (m_healthy.load() &&
+                    now + boost::posix_time::milliseconds(SPOOL_REPLAY_TICK_MS) < lastCheck + m_healthInterval)
+                {
+                    tokens -= replay((size_t) tokens);
+                }
+
+                boost::this_thread::sleep(boost::posix_time::milliseconds(SPOOL_REPLAY_TICK_MS));
+            }
+        }
+        catch (const boost::thread_interrupted&)
+        {
+        }
+    }
+
+    /**
+     * Sends spooled messages to the wrapped transport, oldest first. They
+     * stay in the spool until the next health check confirms them.
+     * @param aLimit The most messages to send.
+     * @return The number of messages sent.
+     */
+    virtual size_t replay(const size_t &aLimit)
+    {
+        size_t replayed = 0;
+
+        if (aLimit == 0 || m_spool.allRead())
+        {
+            return 0;
+        }
+
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        while (replayed < aLimit && m_spool.read(m_replayMessage))
+        {
+            m_transport->send(m_replayMessage);
+            ++replayed;
+        }
+
+        m_transport->flush();
+
+        // Some of what was replayed since the last check may be lost
+        if (!m_transport->healthy())
+        {
+            m_healthy.store(false);
+            m_spool.rewind();
+        }
+
+        return replayed;
+    }
+
+    /**
+     * Checks whether the destination is reachable. The wrapped transport is
+     * flushed first, which lets it reconnect.
+     * @return True if healthy.
+     */
+    virtual bool checkHealth()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            m_transport->flush();
+
+            if (!m_transport->healthy())
+            {
+                return false;
+            }
+        }
+
+        return m_healthCheckHost.empty() || probe();
+    }
+
+    /**
+     * Connects to the health check host, giving up after a health interval.
+     * @return True if the connection succeeded.
+     */
+    virtual bool probe()
+    {
+        boost::asio::io_service service;
+        boost::asio::ip::tcp::resolver resolver(service);
+        boost::asio::ip::tcp::resolver::query query(m_healthCheckHost, m_healthCheckPort);
+        boost::system::error_code error;
+        boost::asio::ip::tcp::resolver::iterator endpoints = resolver.resolve(query, error);
+
+        if (error)
+        {
+            return false;
+        }
+
+        boost::asio::ip::tcp::socket socket(service);
+        boost::asio::deadline_timer timer(service, m_healthInterval);
+
+        // Whichever finishes first cancels the other
+        error = boost::asio::error::would_block;
+        boost::asio::async_connect(socket, endpoints,
+                boost::bind(&SpoolingTransport::probeConnected, _1, &error, &timer));
+        timer.async_wait(boost::bind(&SpoolingTransport::probeTimedOut, _1, &socket));
+        service.run();
+
+        return !error;
+    }
+
+    /**
+     * Completion handler of the probe's connect.
+     * @param anError The result of the connect.
+     * @param aResult Where to store it.
+     * @param aTimer The timeout to cancel.
+     */
+    static void probeConnected(const boost::system::error_code &anError,
+                               boost::system::error_code *aResult,
+                               boost::asio::deadline_timer *aTimer)
+    {
+        *aResult = anError;
+        aTimer->cancel();
+    }
+
+    /**
+     * Completion handler of the probe's timeout.
+     * @param anError Set if the timer was cancelled.
+     * @param aSocket The socket to close if the connect is still going.
+     */
+    static void probeTimedOut(const boost::system::error_code &anError,
+                              boost::asio::ip::tcp::socket *aSocket)
+    {
+        if (anError != boost::asio::error::operation_aborted)
+        {
+            boost::system::error_code error;
+            aSocket->close(error);
+        }
+    }
+};
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(SPOOLINGTRANSPORT_HPP)
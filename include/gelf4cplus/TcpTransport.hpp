@@ -0,0 +1,535 @@
+/*
+ * File:   TcpTransport.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(TCPTRANSPORT_HPP)
+#define TCPTRANSPORT_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Third-party Headers
+
+#define BOOST_SYSTEM_NO_LIB
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+// Other Headers
+
+#include "ITransport.hpp"
+#include "Resolver.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace transport
+{
+
+using std::string;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t DEFAULT_TCP_BATCH_SIZE = 64; ///< Frames written per gather write.
+const size_t DEFAULT_TCP_MAX_PENDING_BYTES = 8 * 1024 * 1024; ///< Buffer limit.
+const long TCP_MIN_RECONNECT_DELAY_MS = 100; ///< First reconnect backoff.
+const long TCP_MAX_RECONNECT_DELAY_MS = 30000; ///< Longest reconnect backoff.
+const long DEFAULT_TCP_CONNECT_TIMEOUT_MS = 1000; ///< Longest a connect may take.
+const long DEFAULT_TCP_WRITE_TIMEOUT_MS = 1000; ///< Longest a write may take.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * This class defines a TCP transport for use with the GELF appender. Messages
+ * are sent uncompressed and terminated by a null byte over one persistent
+ * connection. Frames are buffered until flush() is called or a batch is full,
+ * and are then written with a single gather write. If the connection drops,
+ * unsent frames are kept and the transport reconnects with an exponential
+ * backoff. Messages that arrive while the buffer is full are dropped.
+ *
+ * Connects and writes run on the transport's own io_service with a timeout,
+ * so an unreachable host or a server that stops reading holds up the caller
+ * for at most the connect or write timeout. A write that times out counts as
+ * a dropped connection.
+ *
+ * The host name is resolved in the background, so the transport never waits
+ * for DNS; a connection tries every resolved address, and a failed one has
+ * the name resolved again.
+ */
+class TcpTransport : public ITransport
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The default constructor.
+     * @param aDstHost A destination host name.
+     * @param aDstPort A destination port.
+     * @param aMaxBatchSize The number of frames to buffer before writing.
+     * @param aMaxPendingBytes The most bytes to buffer while disconnected.
+     * @param aDnsRefreshMs Time in ms between resolutions of the host name.
+     */
+    TcpTransport(const string &aDstHost = "localhost",
+                 const int &aDstPort = DEFAULT_GRAYLOG2_PORT,
+                 const size_t &aMaxBatchSize = DEFAULT_TCP_BATCH_SIZE,
+                 const size_t &aMaxPendingBytes = DEFAULT_TCP_MAX_PENDING_BYTES,
+                 const long &aDnsRefreshMs = DEFAULT_DNS_REFRESH_MS) :
+                 m_resolver(aDstHost, aDstPort, false, aDnsRefreshMs),
+                 m_maxBatchSize(aMaxBatchSize == 0 ? 1 : aMaxBatchSize),
+                 m_maxPendingBytes(aMaxPendingBytes),
+                 m_socket(m_service),
+                 m_timer(m_service),
+                 m_connectTimeout(boost::posix_time::milliseconds(DEFAULT_TCP_CONNECT_TIMEOUT_MS)),
+                 m_writeTimeout(boost::posix_time::milliseconds(DEFAULT_TCP_WRITE_TIMEOUT_MS)),
+                 m_frameCount(0),
+                 m_pendingBytes(0),
+                 m_droppedMessages(0),
+                 m_connected(false),
+                 m_reconnectDelay(boost::posix_time::milliseconds(TCP_MIN_RECONNECT_DELAY_MS)),
+                 m_nextConnectAttempt(boost::posix_time::min_date_time)
+    {
+        // Connects once the host name is resolved, so a first flush may
+        // find nothing to connect to; it is retried on the next one
+        connect();
+    }
+
+    /**
+     * A virtual destructor in case someone wants to derive from this class.
+     * Makes one last attempt to write any buffered frames.
+     */
+    virtual ~TcpTransport()
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    // Methods
+
+    /**
+     * Buffers a message, writing the batch if it is full.
+     * @param aMessage The message to send.
+     */
+    virtual void send(const string &aMessage)
+    {
+        enqueue(aMessage);
+    }
+
+    /**
+     * Buffers a message, sharing its bytes until they are written, and writes
+     * the batch if it is full.
+     * @param aMessage The message to send.
+     */
+    virtual void send(Buffer &aMessage)
+    {
+        enqueue(aMessage);
+    }
+
+    /**
+     * Buffers a message made up of several fragments, gathering them straight
+     * into the frame, and writes the batch if it is full.
+     * @param aMessage The fragments of the message to send.
+     */
+    virtual void send(const Fragments &aMessage)
+    {
+        enqueue(aMessage);
+    }
+
+    /**
+     * Writes all buffered frames with as few system calls as possible.
+     */
+    virtual void flush()
+    {
+        if (m_frameCount == 0 || (!m_socket.is_open() && !connect()))
+        {
+            return;
+        }
+
+        static const char DELIMITER = '\0';
+
+        // Gather all messages and their delimiters into one buffer sequence
+        m_buffers.clear();
+
+        for (size_t i = 0; i < m_frameCount; ++i)
+        {
+            m_buffers.push_back(boost::asio::buffer(m_frames[i].data(), m_frames[i].length()));
+            m_buffers.push_back(boost::asio::buffer(&DELIMITER, 1));
+        }
+
+        // Written asynchronously so that a stalled server can't block us
+        boost::system::error_code error = boost::asio::error::would_block;
+        size_t written = 0;
+
+        boost::asio::async_write(m_socket, m_buffers,
+                boost::bind(&TcpTransport::writeCompleted, _1, _2, &error, &written, &m_timer));
+        runWithTimeout(m_writeTimeout, &error);
+
+        if (!error)
+        {
+            releaseFrames(0, m_frameCount);
+            m_frameCount = 0;
+            m_pendingBytes = 0;
+
+            return;
+        }
+
+        // Keep the frames that did not make it out in full for the next
+        // connection; the receiver drops a frame cut off by a disconnect
+        size_t sent = 0;
+
+        while (sent < m_frameCount && written >= m_frames[sent].length() + 1)
+        {
+            written -= m_frames[sent].length() + 1;
+            m_pendingBytes -= m_frames[sent].length() + 1;
+            ++sent;
+        }
+
+        if (sent != 0)
+        {
+            releaseFrames(0, sent);
+
+            for (size_t i = sent; i < m_frameCount; ++i)
+            {
+                m_frames[i - sent] = m_frames[i];
+            }
+
+            releaseFrames(m_frameCount - sent, m_frameCount);
+            m_frameCount -= sent;
+        }
+
+        disconnect();
+    }
+
+    /**
+     * Gets the longest time a connection attempt may take.
+     * @return The connect timeout.
+     */
+    virtual boost::posix_time::time_duration connectTimeout() const
+    {
+        return m_connectTimeout;
+    }
+
+    /**
+     * Sets the longest time a connection attempt may take, over all of the
+     * resolved addresses.
+     * @param aValueMs The new connect timeout in ms.
+     */
+    virtual void connectTimeout(const long &aValueMs)
+    {
+        m_connectTimeout = boost::posix_time::milliseconds(aValueMs);
+    }
+
+    /**
+     * Gets the longest time writing a batch may take.
+     * @return The write timeout.
+     */
+    virtual boost::posix_time::time_duration writeTimeout() const
+    {
+        return m_writeTimeout;
+    }
+
+    /**
+     * Sets the longest time writing a batch may take.
+     * @param aValueMs The new write timeout in ms.
+     */
+    virtual void writeTimeout(const long &aValueMs)
+    {
+        m_writeTimeout = boost::posix_time::milliseconds(aValueMs);
+    }
+
+    /**
+     * TCP frames are delimited by a null byte, so they can't be compressed.
+     * @return False.
+     */
+    virtual bool supportsCompression() const
+    {
+        return false;
+    }
+
+    /**
+     * Is the transport connected?
+     * @return True if the socket is connected.
+     */
+    virtual bool connected() const
+    {
+        return m_socket.is_open();
+    }
+
+    /**
+     * Is the transport connected, or has it nothing to write? Unlike
+     * connected() this may be called from any thread.
+     * @return False if frames are waiting for a connection.
+     */
+    virtual bool healthy() const
+    {
+        return m_connected.load(boost::memory_order_relaxed) ||
+               m_frameCount.load(boost::memory_order_relaxed) == 0;
+    }
+
+    /**
+     * Gets the number of buffered frames, which flush() could not write if
+     * the server is unreachable.
+     * @return The number of frames not yet written.
+     */
+    virtual size_t pendingMessages() const
+    {
+        return m_frameCount.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of messages dropped because the buffer was full.
+     * @return The number of dropped messages.
+     */
+    virtual uint64_t droppedMessages() const
+    {
+        return m_droppedMessages.load(boost::memory_order_relaxed);
+    }
+
+protected:
+
+    // Members
+
+    Resolver m_resolver; ///< Resolves the destination host name.
+    size_t m_maxBatchSize; ///< Frames to buffer before writing.
+    size_t m_maxPendingBytes; ///< Most bytes to buffer.
+    boost::asio::io_service m_service; ///< The Boost IO service.
+    boost::asio::ip::tcp::socket m_socket; ///< The Boost socket.
+    boost::asio::deadline_timer m_timer; ///< Times out connects and writes.
+    boost::posix_time::time_duration m_connectTimeout; ///< Longest connect.
+    boost::posix_time::time_duration m_writeTimeout; ///< Longest write.
+    std::vector<Buffer> m_frames; ///< Buffered messages, without delimiters.
+    std::vector<boost::asio::const_buffer> m_buffers; ///< The gather list.
+    boost::atomic<size_t> m_frameCount; ///< Number of buffered frames.
+    size_t m_pendingBytes; ///< Number of buffered bytes.
+    boost::atomic<uint64_t> m_droppedMessages; ///< Messages lost to a full buffer.
+    boost::atomic<bool> m_connected; ///< Mirrors the socket for other threads.
+    boost::posix_time::time_duration m_reconnectDelay; ///< Current backoff.
+    boost::posix_time::ptime m_nextConnectAttempt; ///< Earliest reconnect.
+
+    // Methods
+
+    /**
+     * Buffers a message as a null-terminated frame, writing the batch if it
+     * is full.
+     * @param aMessage The message to send: a string, a Buffer or Fragments.
+     */
+    template <typename Message>
+    void enqueue(Message &aMessage)
+    {
+        size_t length = aMessage.length();
+
+        // Make room by writing what we have, drop the message if we can't
+        if (m_pendingBytes + length + 1 > m_maxPendingBytes)
+        {
+            flush();
+
+            if (m_pendingBytes + length + 1 > m_maxPendingBytes)
+            {
+                m_droppedMessages.fetch_add(1, boost::memory_order_relaxed);
+
+                return;
+            }
+        }
+
+        // Reuse the frame handles; the messages themselves are pooled
+        if (m_frameCount == m_frames.size())
+        {
+            m_frames.push_back(Buffer());
+        }
+
+        // The delimiter is added by the gather write, so a Buffer is shared
+        Buffer::transfer(aMessage, m_frames[m_frameCount++]);
+        m_pendingBytes += length + 1;
+
+        if (m_frameCount >= m_maxBatchSize)
+        {
+            flush();
+        }
+    }
+
+    /**
+     * Lets go of buffered messages, so that they can go back to the pool.
+     * @param aBegin The first frame to let go of.
+     * @param anEnd One past the last frame to let go of.
+     */
+    void releaseFrames(const size_t &aBegin, const size_t &anEnd)
+    {
+        for (size_t i = aBegin; i < anEnd; ++i)
+        {
+            m_frames[i].reset();
+        }
+    }
+
+    /**
+     * Connects to the destination unless still backing off from a failure.
+     * @return True if connected.
+     */
+    virtual bool connect()
+    {
+        boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+        if (now < m_nextConnectAttempt)
+        {
+            return false;
+        }
+
+        // Not resolved yet, which is no reason to back off
+        Resolver::Addresses addresses = m_resolver.addresses();
+
+        if (addresses.empty())
+        {
+            return false;
+        }
+
+        // Try each resolved address in turn, all within the connect timeout
+        boost::posix_time::ptime deadline = now + m_connectTimeout;
+        boost::system::error_code error;
+
+        for (size_t i = 0; i < addresses.size(); ++i)
+        {
+            m_socket.close(error);
+
+            now = boost::posix_time::microsec_clock::universal_time();
+
+            if (now >= deadline)
+            {
+                error = boost::asio::error::timed_out;
+
+                break;
+            }
+
+            error = boost::asio::error::would_block;
+
+            m_socket.async_connect(boost::asio::ip::tcp::endpoint(addresses[i], m_resolver.port()),
+                    boost::bind(&TcpTransport::connectCompleted, _1, &error, &m_timer));
+            runWithTimeout(deadline - now, &error);
+
+            if (!error)
+            {
+                break;
+            }
+        }
+
+        if (error)
+        {
+            // The addresses may be stale
+            m_resolver.refresh();
+            disconnect();
+
+            return false;
+        }
+
+        // We do our own batching, so don't let Nagle hold frames back
+        m_socket.set_option(boost::asio::ip::tcp::no_delay(true), error);
+        m_reconnectDelay = boost::posix_time::milliseconds(TCP_MIN_RECONNECT_DELAY_MS);
+        m_connected.store(true, boost::memory_order_relaxed);
+
+        return true;
+    }
+
+    /**
+     * Runs the operation started on the socket until it completes, closing
+     * the socket if it takes longer than the timeout.
+     * @param aTimeout The longest the operation may take.
+     * @param aResult Set by the operation's completion handler; would_block
+     * until then.
+     */
+    void runWithTimeout(const boost::posix_time::time_duration &aTimeout,
+                        boost::system::error_code *aResult)
+    {
+        m_timer.expires_from_now(aTimeout);
+        m_timer.async_wait(boost::bind(&TcpTransport::timedOut, _1, aResult, &m_socket));
+
+        m_service.reset();
+        m_service.run();
+    }
+
+    /**
+     * Completion handler of a connect.
+     * @param anError The result of the connect.
+     * @param aResult Where to store it.
+     * @param aTimer The timeout to cancel.
+     */
+    static void connectCompleted(const boost::system::error_code &anError,
+                                 boost::system::error_code *aResult,
+                                 boost::asio::deadline_timer *aTimer)
+    {
+        *aResult = anError;
+        aTimer->cancel();
+    }
+
+    /**
+     * Completion handler of a write.
+     * @param anError The result of the write.
+     * @param aBytes The number of bytes written.
+     * @param aResult Where to store the result.
+     * @param aWritten Where to store the number of bytes written.
+     * @param aTimer The timeout to cancel.
+     */
+    static void writeCompleted(const boost::system::error_code &anError,
+                               const size_t &aBytes,
+                               boost::system::error_code *aResult,
+                               size_t *aWritten,
+                               boost::asio::deadline_timer *aTimer)
+    {
+        *aResult = anError;
+        *aWritten = aBytes;
+        aTimer->cancel();
+    }
+
+    /**
+     * Completion handler of the timeout. Closes the socket, which aborts the
+     * operation, unless the operation has already completed.
+     * @param anError Set if the timer was cancelled.
+     * @param aResult The result of the operation, would_block while it runs.
+     * @param aSocket The socket.
+     */
+    static void timedOut(const boost::system::error_code &anError,
+                         boost::system::error_code *aResult,
+                         boost::asio::ip::tcp::socket *aSocket)
+    {
+        if (anError != boost::asio::error::operation_aborted &&
+            *aResult == boost::asio::error::would_block)
+        {
+            boost::system::error_code error;
+            aSocket->close(error);
+        }
+    }
+
+    /**
+     * Closes the socket and pushes back the next connection attempt.
+     */
+    virtual void disconnect()
+    {
+        boost::system::error_code error;
+        m_socket.close(error);
+        m_connected.store(false, boost::memory_order_relaxed);
+
+        m_nextConnectAttempt = boost::posix_time::microsec_clock::universal_time() +
+                m_reconnectDelay;
+        m_reconnectDelay = std::min(m_reconnectDelay * 2,
+                                    boost::posix_time::time_duration(
+                                        boost::posix_time::milliseconds(TCP_MAX_RECONNECT_DELAY_MS)));
+    }
+};
+
+} // namespace transport
+} // namespace gelf4cplus
+
+#endif // #if !defined(TCPTRANSPORT_HPP)
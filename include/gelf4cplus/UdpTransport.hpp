@@ -13,23 +13,41 @@
 // System Headers
 
 #include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
 #include <cstdlib>
-#include <sstream>
+#include <cstring>
+#include <cerrno>
 #include <stdint.h>
 
+#if defined(__linux__)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#endif
+
 // Third-party Headers
 
 #define BOOST_SYSTEM_NO_LIB
-#include <boost/functional/hash.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
 #include <boost/lexical_cast.hpp>
-#include <boost/interprocess/detail/os_thread_functions.hpp>
 
 // Other Headers
 
 #include "ITransport.hpp"
+#include "ChunkedMessage.hpp"
+#include "MessageIdGenerator.hpp"
+#include "HandlerAllocator.hpp"
+#include "Resolver.hpp"
 
 /*- NAMESPACES ---------------------------------------------------------------*/
 
@@ -44,13 +62,55 @@ using std::string;
 
 const uint16_t DISABLE_CHUNKING = 0; ///< Constant used to disable chunking.
 const uint16_t DEFAULT_CHUNK_SIZE = 1024; ///< The default size of chunks.
-const int DEFAULT_GRAYLOG2_PORT = 12201; ///< The default Graylog2 port.
-const string DEFAULT_GRAYLOG2_HOST = "localhost"; ///< The default Graylog2 host.
+const uint16_t AUTO_CHUNK_SIZE = 0xffff; ///< Chunk size that follows the path MTU.
+const size_t MAX_UDP_PAYLOAD = 65507; ///< Largest payload of an IPv4 datagram.
+const size_t IPV4_HEADER_SIZE = 20; ///< Size of an IPv4 header without options.
+const size_t IPV6_HEADER_SIZE = 40; ///< Size of an IPv6 header.
+const size_t UDP_HEADER_SIZE = 8; ///< Size of a UDP header.
+const long DEFAULT_MTU_PROBE_INTERVAL_MS = 60000; ///< Time between path MTU probes.
+const size_t DISABLE_BATCHING = 1; ///< Batch size that sends each datagram alone.
+const size_t DEFAULT_UDP_BATCH_SIZE = 64; ///< Datagrams per batched send.
+const long DEFAULT_UDP_FLUSH_INTERVAL_MS = 10; ///< Longest a datagram is held.
+const size_t DEFAULT_UDP_MAX_IN_FLIGHT_BYTES = 16 * 1024 * 1024; ///< Send limit.
+const size_t MAX_POOLED_MESSAGES = 256; ///< Idle message buffers kept around.
+const long UDP_CLOSE_TIMEOUT_MS = 1000; ///< Longest the destructor waits for sends to complete.
+const size_t UDP_MAX_HELD_MESSAGES = 1024; ///< Messages held until the host resolves.
 
 /*- CLASSES ------------------------------------------------------------------*/
 
 /**
  * This class defines a UDP transport for use with the GELF appender.
+ *
+ * With a batch size above DISABLE_BATCHING, datagrams are gathered until the
+ * batch is full, flush() is called or the flush interval has passed since the
+ * oldest one was gathered, and are then sent together. On Linux a batch goes
+ * out with a single sendmmsg() call. A timer on the I/O thread sends a batch
+ * that has been held for the flush interval when no further message comes
+ * along, so the caller need not flush after every message.
+ *
+ * Otherwise each message is sent asynchronously. The transport runs its own
+ * I/O thread unless it is given an io_service that the caller runs. Message
+ * buffers come from a pool and go back to it once the last datagram of the
+ * message has completed, and the completions keep count of errors and of the
+ * bytes still in flight. Messages that would take the bytes in flight over
+ * the limit are dropped.
+ *
+ * The host name is resolved in the background and again every DNS refresh
+ * interval, so constructing the transport never waits for DNS. Messages sent
+ * before the first resolution completes are held, up to UDP_MAX_HELD_MESSAGES
+ * and the limit on bytes in flight, and sent once it does. Once a lookup has
+ * failed, messages that find no address are dropped and count as send
+ * errors. When the addresses change, or sends to the current one are
+ * refused, the transport moves to another resolved address.
+ *
+ * With a chunk size of AUTO_CHUNK_SIZE, the chunks are as large as the path
+ * MTU to the destination allows without IP fragmentation, once the IP, UDP
+ * and GELF chunk headers are taken off. On Linux the MTU is read with IP_MTU
+ * from a socket connected to the destination, and read again every probe
+ * interval, when the address changes and when a send fails as too large.
+ * Sends leave path MTU discovery on, so that the kernel learns of smaller
+ * MTUs along the path. Elsewhere, and until the first probe, chunks are
+ * DEFAULT_CHUNK_SIZE.
  */
 class UdpTransport : public ITransport
 {
@@ -59,43 +119,201 @@ public:
     // Constructors & Destructor
 
     /**
-     * The default constructor.
+     * The default constructor, which starts an I/O thread for the transport.
      * @param aDstHost A destination host name.
      * @param aDstPort A destination port.
-     * @param aMaxChunkSize The maximum size of each chunk.
+     * @param aMaxChunkSize The maximum size of each chunk, or AUTO_CHUNK_SIZE
+     * to follow the path MTU.
+     * @param aMaxBatchSize The number of datagrams to send at once.
+     * @param aFlushIntervalMs Longest time in ms a datagram is held back.
+     * @param aDnsRefreshMs Time in ms between resolutions of the host name.
      */
     UdpTransport(const string &aDstHost = "localhost",
                  const int &aDstPort = DEFAULT_GRAYLOG2_PORT,
-                 const uint16_t &aMaxChunkSize = DEFAULT_CHUNK_SIZE) :
-                 m_maxChunkSize(aMaxChunkSize)
+                 const uint16_t &aMaxChunkSize = DEFAULT_CHUNK_SIZE,
+                 const size_t &aMaxBatchSize = DISABLE_BATCHING,
+                 const long &aFlushIntervalMs = DEFAULT_UDP_FLUSH_INTERVAL_MS,
+                 const long &aDnsRefreshMs = DEFAULT_DNS_REFRESH_MS) :
+                 m_maxChunkSize(aMaxChunkSize == AUTO_CHUNK_SIZE ? DEFAULT_CHUNK_SIZE : aMaxChunkSize),
+                 m_autoChunkSize(aMaxChunkSize == AUTO_CHUNK_SIZE),
+                 m_mtuProbeInterval(boost::posix_time::milliseconds(DEFAULT_MTU_PROBE_INTERVAL_MS)),
+                 m_pathMtu(0),
+                 m_mtuProbeRequested(false),
+                 m_maxBatchSize(aMaxBatchSize == 0 ? DISABLE_BATCHING : aMaxBatchSize),
+                 m_flushInterval(boost::posix_time::milliseconds(aFlushIntervalMs)),
+                 m_messageCount(0),
+                 m_datagramCount(0),
+                 m_sendErrors(0),
+                 m_checkedErrors(0),
+                 m_ownService(new boost::asio::io_service()),
+                 m_service(*m_ownService),
+                 m_strand(m_service),
+                 m_flushTimer(m_service),
+                 m_flushTimerArmed(false),
+                 m_resolver(aDstHost, aDstPort, true, aDnsRefreshMs),
+                 m_endpointGeneration(0),
+                 m_addressIndex(0),
+                 m_rotationErrors(0),
+                 m_maxInFlightBytes(DEFAULT_UDP_MAX_IN_FLIGHT_BYTES),
+                 m_inFlightBytes(0),
+                 m_inFlightMessages(0),
+                 m_pendingHandlers(0),
+                 m_heldBytes(0),
+                 m_heldMessageCount(0),
+                 m_droppedMessages(0),
+                 m_lastError(0),
+                 m_socketConnected(false)
     {
-        // Build the id string using the IP, PID, and TID
-        std::ostringstream ss;
-        ss << boost::asio::ip::host_name() <<
-                boost::interprocess::detail::get_current_process_id() <<
-                boost::interprocess::detail::get_current_thread_id();
-        m_threadId = ss.str();
+        initialize();
+
+        // Keep run() going while idle and give it a thread
+        m_work.reset(new boost::asio::io_service::work(m_service));
+        m_ioThread.reset(new boost::thread(
+                boost::bind(&boost::asio::io_service::run, m_ownService.get())));
+    }
 
-        // Set up the Boost Asio stuff
-        boost::asio::ip::udp::resolver resolver(m_service);
-        boost::asio::ip::udp::resolver::query query(boost::asio::ip::udp::v4(),
-                                                    aDstHost,
-                                                    boost::lexical_cast<string>(aDstPort));
-        m_endpoint = *resolver.resolve(query);
-        m_socket = new boost::asio::ip::udp::socket(m_service, m_endpoint.protocol());
+    /**
+     * A constructor that uses an io_service run by the caller. The io_service
+     * must keep running until this transport has been destroyed, and the
+     * transport must not be destroyed from a thread that runs it.
+     * @param aService The io_service to send with.
+     * @param aDstHost A destination host name.
+     * @param aDstPort A destination port.
+     * @param aMaxChunkSize The maximum size of each chunk, or AUTO_CHUNK_SIZE
+     * to follow the path MTU.
+     * @param aMaxBatchSize The number of datagrams to send at once.
+     * @param aFlushIntervalMs Longest time in ms a datagram is held back.
+     * @param aDnsRefreshMs Time in ms between resolutions of the host name.
+     */
+    UdpTransport(boost::asio::io_service &aService,
+                 const string &aDstHost = "localhost",
+                 const int &aDstPort = DEFAULT_GRAYLOG2_PORT,
+                 const uint16_t &aMaxChunkSize = DEFAULT_CHUNK_SIZE,
+                 const size_t &aMaxBatchSize = DISABLE_BATCHING,
+                 const long &aFlushIntervalMs = DEFAULT_UDP_FLUSH_INTERVAL_MS,
+                 const long &aDnsRefreshMs = DEFAULT_DNS_REFRESH_MS) :
+                 m_maxChunkSize(aMaxChunkSize == AUTO_CHUNK_SIZE ? DEFAULT_CHUNK_SIZE : aMaxChunkSize),
+                 m_autoChunkSize(aMaxChunkSize == AUTO_CHUNK_SIZE),
+                 m_mtuProbeInterval(boost::posix_time::milliseconds(DEFAULT_MTU_PROBE_INTERVAL_MS)),
+                 m_pathMtu(0),
+                 m_mtuProbeRequested(false),
+                 m_maxBatchSize(aMaxBatchSize == 0 ? DISABLE_BATCHING : aMaxBatchSize),
+                 m_flushInterval(boost::posix_time::milliseconds(aFlushIntervalMs)),
+                 m_messageCount(0),
+                 m_datagramCount(0),
+                 m_sendErrors(0),
+                 m_checkedErrors(0),
+                 m_service(aService),
+                 m_strand(m_service),
+                 m_flushTimer(m_service),
+                 m_flushTimerArmed(false),
+                 m_resolver(aDstHost, aDstPort, true, aDnsRefreshMs),
+                 m_endpointGeneration(0),
+                 m_addressIndex(0),
+                 m_rotationErrors(0),
+                 m_maxInFlightBytes(DEFAULT_UDP_MAX_IN_FLIGHT_BYTES),
+                 m_inFlightBytes(0),
+                 m_inFlightMessages(0),
+                 m_pendingHandlers(0),
+                 m_heldBytes(0),
+                 m_heldMessageCount(0),
+                 m_droppedMessages(0),
+                 m_lastError(0),
+                 m_socketConnected(false)
+    {
+        initialize();
     }
 
     /**
      * A virtual destructor in case someone wants to derive from this class.
+     * Waits for the sends in flight to complete before the socket goes away:
+     * on our own I/O thread until they have. On a caller's io_service it waits
+     * for up to UDP_CLOSE_TIMEOUT_MS, then closes the socket to abort the rest
+     * and waits until every handler bound to this transport has run.
      */
     virtual ~UdpTransport()
     {
+        // Give messages held for DNS a last chance to go out
+        if (!m_heldMessages.empty())
+        {
+            m_resolver.waitUntilResolved(UDP_CLOSE_TIMEOUT_MS);
+        }
+
+        flush();
+
+        if (m_maxBatchSize > DISABLE_BATCHING)
+        {
+            m_pendingHandlers.fetch_add(1, boost::memory_order_relaxed);
+            m_strand.post(boost::bind(&UdpTransport::stopFlushTimer, this));
+        }
+
+        if (m_ioThread)
+        {
+            // Let run() return once the queued sends have completed
+            m_work.reset();
+            m_ioThread->join();
+        }
+        else
+        {
+            boost::posix_time::ptime deadline =
+                    boost::posix_time::microsec_clock::universal_time() +
+                    boost::posix_time::milliseconds(UDP_CLOSE_TIMEOUT_MS);
+
+            while (pendingMessages() != 0 &&
+                   boost::posix_time::microsec_clock::universal_time() < deadline)
+            {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+            }
+
+            // Abort what is left; the handlers still queued on the caller's
+            // io_service point at us, so wait for them even then
+            m_pendingHandlers.fetch_add(1, boost::memory_order_relaxed);
+            m_strand.post(boost::bind(&UdpTransport::closeSocket, this));
+
+            while (m_pendingHandlers.load(boost::memory_order_acquire) != 0)
+            {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+            }
+        }
+
         delete m_socket;
         m_socket = NULL;
+
+        // Free the pooled buffers
+        boost::lock_guard<boost::mutex> lock(m_poolMutex);
+
+        for (size_t i = 0; i < m_pool.size(); ++i)
+        {
+            delete m_pool[i];
+        }
     }
 
     // Methods
 
+    /**
+     * Connects the socket to the destination, so that the kernel reports an
+     * ICMP rejection, such as ECONNREFUSED from a closed port, as an error of
+     * a later send, which healthy() then sees and which moves the transport
+     * on to the next resolved address. Must be called before the first send.
+     * @return False if the socket could not be connected.
+     */
+    virtual bool connectSocket()
+    {
+        m_socketConnected = true;
+
+        // Not resolved yet; the socket is connected once it is
+        if (!updateEndpoint())
+        {
+            return true;
+        }
+
+        boost::system::error_code error;
+        m_socket->connect(m_endpoint, error);
+        m_socketConnected = !error;
+
+        return m_socketConnected;
+    }
+
     /**
      * Gets the maximum chunk size.
      * @return The maximum chunk size.
@@ -107,11 +325,153 @@ public:
 
     /**
      * Sets the maximum chunk size.
-     * @param aValue The new maximum chunk size.
+     * @param aValue The new maximum chunk size, or AUTO_CHUNK_SIZE to follow
+     * the path MTU.
      */
     virtual void maxChunkSize(const uint16_t &aValue)
     {
-        m_maxChunkSize = aValue;
+        m_autoChunkSize = aValue == AUTO_CHUNK_SIZE;
+
+        if (!m_autoChunkSize)
+        {
+            m_maxChunkSize = aValue;
+
+            return;
+        }
+
+        enablePathMtuDiscovery();
+        probeChunkSize();
+    }
+
+    /**
+     * Does the chunk size follow the path MTU?
+     * @return True if the chunk size is AUTO_CHUNK_SIZE.
+     */
+    virtual bool autoChunkSize() const
+    {
+        return m_autoChunkSize;
+    }
+
+    /**
+     * Gets the path MTU the chunk size was last derived from.
+     * @return The path MTU, or 0 if it has not been probed.
+     */
+    virtual size_t pathMtu() const
+    {
+        return m_pathMtu;
+    }
+
+    /**
+     * Sets the time between path MTU probes.
+     * @param aValueMs The new interval in ms.
+     */
+    virtual void mtuProbeInterval(const long &aValueMs)
+    {
+        m_mtuProbeInterval = boost::posix_time::milliseconds(aValueMs);
+        m_nextMtuProbe = boost::posix_time::ptime(boost::posix_time::neg_infin);
+    }
+
+    /**
+     * Gets the size of the largest message that fits in MAX_CHUNK_COUNT
+     * chunks, or in one datagram when chunking is disabled.
+     * @return The largest message size in bytes.
+     */
+    virtual size_t maxMessageSize() const
+    {
+        if (m_maxChunkSize == DISABLE_CHUNKING)
+        {
+            return MAX_UDP_PAYLOAD;
+        }
+
+        return (size_t) m_maxChunkSize * MAX_CHUNK_COUNT;
+    }
+
+    /**
+     * Gets the number of datagrams sent at once.
+     * @return The maximum batch size.
+     */
+    virtual size_t maxBatchSize() const
+    {
+        return m_maxBatchSize;
+    }
+
+    /**
+     * Gets the number of datagrams that failed to send.
+     * @return The number of send errors.
+     */
+    virtual uint64_t sendErrors() const
+    {
+        return m_sendErrors.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Has every datagram sent since the last call gone out without error?
+     * UDP cannot tell whether anyone receives the datagrams, so this only
+     * catches local errors and, on a connected socket, ICMP rejections.
+     * @return True if no send has failed since the last call.
+     */
+    virtual bool healthy() const
+    {
+        uint64_t errors = m_sendErrors.load(boost::memory_order_relaxed);
+
+        return m_checkedErrors.exchange(errors, boost::memory_order_relaxed) == errors;
+    }
+
+    /**
+     * Gets the error code of the last failed send.
+     * @return The last error value, or 0 if no send has failed.
+     */
+    virtual int lastError() const
+    {
+        return m_lastError.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of messages dropped because too many bytes were in
+     * flight, the message was too large for UDP or the destination had not
+     * been resolved.
+     * @return The number of dropped messages.
+     */
+    virtual uint64_t droppedMessages() const
+    {
+        return m_droppedMessages.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of payload bytes handed to the I/O thread whose sends
+     * have not completed.
+     * @return The bytes in flight.
+     */
+    virtual size_t inFlightBytes() const
+    {
+        return m_inFlightBytes.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of messages whose sends have not completed.
+     * @return The messages in flight.
+     */
+    virtual size_t inFlightMessages() const
+    {
+        return m_inFlightMessages.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the limit on payload bytes in flight.
+     * @return The limit on bytes in flight.
+     */
+    virtual size_t maxInFlightBytes() const
+    {
+        return m_maxInFlightBytes;
+    }
+
+    /**
+     * Sets the limit on payload bytes in flight.
+     * @param aValue The new limit on bytes in flight.
+     */
+    virtual void maxInFlightBytes(const size_t &aValue)
+    {
+        m_maxInFlightBytes = aValue;
     }
 
     /**
@@ -120,98 +480,871 @@ public:
      */
     virtual void send(const string &aMessage)
     {
-        size_t length = aMessage.length();
+        enqueue(aMessage);
+    }
 
-        if (m_maxChunkSize != DISABLE_CHUNKING &&
-                length > m_maxChunkSize)
-        {
-            size_t chunkCount = (length / m_maxChunkSize) + 1;
-            string messageId;
-            generateMessageId(messageId);
+    /**
+     * Sends a message using this transport, sharing its bytes until the
+     * datagrams have been sent.
+     * @param aMessage The message to send.
+     */
+    virtual void send(Buffer &aMessage)
+    {
+        enqueue(aMessage);
+    }
 
-            for (size_t i = 0; i < chunkCount; ++i)
-            {
-                string messageChunkPrefix;
-                createChunkedMessagePart(messageId, i, chunkCount, messageChunkPrefix);
-                size_t skip = i * m_maxChunkSize;
+    /**
+     * Sends a message made up of several fragments, gathering them straight
+     * into the datagram payload.
+     * @param aMessage The fragments of the message to send.
+     */
+    virtual void send(const Fragments &aMessage)
+    {
+        enqueue(aMessage);
+    }
 
-                // Send the message chunk to the UDP endpoint
-                m_socket->async_send_to(boost::asio::buffer(messageChunkPrefix + aMessage.substr(skip, m_maxChunkSize)),
-                                        m_endpoint, boost::bind(&UdpTransport::handler, this));
-            }
-        }
-        else
+    /**
+     * Gets the number of messages whose asynchronous sends have not completed.
+     * @return The number of messages still in flight.
+     */
+    virtual size_t pendingMessages() const
+    {
+        return m_inFlightMessages.load(boost::memory_order_acquire) +
+               m_heldMessageCount.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Must flush() be called for what was sent to go out? The flush timer
+     * sends batches, so only messages held for DNS need it.
+     * @return True if messages are held until the host name resolves.
+     */
+    virtual bool needsFlush() const
+    {
+        return !m_heldMessages.empty();
+    }
+
+    /**
+     * Sends all gathered datagrams, and any messages held for DNS if the host
+     * has been resolved since.
+     */
+    virtual void flush()
+    {
+        if (!m_heldMessages.empty() && updateEndpoint())
         {
-            // Send the message to the UDP endpoint
-            m_socket->async_send_to(boost::asio::buffer(aMessage), m_endpoint, boost::bind(&UdpTransport::handler, this));
+            releaseHeldMessages();
         }
+
+        boost::lock_guard<boost::mutex> lock(m_batchMutex);
+        sendBatch();
     }
 
 protected:
 
-    // Constant Static Members
+    // Type Definitions
 
-    const static uint8_t MAX_HEADER_SIZE = 8; ///< Maximum message ID size.
+    /**
+     * A pooled message buffer and the number of its datagrams still pending.
+     */
+    struct InFlightMessage
+    {
+        ChunkedMessage message; ///< The message being sent.
+        boost::asio::ip::udp::endpoint endpoint; ///< Where to send it.
+        size_t pendingDatagrams; ///< Datagrams whose sends have not completed.
+    };
 
     // Members
 
     uint16_t m_maxChunkSize; ///< The maximum chunk size.
+    bool m_autoChunkSize; ///< Does m_maxChunkSize follow the path MTU?
+    boost::posix_time::time_duration m_mtuProbeInterval; ///< Between MTU probes.
+    boost::posix_time::ptime m_nextMtuProbe; ///< When to probe the MTU again.
+    size_t m_pathMtu; ///< The last path MTU probed, 0 if none.
+    boost::atomic<bool> m_mtuProbeRequested; ///< Did a send fail as too large?
+    size_t m_maxBatchSize; ///< Datagrams to gather before sending.
+    boost::posix_time::time_duration m_flushInterval; ///< Longest hold time.
+    boost::mutex m_batchMutex; ///< Guards the batch against the flush timer.
+    boost::posix_time::ptime m_oldestDatagramTime; ///< When the batch began.
+    std::vector<ChunkedMessage> m_messages; ///< Gathered messages, reused.
+    size_t m_messageCount; ///< Number of gathered messages.
+    size_t m_datagramCount; ///< Number of gathered datagrams.
+    boost::atomic<uint64_t> m_sendErrors; ///< Datagrams that failed to send.
+    mutable boost::atomic<uint64_t> m_checkedErrors; ///< Send errors at the last healthy().
+#if defined(__linux__)
+    std::vector<struct iovec> m_iovecs; ///< Two iovecs per gathered datagram.
+    std::vector<struct mmsghdr> m_headers; ///< One header per datagram.
+#endif
+    HandlerMemory m_handlerMemory; ///< Memory for asio operations, outlives the service.
+    boost::scoped_ptr<boost::asio::io_service> m_ownService; ///< Our IO service.
+    boost::asio::io_service &m_service; ///< The Boost IO service in use.
+    boost::asio::io_service::strand m_strand; ///< Serializes socket access.
+    boost::asio::deadline_timer m_flushTimer; ///< Sends a batch held too long.
+    bool m_flushTimerArmed; ///< Is m_flushTimer waiting? Guarded by m_batchMutex.
+    boost::scoped_ptr<boost::asio::io_service::work> m_work; ///< Keeps run() going.
+    boost::scoped_ptr<boost::thread> m_ioThread; ///< Runs m_ownService.
+    Resolver m_resolver; ///< Resolves the destination host name.
+    uint64_t m_endpointGeneration; ///< The resolver generation of m_endpoint.
+    size_t m_addressIndex; ///< Which of the resolved addresses is in use.
+    uint64_t m_rotationErrors; ///< Send errors when the address was last picked.
     boost::asio::ip::udp::endpoint m_endpoint; ///< The Boost endpoint.
     boost::asio::ip::udp::socket *m_socket; ///< The Boost socket.
-    boost::asio::io_service m_service; ///< The Boost IO service.
-    string m_threadId; ///< The thread ID.
+    std::vector<InFlightMessage*> m_pool; ///< Idle message buffers.
+    boost::mutex m_poolMutex; ///< Guards m_pool.
+    size_t m_maxInFlightBytes; ///< Limit on bytes in flight.
+    boost::atomic<size_t> m_inFlightBytes; ///< Bytes handed to the I/O thread.
+    boost::atomic<size_t> m_inFlightMessages; ///< Messages not yet sent.
+    boost::atomic<size_t> m_pendingHandlers; ///< Queued handlers bound to us.
+    std::deque<Buffer> m_heldMessages; ///< Messages waiting for the first resolution.
+    size_t m_heldBytes; ///< Bytes in m_heldMessages.
+    boost::atomic<size_t> m_heldMessageCount; ///< Mirrors m_heldMessages for other threads.
+    boost::atomic<uint64_t> m_droppedMessages; ///< Messages over the limit.
+    boost::atomic<int> m_lastError; ///< Error value of the last failure.
+    bool m_socketConnected; ///< Is the socket connected to m_endpoint?
 
     // Methods
 
     /**
-     * Creates the prefix for the specific chunk.
-     * @param aMessageId The unique ID of this message.
-     * @param anIndex This chunk index.
-     * @param aChunkCount The total chunk count.
-     * @param aResult The resultant chunk.
+     * Sends all gathered datagrams. Called with m_batchMutex held.
      */
-    virtual void createChunkedMessagePart(const string &aMessageId,
-                                          const size_t &anIndex,
-                                          const size_t &aChunkCount,
-                                          string &aResult)
+    void sendBatch()
     {
-        // Chunked GELF ID: 0x1e 0x0f (identifying this message as a chunked GELF message)
-        aResult.push_back(0x1e);
-        aResult.push_back(0x0f);
+        if (m_datagramCount == 0)
+        {
+            return;
+        }
+
+#if defined(__linux__)
+        // Point one message header at the gather list of each datagram
+        m_iovecs.resize(m_datagramCount * 2);
+        m_headers.resize(m_datagramCount);
+
+        size_t datagram = 0;
+
+        for (size_t i = 0; i < m_messageCount; ++i)
+        {
+            const ChunkedMessage &message = m_messages[i];
+
+            for (size_t j = 0; j < message.chunkCount(); ++j, ++datagram)
+            {
+                struct iovec *iov = &m_iovecs[datagram * 2];
+                size_t iovlen = 0;
+
+                if (message.chunked())
+                {
+                    iov[iovlen].iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(message.header(j)));
+                    iov[iovlen++].iov_len = CHUNK_HEADER_SIZE;
+                }
+
+                boost::asio::const_buffer slice = message.slice(j);
+                iov[iovlen].iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(slice));
+                iov[iovlen++].iov_len = boost::asio::buffer_size(slice);
+
+                std::memset(&m_headers[datagram], 0, sizeof(m_headers[datagram]));
+                // A connected socket already knows where to send
+                if (!m_socketConnected)
+                {
+                    m_headers[datagram].msg_hdr.msg_name = m_endpoint.data();
+                    m_headers[datagram].msg_hdr.msg_namelen = m_endpoint.size();
+                }
+
+                m_headers[datagram].msg_hdr.msg_iov = iov;
+                m_headers[datagram].msg_hdr.msg_iovlen = iovlen;
+            }
+        }
+
+        // The kernel may send fewer than asked, so keep going until done
+        size_t sent = 0;
+
+        while (sent < m_datagramCount)
+        {
+            int result = ::sendmmsg(m_socket->native_handle(), &m_headers[sent],
+                                    m_datagramCount - sent, 0);
 
-        // Message ID: 8 bytes 
-        aResult += aMessageId;
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                // Skip the datagram that failed and carry on with the rest
+                recordError(errno);
+                ++sent;
 
-        // Sequence Number: 1 byte (The sequence number of this chunk)
-        aResult.push_back((char) anIndex);
+                continue;
+            }
 
-        // Total Number: 1 byte (How many chunks does this message consist of in total)
-        aResult.push_back((char) aChunkCount);
+            sent += result;
+        }
+#else
+        for (size_t i = 0; i < m_messageCount; ++i)
+        {
+            const ChunkedMessage &message = m_messages[i];
+
+            for (size_t j = 0; j < message.chunkCount(); ++j)
+            {
+                boost::system::error_code error;
+
+                if (m_socketConnected)
+                {
+                    m_socket->send(message.datagram(j), 0, error);
+                }
+                else
+                {
+                    m_socket->send_to(message.datagram(j), m_endpoint, 0, error);
+                }
+
+                if (error)
+                {
+                    recordError(error.value());
+                }
+            }
+        }
+#endif
+
+        // Give the payloads back to the pool
+        for (size_t i = 0; i < m_messageCount; ++i)
+        {
+            m_messages[i].clear();
+        }
+
+        m_messageCount = 0;
+        m_datagramCount = 0;
+    }
+
+    /**
+     * Sends a message, holding it if the host name has not been resolved.
+     * @param aMessage The message to send: a string, a Buffer or Fragments.
+     */
+    template <typename Message>
+    void enqueue(Message &aMessage)
+    {
+        // Nowhere to send it until the host name has been resolved
+        if (!updateEndpoint())
+        {
+            hold(aMessage);
+
+            return;
+        }
+
+        // What came before the first resolution goes out first
+        if (!m_heldMessages.empty())
+        {
+            releaseHeldMessages();
+        }
+
+        dispatch(aMessage);
+    }
+
+    /**
+     * Keeps a message until the host name has been resolved, or drops it if
+     * a lookup has already failed or too much is held.
+     * @param aMessage The message to hold: a string, a Buffer or Fragments.
+     */
+    template <typename Message>
+    void hold(Message &aMessage)
+    {
+        size_t length = aMessage.length();
+
+        if (m_resolver.failures() != 0 ||
+            m_heldMessages.size() >= UDP_MAX_HELD_MESSAGES ||
+            m_heldBytes + length > m_maxInFlightBytes)
+        {
+            m_droppedMessages.fetch_add(1, boost::memory_order_relaxed);
+            recordError(boost::asio::error::host_not_found);
+
+            return;
+        }
+
+        m_heldMessages.push_back(Buffer());
+        Buffer::transfer(aMessage, m_heldMessages.back());
+        m_heldBytes += length;
+        m_heldMessageCount.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Sends the messages held until the host name was resolved.
+     */
+    void releaseHeldMessages()
+    {
+        for (size_t i = 0; i < m_heldMessages.size(); ++i)
+        {
+            dispatch(m_heldMessages[i]);
+        }
+
+        m_heldMessages.clear();
+        m_heldBytes = 0;
+        m_heldMessageCount.store(0, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Hands a message to the I/O thread, or gathers it into the batch.
+     * @param aMessage The message to send: a string, a Buffer or Fragments.
+     */
+    template <typename Message>
+    void dispatch(Message &aMessage)
+    {
+        if (m_autoChunkSize &&
+                (m_mtuProbeRequested.exchange(false, boost::memory_order_relaxed) ||
+                 boost::posix_time::microsec_clock::universal_time() >= m_nextMtuProbe))
+        {
+            probeChunkSize();
+        }
+
+        size_t length = aMessage.length();
+
+        // The chunk header counts in a byte and receivers give up after
+        // MAX_CHUNK_COUNT chunks, so a larger message would arrive corrupt
+        if (length > maxMessageSize())
+        {
+            m_droppedMessages.fetch_add(1, boost::memory_order_relaxed);
+
+            return;
+        }
+
+        if (m_maxBatchSize > DISABLE_BATCHING)
+        {
+            batch(aMessage);
+
+            return;
+        }
+
+        // Bound the memory held by sends that have not completed
+        if (m_inFlightBytes.load(boost::memory_order_relaxed) + length > m_maxInFlightBytes)
+        {
+            m_droppedMessages.fetch_add(1, boost::memory_order_relaxed);
+
+            return;
+        }
+
+        // Put the payload once into a pooled buffer; it goes back to the
+        // pool when the last datagram pointing into it has been sent
+        InFlightMessage *message = acquireMessage();
+        message->message.assign(aMessage, chunkSizeFor(length), createMessageId(length));
+        message->endpoint = m_endpoint;
+        message->pendingDatagrams = message->message.chunkCount();
+
+        m_inFlightBytes.fetch_add(length, boost::memory_order_relaxed);
+        m_inFlightMessages.fetch_add(1, boost::memory_order_relaxed);
+
+        // All socket operations happen on the I/O thread
+        m_pendingHandlers.fetch_add(1, boost::memory_order_relaxed);
+        m_strand.post(makeAllocatingHandler(m_handlerMemory,
+                                            boost::bind(&UdpTransport::startSend, this, message)));
     }
 
     /**
-     * Generates a unique 8-byte message ID by hashing the host name, process
-     * ID, thread ID, and time.
+     * Gathers the datagrams for a message into the batch, sending the batch
+     * when it fills up or has been held for longer than the flush interval.
+     * @param aMessage The message to send: a string, a Buffer or Fragments.
+     */
+    template <typename Message>
+    void batch(Message &aMessage)
+    {
+        size_t length = aMessage.length();
+        size_t chunkSize = chunkSizeFor(length);
+        size_t chunkCount = chunkSize == DISABLE_CHUNKING ? 1 : (length + chunkSize - 1) / chunkSize;
+
+        boost::lock_guard<boost::mutex> lock(m_batchMutex);
+
+        // Send what we have if this message does not fit in the batch
+        if (m_datagramCount != 0 && m_datagramCount + chunkCount > m_maxBatchSize)
+        {
+            sendBatch();
+        }
+
+        if (m_datagramCount == 0)
+        {
+            m_oldestDatagramTime = boost::posix_time::microsec_clock::universal_time();
+
+            // Have the batch sent even if nothing else is
+            if (!m_flushTimerArmed)
+            {
+                m_flushTimerArmed = true;
+                m_pendingHandlers.fetch_add(1, boost::memory_order_relaxed);
+                m_strand.post(boost::bind(&UdpTransport::armFlushTimer, this));
+            }
+        }
+
+        // Reuse the gathered messages so the batch stops allocating
+        if (m_messageCount == m_messages.size())
+        {
+            m_messages.push_back(ChunkedMessage());
+        }
+
+        ChunkedMessage &message = m_messages[m_messageCount++];
+        message.assign(aMessage, chunkSize, createMessageId(length));
+        m_datagramCount += message.chunkCount();
+
+        if (m_datagramCount >= m_maxBatchSize ||
+                boost::posix_time::microsec_clock::universal_time() - m_oldestDatagramTime >= m_flushInterval)
+        {
+            sendBatch();
+        }
+    }
+
+    /**
+     * Starts the flush timer for the batch being gathered. Runs on the I/O
+     * thread.
+     */
+    void armFlushTimer()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(m_batchMutex);
+            waitForFlush();
+        }
+
+        m_pendingHandlers.fetch_sub(1, boost::memory_order_release);
+    }
+
+    /**
+     * Sets the flush timer to go off when the batch has been held for the
+     * flush interval, or disarms it if the batch has been sent. Runs on the
+     * I/O thread with m_batchMutex held.
+     */
+    void waitForFlush()
+    {
+        if (m_datagramCount == 0)
+        {
+            m_flushTimerArmed = false;
+
+            return;
+        }
+
+        m_flushTimer.expires_at(m_oldestDatagramTime + m_flushInterval);
+        m_pendingHandlers.fetch_add(1, boost::memory_order_relaxed);
+        m_flushTimer.async_wait(m_strand.wrap(boost::bind(&UdpTransport::flushTimerExpired, this,
+                                                          boost::asio::placeholders::error)));
+    }
+
+    /**
+     * Handler for the flush timer. Sends the batch if it has been held for
+     * the flush interval, and waits for the next one otherwise.
+     * @param anError Set if the timer was cancelled.
+     */
+    void flushTimerExpired(const boost::system::error_code &anError)
+    {
+        if (anError != boost::asio::error::operation_aborted)
+        {
+            boost::lock_guard<boost::mutex> lock(m_batchMutex);
+
+            if (m_datagramCount != 0 &&
+                    boost::posix_time::microsec_clock::universal_time() - m_oldestDatagramTime >= m_flushInterval)
+            {
+                sendBatch();
+            }
+
+            waitForFlush();
+        }
+
+        m_pendingHandlers.fetch_sub(1, boost::memory_order_release);
+    }
+
+    /**
+     * Cancels the flush timer. Runs on the I/O thread.
+     */
+    void stopFlushTimer()
+    {
+        boost::system::error_code error;
+        m_flushTimer.cancel(error);
+
+        m_pendingHandlers.fetch_sub(1, boost::memory_order_release);
+    }
+
+    /**
+     * Gets the chunk size to use for a message.
+     * @param aLength The length of the message.
+     * @return The chunk size or DISABLE_CHUNKING if the message fits in one
+     * datagram.
+     */
+    size_t chunkSizeFor(const size_t &aLength) const
+    {
+        if (m_maxChunkSize != DISABLE_CHUNKING && aLength > m_maxChunkSize)
+        {
+            return m_maxChunkSize;
+        }
+
+        return DISABLE_CHUNKING;
+    }
+
+    /**
+     * Generates a message ID if a message needs chunking.
+     * @param aLength The length of the message.
+     * @return The message ID or an empty string if not chunked.
+     */
+    string createMessageId(const size_t &aLength)
+    {
+        string messageId;
+
+        if (chunkSizeFor(aLength) != DISABLE_CHUNKING)
+        {
+            generateMessageId(messageId);
+        }
+
+        return messageId;
+    }
+
+    /**
+     * Generates a unique 8-byte message ID.
      * @param aMessageId The resultant message ID
      */
     virtual void generateMessageId(string &aMessageId)
     {
-        // Create the "unique" string using the host name and current time
-        std::ostringstream ss;
-        ss << m_threadId << boost::posix_time::microsec_clock::universal_time();
+        MessageIdGenerator::next(aMessageId);
+    }
+
+    /**
+     * Sets up the socket. Called from the constructors. The destination is
+     * resolved in the background, so this does not wait for DNS.
+     */
+    virtual void initialize()
+    {
+        m_socket = new boost::asio::ip::udp::socket(m_service, boost::asio::ip::udp::v4());
+
+        if (m_autoChunkSize)
+        {
+            enablePathMtuDiscovery();
+        }
+
+        updateEndpoint();
+    }
+
+    /**
+     * Makes the socket send datagrams that fit the known path MTU with the
+     * don't-fragment flag set, so that routers report smaller MTUs, and
+     * fragment the others rather than fail to send them.
+     */
+    void enablePathMtuDiscovery()
+    {
+#if defined(__linux__)
+        int discover = IP_PMTUDISC_WANT;
+        ::setsockopt(m_socket->native_handle(), IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover));
+#endif
+    }
+
+    /**
+     * Sets the chunk size from the path MTU to the destination. Keeps the
+     * current chunk size if the MTU cannot be read.
+     */
+    void probeChunkSize()
+    {
+        m_nextMtuProbe = boost::posix_time::microsec_clock::universal_time() + m_mtuProbeInterval;
+
+        if (m_endpoint.port() == 0)
+        {
+            return;
+        }
+
+        size_t mtu = probePathMtu(m_endpoint);
+        size_t headers = (m_endpoint.address().is_v6() ? IPV6_HEADER_SIZE : IPV4_HEADER_SIZE) +
+                UDP_HEADER_SIZE + CHUNK_HEADER_SIZE;
+
+        if (mtu <= headers)
+        {
+            return;
+        }
+
+        m_pathMtu = mtu;
+        m_maxChunkSize = (uint16_t) std::min(mtu - headers, MAX_UDP_PAYLOAD - CHUNK_HEADER_SIZE);
+    }
+
+    /**
+     * Reads the path MTU to a destination, as the kernel knows it, from a
+     * socket connected to it. Connecting a UDP socket sends nothing.
+     * @param anEndpoint The destination.
+     * @return The path MTU, or 0 if it cannot be read.
+     */
+    static size_t probePathMtu(const boost::asio::ip::udp::endpoint &anEndpoint)
+    {
+#if defined(__linux__)
+        boost::asio::io_service service;
+        boost::asio::ip::udp::socket socket(service);
+        boost::system::error_code error;
+
+        socket.connect(anEndpoint, error);
+
+        if (error)
+        {
+            return 0;
+        }
+
+        int mtu = 0;
+        socklen_t length = sizeof(mtu);
+        int result = anEndpoint.address().is_v6() ?
+                ::getsockopt(socket.native_handle(), IPPROTO_IPV6, IPV6_MTU, &mtu, &length) :
+                ::getsockopt(socket.native_handle(), IPPROTO_IP, IP_MTU, &mtu, &length);
+
+        return result == 0 && mtu > 0 ? (size_t) mtu : 0;
+#else
+        (void) anEndpoint;
+
+        return 0;
+#endif
+    }
+
+    /**
+     * Picks the address to send to: a new one when the host name resolves to
+     * different addresses, and the next one when sends are being refused or
+     * the host is unreachable, which also has the name resolved again.
+     * @return False if the host name has not been resolved yet.
+     */
+    bool updateEndpoint()
+    {
+        uint64_t generation = m_resolver.generation();
+
+        if (generation == 0)
+        {
+            return false;
+        }
+
+        uint64_t errors = m_sendErrors.load(boost::memory_order_relaxed);
+        bool unreachable = errors != m_rotationErrors &&
+                isUnreachable(m_lastError.load(boost::memory_order_relaxed));
+
+        if (generation == m_endpointGeneration && !unreachable)
+        {
+            return true;
+        }
+
+        Resolver::Addresses addresses = m_resolver.addresses();
+
+        if (generation != m_endpointGeneration)
+        {
+            // Stay on the current address if the host still resolves to it
+            Resolver::Addresses::iterator current =
+                    std::find(addresses.begin(), addresses.end(), m_endpoint.address());
+
+            m_addressIndex = current == addresses.end() ? 0 : current - addresses.begin();
+        }
+        else
+        {
+            m_addressIndex = (m_addressIndex + 1) % addresses.size();
+            m_resolver.refresh();
+        }
+
+        m_endpointGeneration = generation;
+        m_rotationErrors = errors;
+
+        setEndpoint(boost::asio::ip::udp::endpoint(addresses[m_addressIndex], m_resolver.port()));
+
+        return true;
+    }
+
+    /**
+     * Sends to a new address from now on, connecting the socket to it if the
+     * socket is connected.
+     * @param anEndpoint The new address.
+     */
+    void setEndpoint(const boost::asio::ip::udp::endpoint &anEndpoint)
+    {
+        // The flush timer sends batches to m_endpoint from the I/O thread
+        boost::lock_guard<boost::mutex> lock(m_batchMutex);
+
+        if (anEndpoint == m_endpoint)
+        {
+            return;
+        }
 
-        // Create a hash of the "unique" string using Boost
-        size_t hash = boost::hash<string>()(ss.str());
+        m_endpoint = anEndpoint;
 
-        // Return a byte array of the hash using std::string
-        aMessageId.assign((char*) &hash, MAX_HEADER_SIZE);
+        // The path to the new address may have a different MTU
+        if (m_autoChunkSize)
+        {
+            probeChunkSize();
+        }
+
+        if (!m_socketConnected)
+        {
+            return;
+        }
+
+        // Async sends use the socket on the I/O thread, so connect there
+        if (m_maxBatchSize > DISABLE_BATCHING)
+        {
+            reconnectSocket(anEndpoint);
+        }
+        else
+        {
+            m_pendingHandlers.fetch_add(1, boost::memory_order_relaxed);
+            m_strand.post(boost::bind(&UdpTransport::reconnectPostedSocket, this, anEndpoint));
+        }
+    }
+
+    /**
+     * Connects the socket to a new address.
+     * @param anEndpoint The new address.
+     */
+    void reconnectSocket(const boost::asio::ip::udp::endpoint &anEndpoint)
+    {
+        boost::system::error_code error;
+        m_socket->connect(anEndpoint, error);
+
+        if (error)
+        {
+            recordError(error.value());
+        }
+    }
+
+    /**
+     * Connects the socket to a new address. Runs on the I/O thread.
+     * @param anEndpoint The new address.
+     */
+    void reconnectPostedSocket(const boost::asio::ip::udp::endpoint &anEndpoint)
+    {
+        reconnectSocket(anEndpoint);
+
+        m_pendingHandlers.fetch_sub(1, boost::memory_order_release);
     }
 
     /**
-     * Dummy handler for the Boost async_send_to()
+     * Closes the socket, which aborts the sends still in flight. Runs on the
+     * I/O thread.
      */
-    virtual void handler()
+    void closeSocket()
     {
+        boost::system::error_code error;
+        m_socket->close(error);
+
+        m_pendingHandlers.fetch_sub(1, boost::memory_order_release);
+    }
+
+    /**
+     * Does an error mean that the address can't be reached?
+     * @param anError The error value.
+     * @return True for refused and unreachable errors.
+     */
+    static bool isUnreachable(const int &anError)
+    {
+        return anError == ECONNREFUSED || anError == EHOSTUNREACH || anError == ENETUNREACH;
+    }
+
+    /**
+     * Takes a message buffer from the pool, or allocates one if it is empty.
+     * @return The message buffer.
+     */
+    InFlightMessage* acquireMessage()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(m_poolMutex);
+
+            if (!m_pool.empty())
+            {
+                InFlightMessage *message = m_pool.back();
+                m_pool.pop_back();
+
+                return message;
+            }
+        }
+
+        return new InFlightMessage();
+    }
+
+    /**
+     * Returns a message buffer to the pool.
+     * @param aMessage The message buffer.
+     */
+    void releaseMessage(InFlightMessage *aMessage)
+    {
+        const ChunkedMessage &message = aMessage->message;
+
+        m_inFlightBytes.fetch_sub(message.payload().length(), boost::memory_order_relaxed);
+        m_inFlightMessages.fetch_sub(1, boost::memory_order_relaxed);
+
+        // Give the payload back to the pool, or to the caller still sharing it
+        aMessage->message.clear();
+
+        {
+            boost::lock_guard<boost::mutex> lock(m_poolMutex);
+
+            if (m_pool.size() < MAX_POOLED_MESSAGES)
+            {
+                m_pool.push_back(aMessage);
+
+                return;
+            }
+        }
+
+        delete aMessage;
+    }
+
+    /**
+     * Starts sending the datagrams of a message. Runs on the I/O thread.
+     * @param aMessage The message to send.
+     */
+    virtual void startSend(InFlightMessage *aMessage)
+    {
+#if BOOST_ASIO_VERSION >= 101200
+        // Unlike strand.wrap(), this lets asio see the handler's allocator
+        sendDatagrams(aMessage, boost::asio::bind_executor(m_strand, makeAllocatingHandler(m_handlerMemory,
+                boost::bind(&UdpTransport::handler, this, aMessage, boost::asio::placeholders::error))));
+#else
+        sendDatagrams(aMessage, m_strand.wrap(makeAllocatingHandler(m_handlerMemory,
+                boost::bind(&UdpTransport::handler, this, aMessage, boost::asio::placeholders::error))));
+#endif
+
+        m_pendingHandlers.fetch_sub(1, boost::memory_order_release);
+    }
+
+    /**
+     * Sends each datagram of a message to the UDP endpoint.
+     * @param aMessage The message to send.
+     * @param aHandler The completion handler for each datagram.
+     */
+    template <typename Handler>
+    void sendDatagrams(InFlightMessage *aMessage, const Handler &aHandler)
+    {
+        for (size_t i = 0; i < aMessage->message.chunkCount(); ++i)
+        {
+            m_pendingHandlers.fetch_add(1, boost::memory_order_relaxed);
+
+            // Send the header and payload slice to the UDP endpoint
+            if (m_socketConnected)
+            {
+                m_socket->async_send(aMessage->message.datagram(i), aHandler);
+            }
+            else
+            {
+                m_socket->async_send_to(aMessage->message.datagram(i), aMessage->endpoint, aHandler);
+            }
+        }
+    }
+
+    /**
+     * Handler for the Boost async_send_to(). Records errors and returns the
+     * message buffer to the pool once all of its datagrams have completed.
+     * @param aMessage The message being sent.
+     * @param anError The result of the send.
+     */
+    virtual void handler(InFlightMessage *aMessage,
+                         const boost::system::error_code &anError)
+    {
+        if (anError)
+        {
+            recordError(anError.value());
+        }
+
+        if (--aMessage->pendingDatagrams == 0)
+        {
+            releaseMessage(aMessage);
+        }
+
+        // Last, since the destructor may go ahead once this reaches zero
+        m_pendingHandlers.fetch_sub(1, boost::memory_order_release);
+    }
+
+    /**
+     * Counts a failed send.
+     * @param anError The error value.
+     */
+    void recordError(const int &anError)
+    {
+        m_sendErrors.fetch_add(1, boost::memory_order_relaxed);
+        m_lastError.store(anError, boost::memory_order_relaxed);
+
+        // The path MTU has shrunk below the chunk size
+        if (anError == EMSGSIZE)
+        {
+            m_mtuProbeRequested.store(true, boost::memory_order_relaxed);
+        }
     }
 };
 
@@ -0,0 +1,296 @@
+/*
+ * File:   WaitStrategy.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(WAITSTRATEGY_HPP)
+#define WAITSTRATEGY_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Header Files
+
+#include <ctime>
+#include <climits>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+// Third-party Header Files
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace appender
+{
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const unsigned DEFAULT_SPIN_BUDGET = 2000; ///< Polls before yielding or parking.
+
+/*- ENUMERATIONS -------------------------------------------------------------*/
+
+/**
+ * How the sender thread waits for events.
+ */
+enum WaitStrategy
+{
+    WAIT_SPIN, ///< Poll without pause; lowest latency, burns a core.
+    WAIT_YIELD, ///< Poll for the spin budget, then yield between polls.
+    WAIT_PARK, ///< Sleep in the kernel until a producer wakes it.
+    WAIT_HYBRID ///< Poll for the spin budget, then sleep.
+};
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * Puts the single consumer of a queue to sleep until there is work, and lets
+ * producers wake it.
+ *
+ * A parked consumer sleeps on a futex on Linux, and on a condition variable
+ * elsewhere. Producers only make a system call for the first event after the
+ * consumer parked, that is on the empty to non-empty transition; while the
+ * consumer is awake or polling notify() is a fence and a load.
+ */
+class Waiter : private boost::noncopyable
+{
+public:
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor.
+     * @param aStrategy How to wait.
+     * @param aSpinBudget How many times to poll before yielding or parking.
+     */
+    explicit Waiter(const WaitStrategy &aStrategy = WAIT_PARK,
+                    const unsigned &aSpinBudget = DEFAULT_SPIN_BUDGET) :
+        m_strategy(aStrategy),
+        m_spinBudget(aSpinBudget),
+        m_state(AWAKE)
+    {
+    }
+
+    // Methods
+
+    /**
+     * Gets how the consumer waits.
+     * @return The wait strategy.
+     */
+    WaitStrategy strategy() const
+    {
+        return m_strategy.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets how many times the consumer polls before yielding or parking.
+     * Not used by WAIT_SPIN, which polls forever, or WAIT_PARK, which does
+     * not poll.
+     * @return The spin budget.
+     */
+    unsigned spinBudget() const
+    {
+        return m_spinBudget.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Sets how the consumer waits. Takes effect on its next wait, and may be
+     * called from any thread while the consumer runs.
+     * @param aStrategy How to wait.
+     * @param aSpinBudget How many times to poll before yielding or parking.
+     */
+    void strategy(const WaitStrategy &aStrategy, const unsigned &aSpinBudget)
+    {
+        m_strategy.store(aStrategy, boost::memory_order_relaxed);
+        m_spinBudget.store(aSpinBudget, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Waits until there is work. Must only be called from the consumer.
+     * @param aReady Returns true once there is work.
+     * @param aTimeoutMs The longest to sleep while parked.
+     */
+    template <typename Predicate>
+    void wait(Predicate aReady, const long &aTimeoutMs)
+    {
+        WaitStrategy strategy = m_strategy.load(boost::memory_order_relaxed);
+        unsigned spinBudget = m_spinBudget.load(boost::memory_order_relaxed);
+
+        // Spinning polls forever; parking goes straight to sleep
+        if (strategy == WAIT_SPIN)
+        {
+            spinBudget = UINT_MAX;
+        }
+        else if (strategy == WAIT_PARK)
+        {
+            spinBudget = 0;
+        }
+
+        for (;;)
+        {
+            for (unsigned i = 0; i < spinBudget; ++i)
+            {
+                if (aReady())
+                {
+                    return;
+                }
+
+                pause();
+            }
+
+            switch (strategy)
+            {
+            case WAIT_SPIN:
+                break;
+
+            case WAIT_YIELD:
+                if (aReady())
+                {
+                    return;
+                }
+
+                boost::this_thread::yield();
+                break;
+
+            default:
+                park(aReady, aTimeoutMs);
+                return;
+            }
+        }
+    }
+
+    /**
+     * Tells the consumer there is work. Call after publishing the work.
+     */
+    void notify()
+    {
+        // Order the published work before the check of the state
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+        if (m_state.load(boost::memory_order_relaxed) == PARKED &&
+            m_state.exchange(AWAKE) == PARKED)
+        {
+            unpark();
+        }
+    }
+
+    /**
+     * Wakes the consumer if it is parked, whatever the state of the work.
+     */
+    void wake()
+    {
+        m_state.store(AWAKE);
+        unpark();
+    }
+
+protected:
+
+    // Type Definitions
+
+    /**
+     * The states of the consumer, as seen by the producers.
+     */
+    enum State
+    {
+        AWAKE, ///< Running or polling.
+        PARKED ///< Asleep until woken.
+    };
+
+    // Attributes
+
+    boost::atomic<WaitStrategy> m_strategy; ///< How to wait.
+    boost::atomic<unsigned> m_spinBudget; ///< Polls before yielding or parking.
+    boost::atomic<int> m_state; ///< AWAKE or PARKED, and the futex word.
+
+#if !defined(__linux__)
+    boost::mutex m_mutex; ///< Mutex for m_condition.
+    boost::condition_variable m_condition; ///< Wakes the parked consumer.
+#endif
+
+    // Methods
+
+    /**
+     * Sleeps until a producer wakes the consumer or the timeout passes.
+     * @param aReady Returns true once there is work.
+     * @param aTimeoutMs The longest to sleep.
+     */
+    template <typename Predicate>
+    void park(Predicate &aReady, const long &aTimeoutMs)
+    {
+#if !defined(__linux__)
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+#endif
+
+        m_state.store(PARKED);
+
+        // Check again now that producers can see we are about to sleep
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+        if (!aReady())
+        {
+#if defined(__linux__)
+            BOOST_STATIC_ASSERT(sizeof(boost::atomic<int>) == sizeof(int));
+
+            struct timespec timeout;
+            timeout.tv_sec = aTimeoutMs / 1000;
+            timeout.tv_nsec = (aTimeoutMs % 1000) * 1000000;
+
+            // Returns at once if a producer already set the state back
+            syscall(SYS_futex, reinterpret_cast<int*>(&m_state), FUTEX_WAIT_PRIVATE,
+                    (int) PARKED, &timeout, NULL, 0);
+#else
+            if (m_state.load() == PARKED)
+            {
+                m_condition.timed_wait(lock, boost::posix_time::milliseconds(aTimeoutMs));
+            }
+#endif
+        }
+
+        m_state.store(AWAKE);
+    }
+
+    /**
+     * Wakes the parked consumer.
+     */
+    void unpark()
+    {
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<int*>(&m_state), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_condition.notify_one();
+#endif
+    }
+
+    /**
+     * Tells the CPU we are polling, which saves power and lets a sibling
+     * hyper-thread run.
+     */
+    static void pause()
+    {
+#if defined(__i386__) || defined(__x86_64__)
+        __asm__ __volatile__("pause");
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+};
+
+} // namespace appender
+} // namespace gelf4cplus
+
+#endif // #if !defined(WAITSTRATEGY_HPP)
@@ -0,0 +1,482 @@
+/*
+ * File:   WorkerPool.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ */
+
+#if !defined(WORKERPOOL_HPP)
+#define WORKERPOOL_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Header Files
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdint.h>
+
+// Third-party Header Files
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// Other Header Files
+
+#include "CapturedEvent.hpp"
+#include "Buffer.hpp"
+#include "CompressionLevelController.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+namespace gelf4cplus
+{
+namespace appender
+{
+
+using std::string;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t JOBS_PER_WORKER = 4; ///< Jobs in flight per worker.
+const long WORKER_IDLE_WAIT_MS = 100; ///< Longest a worker sleeps unwoken.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A batch of events moved out of the queue, and the messages built from them.
+ */
+struct SenderJob : private boost::noncopyable
+{
+    std::vector<CapturedEvent> events; ///< The events.
+    std::vector<transport::Buffer> messages; ///< The messages built from them.
+    size_t count; ///< The number of events.
+    size_t built; ///< The number of messages.
+    uint64_t sequence; ///< The order the job was submitted in.
+
+    /**
+     * The constructor.
+     * @param aSize The most events the job can hold.
+     */
+    explicit SenderJob(const size_t &aSize) :
+        events(aSize),
+        messages(aSize),
+        count(0),
+        built(0),
+        sequence(0)
+    {
+    }
+};
+
+/**
+ * Threads that build and compress messages in parallel for the sender thread.
+ *
+ * The sender thread fills jobs with events and submits them round-robin to
+ * the workers' deques. A worker takes jobs from the front of its own deque
+ * and, when that is empty, steals from the back of the others', so a worker
+ * stuck on large messages does not hold up the rest. Only a worker that finds
+ * every deque empty touches the shared idle count and sleeps; the sender
+ * thread wakes one only if some are asleep. Finished jobs are sent one at a
+ * time; in ordered mode they are sent in the order they were submitted, so
+ * messages leave in queue order, and a job that finishes early waits for the
+ * ones before it. Whoever sends the last job in flight also flushes, so the
+ * sender thread need not wait for the workers except to flush or stop.
+ *
+ * At most JOBS_PER_WORKER jobs per worker are in flight, which bounds the
+ * memory used and makes the sender thread wait while the workers catch up.
+ */
+class WorkerPool : private boost::noncopyable
+{
+public:
+
+    // Type Definitions
+
+    typedef boost::function<void (SenderJob&, string&)> BuildFunction; ///< Builds a job's messages.
+    typedef boost::function<void (SenderJob&)> SendFunction; ///< Sends a job's messages.
+    typedef boost::function<void ()> FlushFunction; ///< Flushes what was sent.
+
+    // Constructors & Destructor
+
+    /**
+     * The constructor, which starts the workers.
+     * @param aWorkers The number of worker threads.
+     * @param anOrdered True to send jobs in the order they were submitted.
+     * @param aJobSize The most events per job.
+     * @param aBuild Builds the messages of a job, given a buffer to reuse.
+     * @param aSend Sends the messages of a job. Never called concurrently.
+     * @param aFlush Flushes once no job is in flight. Never called
+     * concurrently with aSend.
+     */
+    WorkerPool(const size_t &aWorkers,
+               const bool &anOrdered,
+               const size_t &aJobSize,
+               const BuildFunction &aBuild,
+               const SendFunction &aSend,
+               const FlushFunction &aFlush) :
+        m_ordered(anOrdered),
+        m_build(aBuild),
+        m_send(aSend),
+        m_flush(aFlush),
+        m_queues(aWorkers),
+        m_idleWorkers(0),
+        m_stopping(false),
+        m_jobs(aWorkers * JOBS_PER_WORKER),
+        m_inFlight(0),
+        m_nextSequence(0),
+        m_nextWorker(0),
+        m_finished(aWorkers * JOBS_PER_WORKER, NULL),
+        m_nextToSend(0),
+        m_cpuMicroseconds(0)
+    {
+        for (size_t i = 0; i < m_jobs.size(); ++i)
+        {
+            m_jobs[i].reset(new SenderJob(aJobSize));
+            m_freeJobs.push_back(m_jobs[i].get());
+        }
+
+        // Workers steal from every deque, so create them all first
+        for (size_t i = 0; i < aWorkers; ++i)
+        {
+            m_queues[i].reset(new WorkQueue());
+        }
+
+        for (size_t i = 0; i < aWorkers; ++i)
+        {
+            m_threads.create_thread(boost::bind(&WorkerPool::workerLoop, this, i));
+        }
+    }
+
+    /**
+     * The destructor, which finishes the submitted jobs and stops the workers.
+     */
+    ~WorkerPool()
+    {
+        drain();
+
+        {
+            boost::lock_guard<boost::mutex> lock(m_workMutex);
+            m_stopping = true;
+            m_workCondition.notify_all();
+        }
+
+        m_threads.join_all();
+    }
+
+    // Methods
+
+    /**
+     * Gets the number of worker threads.
+     * @return The number of workers.
+     */
+    size_t workers() const
+    {
+        return m_queues.size();
+    }
+
+    /**
+     * Gets the CPU time the workers have spent on finished jobs, for the
+     * compression level controller.
+     * @return Microseconds of CPU time, summed over the workers.
+     */
+    int64_t cpuMicroseconds() const
+    {
+        return m_cpuMicroseconds.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Gets an empty job to fill, waiting for the workers if all jobs are in
+     * flight. Must only be called from the sender thread.
+     * @return The job.
+     */
+    SenderJob* acquire()
+    {
+        boost::unique_lock<boost::mutex> lock(m_jobMutex);
+
+        while (m_freeJobs.empty())
+        {
+            m_jobCondition.wait(lock);
+        }
+
+        SenderJob *job = m_freeJobs.back();
+        m_freeJobs.pop_back();
+        ++m_inFlight;
+
+        job->count = 0;
+        job->built = 0;
+
+        return job;
+    }
+
+    /**
+     * Hands a filled job to the workers. Must only be called from the sender
+     * thread.
+     * @param aJob The job from acquire().
+     */
+    void submit(SenderJob *aJob)
+    {
+        aJob->sequence = m_nextSequence++;
+
+        WorkQueue &queue = *m_queues[m_nextWorker];
+        m_nextWorker = (m_nextWorker + 1) % m_queues.size();
+
+        {
+            boost::lock_guard<boost::mutex> lock(queue.mutex);
+            queue.jobs.push_back(aJob);
+        }
+
+        // A worker going idle counts itself before it looks at the deques
+        // one last time, so either it sees the job or we see it
+        if (m_idleWorkers.load() != 0)
+        {
+            boost::lock_guard<boost::mutex> lock(m_workMutex);
+            m_workCondition.notify_one();
+        }
+    }
+
+    /**
+     * Waits until every submitted job has been sent and flushed.
+     */
+    void drain()
+    {
+        boost::unique_lock<boost::mutex> lock(m_jobMutex);
+
+        while (m_inFlight != 0)
+        {
+            m_jobCondition.wait(lock);
+        }
+
+        lock.unlock();
+
+        // The worker that sent the last job may still be flushing
+        boost::lock_guard<boost::mutex> sendLock(m_sendMutex);
+    }
+
+protected:
+
+    // Type Definitions
+
+    /**
+     * The jobs waiting for one worker.
+     */
+    struct WorkQueue : private boost::noncopyable
+    {
+        boost::mutex mutex; ///< Guards jobs.
+        std::deque<SenderJob*> jobs; ///< The jobs, oldest first.
+    };
+
+    // Attributes
+
+    const bool m_ordered; ///< Send jobs in submission order?
+    BuildFunction m_build; ///< Builds a job's messages.
+    SendFunction m_send; ///< Sends a job's messages.
+    FlushFunction m_flush; ///< Flushes what was sent.
+    std::vector< boost::shared_ptr<WorkQueue> > m_queues; ///< One per worker.
+    boost::mutex m_workMutex; ///< Guards m_stopping and idle waits.
+    boost::condition_variable m_workCondition; ///< Wakes idle workers.
+    boost::atomic<size_t> m_idleWorkers; ///< Workers asleep or about to be.
+    bool m_stopping; ///< Should the workers exit?
+    std::vector< boost::shared_ptr<SenderJob> > m_jobs; ///< Every job.
+    boost::mutex m_jobMutex; ///< Guards m_freeJobs and m_inFlight.
+    boost::condition_variable m_jobCondition; ///< Signals a job coming back.
+    std::vector<SenderJob*> m_freeJobs; ///< Jobs not in flight.
+    size_t m_inFlight; ///< Jobs acquired but not yet sent.
+    uint64_t m_nextSequence; ///< Sequence of the next submitted job.
+    size_t m_nextWorker; ///< Worker the next job is submitted to.
+    boost::mutex m_sendMutex; ///< Serializes sending and flushing.
+    std::vector<SenderJob*> m_finished; ///< Built jobs waiting for their turn.
+    uint64_t m_nextToSend; ///< Sequence of the next job to send in order.
+    boost::thread_group m_threads; ///< The workers.
+    boost::atomic<int64_t> m_cpuMicroseconds; ///< CPU time of the workers.
+
+    // Methods
+
+    /**
+     * The body of a worker thread.
+     * @param anIndex The worker's own deque.
+     */
+    void workerLoop(const size_t &anIndex)
+    {
+        string jsonString;
+        int64_t cpu = CompressionLevelController::threadCpuMicroseconds();
+
+        while (SenderJob *job = take(anIndex))
+        {
+            try
+            {
+                m_build(*job, jsonString);
+            }
+            catch (...)
+            {
+                // Whatever was built is still sent
+            }
+
+            int64_t now = CompressionLevelController::threadCpuMicroseconds();
+            m_cpuMicroseconds.fetch_add(now - cpu, boost::memory_order_relaxed);
+            cpu = now;
+
+            finish(job);
+        }
+    }
+
+    /**
+     * Takes the next job for a worker, stealing one if its own deque is empty,
+     * and sleeping if every deque is.
+     * @param anIndex The worker's own deque.
+     * @return The job, or NULL once the pool is stopping and no job is left.
+     */
+    SenderJob* take(const size_t &anIndex)
+    {
+        if (SenderJob *job = pop(anIndex))
+        {
+            return job;
+        }
+
+        boost::unique_lock<boost::mutex> lock(m_workMutex);
+
+        for (;;)
+        {
+            // Count ourselves idle before looking again, so that a job
+            // submitted after the last look wakes us
+            m_idleWorkers.fetch_add(1);
+            SenderJob *job = pop(anIndex);
+
+            if (job == NULL && !m_stopping)
+            {
+                m_workCondition.timed_wait(lock, boost::posix_time::milliseconds(WORKER_IDLE_WAIT_MS));
+            }
+
+            m_idleWorkers.fetch_sub(1);
+
+            if (job != NULL || (job = pop(anIndex)) != NULL || m_stopping)
+            {
+                return job;
+            }
+        }
+    }
+
+    /**
+     * Takes a job from the deques: the oldest of a worker's own, or else the
+     * newest of the others'.
+     * @param anIndex The worker's own deque.
+     * @return The job, or NULL if every deque is empty.
+     */
+    SenderJob* pop(const size_t &anIndex)
+    {
+        for (size_t i = 0; i < m_queues.size(); ++i)
+        {
+            WorkQueue &queue = *m_queues[(anIndex + i) % m_queues.size()];
+            boost::lock_guard<boost::mutex> lock(queue.mutex);
+
+            if (!queue.jobs.empty())
+            {
+                SenderJob *job;
+
+                if (i == 0)
+                {
+                    job = queue.jobs.front();
+                    queue.jobs.pop_front();
+                }
+                else
+                {
+                    job = queue.jobs.back();
+                    queue.jobs.pop_back();
+                }
+
+                return job;
+            }
+        }
+
+        return NULL;
+    }
+
+    /**
+     * Sends a built job, and in ordered mode every job after it that is
+     * already built, then gives them back to the sender thread.
+     * @param aJob The built job.
+     */
+    void finish(SenderJob *aJob)
+    {
+        size_t sent = 0;
+
+        {
+            boost::lock_guard<boost::mutex> lock(m_sendMutex);
+
+            if (!m_ordered)
+            {
+                send(aJob);
+                sent = 1;
+            }
+            else
+            {
+                m_finished[aJob->sequence % m_finished.size()] = aJob;
+
+                while (SenderJob *job = m_finished[m_nextToSend % m_finished.size()])
+                {
+                    m_finished[m_nextToSend % m_finished.size()] = NULL;
+                    ++m_nextToSend;
+
+                    send(job);
+                    ++sent;
+                }
+            }
+
+            if (sent == 0)
+            {
+                return;
+            }
+
+            bool idle;
+
+            {
+                boost::lock_guard<boost::mutex> lock(m_jobMutex);
+                m_inFlight -= sent;
+                idle = m_inFlight == 0;
+                m_jobCondition.notify_all();
+            }
+
+            // Nothing else is in flight to send for now, so flush
+            if (idle)
+            {
+                try
+                {
+                    m_flush();
+                }
+                catch (...)
+                {
+                }
+            }
+        }
+    }
+
+    /**
+     * Sends a job and puts it back on the free list. Called with m_sendMutex
+     * held.
+     * @param aJob The built job.
+     */
+    void send(SenderJob *aJob)
+    {
+        try
+        {
+            m_send(*aJob);
+        }
+        catch (...)
+        {
+        }
+
+        boost::lock_guard<boost::mutex> lock(m_jobMutex);
+        m_freeJobs.push_back(aJob);
+    }
+};
+
+} // namespace appender
+} // namespace gelf4cplus
+
+#endif // #if !defined(WORKERPOOL_HPP)
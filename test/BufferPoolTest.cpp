@@ -0,0 +1,133 @@
+/*
+ * File:   BufferPoolTest.cpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ *
+ * Builds messages of mixed sizes in pooled buffers that a stand-in transport
+ * holds for a while, and checks that once the pool has warmed up no buffer
+ * comes from the general heap. Build and run from the repository root with:
+ *
+ *   g++ -Iinclude test/BufferPoolTest.cpp -o BufferPoolTest \
+ *       -lboost_thread -lboost_system -lz -lpthread && ./BufferPoolTest
+ */
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <vector>
+
+// Third-party Headers
+
+#include <boost/lexical_cast.hpp>
+
+// Other Headers
+
+#include "TestSupport.hpp"
+#include "gelf4cplus/Buffer.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+using std::string;
+using namespace gelf4cplus::transport;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t HELD_MESSAGES = 8; ///< Messages the stand-in transport holds.
+const size_t MESSAGES = 1000; ///< Messages built in each round.
+
+/*- FUNCTIONS ----------------------------------------------------------------*/
+
+/**
+ * Gets the size of a message, cycling from a few bytes to a few chunks.
+ * @param anIndex The number of the message.
+ * @return The size in bytes.
+ */
+size_t messageSize(const size_t &anIndex)
+{
+    const size_t sizes[] = {100, 3000, 600, 20000, 40, 100000, 7000, 1500};
+
+    return sizes[anIndex % (sizeof(sizes) / sizeof(sizes[0]))];
+}
+
+/**
+ * Builds messages the way the appender does: one buffer, prepared before
+ * each message with the last one's length as the hint, and shared with a
+ * transport that lets go of it some messages later.
+ * @param aHint Pass the hint, or prepare without one?
+ * @return The heap allocations of the pool during the round.
+ */
+uint64_t buildMessages(const bool &aHint)
+{
+    uint64_t allocations = BufferPool::instance().allocations();
+
+    Buffer message;
+    std::vector<Buffer> held(HELD_MESSAGES);
+
+    for (size_t i = 0; i < MESSAGES; ++i)
+    {
+        if (aHint)
+        {
+            message.prepare(message.length());
+        }
+        else
+        {
+            message.prepare();
+        }
+
+        message.bytes().assign(messageSize(i), (char) ('a' + i % 26));
+        held[i % HELD_MESSAGES] = message;
+    }
+
+    return BufferPool::instance().allocations() - allocations;
+}
+
+/**
+ * Once warmed up, building messages of mixed sizes takes every buffer from
+ * the pool, with or without a size hint.
+ */
+void testSteadyState()
+{
+    buildMessages(true);
+
+    uint64_t allocations = buildMessages(true);
+    check(allocations == 0, "allocations with a hint: " + boost::lexical_cast<string>(allocations));
+
+    allocations = buildMessages(false);
+    check(allocations == 0, "allocations without a hint: " + boost::lexical_cast<string>(allocations));
+}
+
+/**
+ * Buffers that grew past the smallest class are handed out again to a
+ * caller that gives no hint.
+ */
+void testGrownBuffers()
+{
+    uint64_t allocations = BufferPool::instance().allocations();
+    Buffer message;
+
+    for (size_t i = 0; i < MESSAGES; ++i)
+    {
+        Buffer sent;
+        message.prepare();
+        message.bytes().assign(3000, 'x');
+        sent = message;
+    }
+
+    allocations = BufferPool::instance().allocations() - allocations;
+    check(allocations <= 2, "allocations for grown buffers: " + boost::lexical_cast<string>(allocations));
+}
+
+/**
+ * Runs the tests.
+ * @return 0 if every check passed.
+ */
+int main()
+{
+    testSteadyState();
+    testGrownBuffers();
+
+    return report();
+}
@@ -0,0 +1,240 @@
+/*
+ * File:   CompressedPrefixTest.cpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ *
+ * Compresses messages with a CompressedPrefix, which splices the cached
+ * blocks of the prefix onto freshly compressed ones, and inflates them with
+ * plain zlib, which checks the framing and the checksums. Build and run from
+ * the repository root with:
+ *
+ *   g++ -Iinclude test/CompressedPrefixTest.cpp -o CompressedPrefixTest \
+ *       -lboost_thread -lboost_system -lz -lpthread && ./CompressedPrefixTest
+ */
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+// Third-party Headers
+
+#include <zlib.h>
+#include <boost/lexical_cast.hpp>
+
+// Other Headers
+
+#include "TestSupport.hpp"
+#include "gelf4cplus/Compressor.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+using std::string;
+using namespace gelf4cplus::message;
+
+/*- FUNCTIONS ----------------------------------------------------------------*/
+
+/**
+ * Inflates a whole zlib or gzip stream, as a GELF input would.
+ * @param aCompression The framing of the stream.
+ * @param aStream The stream.
+ * @param aMessage The inflated message.
+ * @return False if the stream is not one whole, valid stream.
+ */
+bool inflateStream(const Compression &aCompression, const string &aStream, string &aMessage)
+{
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+
+    if (inflateInit2(&stream, aCompression == COMPRESSION_ZLIB ? ZLIB_WINDOW_BITS : GZIP_WINDOW_BITS) != Z_OK)
+    {
+        return false;
+    }
+
+    stream.next_in = (Bytef*) aStream.data();
+    stream.avail_in = (uInt) aStream.length();
+
+    aMessage.clear();
+
+    char output[16384];
+    int result;
+
+    do
+    {
+        stream.next_out = (Bytef*) output;
+        stream.avail_out = sizeof(output);
+
+        result = inflate(&stream, Z_NO_FLUSH);
+        aMessage.append(output, sizeof(output) - stream.avail_out);
+    }
+    while (result == Z_OK);
+
+    inflateEnd(&stream);
+
+    // The trailer is checked before Z_STREAM_END, and nothing may follow it
+    return result == Z_STREAM_END && stream.avail_in == 0;
+}
+
+/**
+ * Builds a message tail of a given kind.
+ * @param aKind Which kind of tail.
+ * @param aPrefix The prefix, which some tails repeat.
+ * @return The tail.
+ */
+string createTail(const int &aKind, const string &aPrefix)
+{
+    string tail;
+
+    switch (aKind)
+    {
+    case 0:
+        // Nothing after the prefix
+        break;
+
+    case 1:
+        tail = "\"short_message\":\"Hello\",\"timestamp\":1337705820.123456,\"level\":6}";
+        break;
+
+    case 2:
+        // Matches that reach back into the prefix
+        tail = aPrefix.substr(0, std::min<size_t>(aPrefix.length(), 500)) + "\"level\":3}";
+        break;
+
+    case 3:
+        // Incompressible
+        for (size_t i = 0; i < 100000; ++i)
+        {
+            tail += (char) (std::rand() & 0xff);
+        }
+
+        break;
+
+    default:
+        // Longer than the deflate window
+        for (size_t i = 0; i < 20000; ++i)
+        {
+            tail += "\"_field" + boost::lexical_cast<string>(i % 97) + "\":\"value\",";
+        }
+
+        break;
+    }
+
+    return tail;
+}
+
+/**
+ * Every spliced stream inflates back to the message, for both framings, at
+ * every level and for prefixes shorter and longer than the deflate window.
+ */
+void testRoundTrip()
+{
+    string shortPrefix = "{\"version\":\"1.1\",\"host\":\"test-host.example.com\",\"facility\":\"gelf4cplus\","
+                         "\"_application\":\"CompressedPrefixTest\",\"_environment\":\"test\",";
+    string longPrefix = shortPrefix;
+
+    for (size_t i = 0; longPrefix.length() < MAX_DICTIONARY_SIZE + 8000; ++i)
+    {
+        longPrefix += "\"_static" + boost::lexical_cast<string>(i) + "\":\"" + string(i % 50, 'v') + "\",";
+    }
+
+    const string *prefixes[] = {&shortPrefix, &longPrefix};
+    const int levels[] = {Z_DEFAULT_COMPRESSION, Z_NO_COMPRESSION, Z_BEST_SPEED, 6, Z_BEST_COMPRESSION};
+    const Compression compressions[] = {COMPRESSION_ZLIB, COMPRESSION_GZIP};
+
+    for (size_t p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); ++p)
+    {
+        CompressedPrefix prefix(*prefixes[p]);
+
+        for (int kind = 0; kind < 5; ++kind)
+        {
+            string message = *prefixes[p] + createTail(kind, *prefixes[p]);
+
+            for (size_t c = 0; c < sizeof(compressions) / sizeof(compressions[0]); ++c)
+            {
+                for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l)
+                {
+                    string what = "prefix " + boost::lexical_cast<string>(p) +
+                                  ", tail " + boost::lexical_cast<string>(kind) +
+                                  ", framing " + boost::lexical_cast<string>(compressions[c]) +
+                                  ", level " + boost::lexical_cast<string>(levels[l]);
+
+                    string compressed;
+                    prefix.compress(compressions[c], message, compressed, levels[l]);
+
+                    string inflated;
+                    check(inflateStream(compressions[c], compressed, inflated), what + " inflates");
+                    check(inflated == message, what + " round trip");
+                    check(Compressor::compressed(compressed.data(), compressed.length()),
+                          what + " has the magic bytes");
+                }
+            }
+        }
+    }
+}
+
+/**
+ * A message without the prefix is compressed whole, and still inflates.
+ */
+void testWithoutPrefix()
+{
+    CompressedPrefix prefix("{\"version\":\"1.1\",\"host\":\"test-host\",");
+    string message = "{\"version\":\"1.1\",\"host\":\"other-host\",\"short_message\":\"Hello\"}";
+
+    for (int c = COMPRESSION_ZLIB; c <= COMPRESSION_GZIP; ++c)
+    {
+        string compressed;
+        prefix.compress((Compression) c, message, compressed);
+
+        string inflated;
+        check(inflateStream((Compression) c, compressed, inflated) && inflated == message,
+              "message without the prefix, framing " + boost::lexical_cast<string>(c));
+    }
+}
+
+/**
+ * Messages compressed one after another on the same thread, which reuses
+ * its deflate context, do not leak into each other.
+ */
+void testReuse()
+{
+    string prefixText = "{\"version\":\"1.1\",\"host\":\"test-host\",";
+    CompressedPrefix prefix(prefixText);
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        string message = prefixText + "\"short_message\":\"message " + boost::lexical_cast<string>(i) + "\"," +
+                         string(i % 300, (char) ('a' + i % 26)) + "}";
+        Compression compression = i % 2 == 0 ? COMPRESSION_ZLIB : COMPRESSION_GZIP;
+        int level = i % 11 - 1;
+
+        string compressed;
+        prefix.compress(compression, message, compressed, level);
+
+        string inflated;
+
+        if (!inflateStream(compression, compressed, inflated) || inflated != message)
+        {
+            check(false, "message " + boost::lexical_cast<string>(i) + " in a row");
+
+            return;
+        }
+    }
+}
+
+/**
+ * Runs the tests.
+ * @return 0 if every check passed.
+ */
+int main()
+{
+    testRoundTrip();
+    testWithoutPrefix();
+    testReuse();
+
+    return report();
+}
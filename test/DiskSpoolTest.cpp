@@ -0,0 +1,458 @@
+/*
+ * File:   DiskSpoolTest.cpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ *
+ * Writes messages to a DiskSpool in a temporary directory, damages the
+ * segment files the way a crash or a full disk can, and checks what a spool
+ * opened on the same directory recovers. Also checks the disk budget. Build
+ * and run from the repository root with:
+ *
+ *   g++ -Iinclude test/DiskSpoolTest.cpp -o DiskSpoolTest \
+ *       -lboost_thread -lboost_system -lz -lpthread && ./DiskSpoolTest
+ */
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <cstdio>
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+// Third-party Headers
+
+#include <boost/lexical_cast.hpp>
+
+// Other Headers
+
+#include "TestSupport.hpp"
+#include "gelf4cplus/DiskSpool.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+using std::string;
+using namespace gelf4cplus::transport;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t SEGMENT_SIZE = SPOOL_HEADER_SIZE + 4096; ///< The smallest segment.
+const size_t WRITE_OFFSET = 32; ///< Where a segment header keeps its write offset.
+
+/*- FUNCTIONS ----------------------------------------------------------------*/
+
+/**
+ * Creates an empty temporary directory for a spool.
+ * @return The directory, or an empty string if it could not be created.
+ */
+string createDirectory()
+{
+    char directory[] = "/tmp/DiskSpoolTest.XXXXXX";
+
+    return ::mkdtemp(directory) != NULL ? directory : "";
+}
+
+/**
+ * Deletes a temporary directory and the segment files in it.
+ * @param aDirectory The directory.
+ */
+void removeDirectory(const string &aDirectory)
+{
+    std::system(("rm -rf " + aDirectory).c_str());
+}
+
+/**
+ * Gets the file name of a segment, the way the spool names it.
+ * @param aDirectory The directory of the spool.
+ * @param aSequence The sequence number of the segment.
+ * @return The file name.
+ */
+string segmentPath(const string &aDirectory, const uint64_t &aSequence)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "spool-%016llx.seg", (unsigned long long) aSequence);
+
+    return aDirectory + "/" + name;
+}
+
+/**
+ * Gets a message of a length that varies with its number.
+ * @param anIndex The number of the message.
+ * @return The message.
+ */
+string message(const size_t &anIndex)
+{
+    string text = "message " + boost::lexical_cast<string>(anIndex) + " ";
+
+    return text + string(anIndex * 37 % 200, (char) ('a' + anIndex % 26));
+}
+
+/**
+ * Gets the space a record takes up in a segment, the way the spool lays it
+ * out.
+ * @param aLength The length of the message.
+ * @return The record size.
+ */
+size_t recordSize(const size_t &aLength)
+{
+    return (SPOOL_RECORD_HEADER_SIZE + aLength + 7) & ~(size_t) 7;
+}
+
+/**
+ * Appends messages to a spool.
+ * @param aSpool The spool.
+ * @param aFirst The number of the first message.
+ * @param aCount The number of messages.
+ * @return The number of messages the spool took.
+ */
+size_t append(DiskSpool &aSpool, const size_t &aFirst, const size_t &aCount)
+{
+    size_t appended = 0;
+
+    for (size_t i = aFirst; i < aFirst + aCount; ++i)
+    {
+        string text = message(i);
+
+        if (aSpool.append(text.data(), text.length()))
+        {
+            ++appended;
+        }
+    }
+
+    return appended;
+}
+
+/**
+ * Reads messages from a spool and checks that they are the expected ones.
+ * @param aSpool The spool.
+ * @param aFirst The number of the first message expected.
+ * @param aCount The number of messages expected.
+ * @param aWhat What is being read, for the checks.
+ */
+void expect(DiskSpool &aSpool, const size_t &aFirst, const size_t &aCount, const string &aWhat)
+{
+    check(aSpool.size() == aCount, aWhat + ": " + boost::lexical_cast<string>(aSpool.size()) +
+          " messages, not " + boost::lexical_cast<string>(aCount));
+
+    string text;
+    size_t read = 0;
+
+    while (aSpool.read(text))
+    {
+        if (text != message(aFirst + read))
+        {
+            check(false, aWhat + ": message " + boost::lexical_cast<string>(aFirst + read) + " intact");
+
+            break;
+        }
+
+        ++read;
+    }
+
+    check(read == aCount, aWhat + ": read " + boost::lexical_cast<string>(read));
+    aSpool.rewind();
+}
+
+/**
+ * Overwrites bytes of a file.
+ * @param aPath The file.
+ * @param anOffset Where to write.
+ * @param aData The bytes.
+ * @param aLength The number of bytes.
+ */
+void overwrite(const string &aPath, const size_t &anOffset, const void *aData, const size_t &aLength)
+{
+    std::fstream file(aPath.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(anOffset);
+    file.write(static_cast<const char*>(aData), aLength);
+}
+
+/**
+ * Reads bytes of a file.
+ * @param aPath The file.
+ * @param anOffset Where to read.
+ * @param aData Where to put the bytes.
+ * @param aLength The number of bytes.
+ */
+void readBack(const string &aPath, const size_t &anOffset, void *aData, const size_t &aLength)
+{
+    std::ifstream file(aPath.c_str(), std::ios::binary);
+    file.seekg(anOffset);
+    file.read(static_cast<char*>(aData), aLength);
+}
+
+/**
+ * Counts the records in a segment file that have not been read.
+ * @param aPath The file.
+ * @return The number of records.
+ */
+size_t countRecords(const string &aPath)
+{
+    uint64_t offsets[2];
+    readBack(aPath, WRITE_OFFSET, offsets, sizeof(offsets));
+
+    size_t count = 0;
+
+    for (uint64_t offset = offsets[1]; offset < offsets[0]; ++count)
+    {
+        uint32_t length;
+        readBack(aPath, offset, &length, sizeof(length));
+
+        offset += recordSize(length);
+    }
+
+    return count;
+}
+
+/**
+ * Messages left in a spool, replayed or not, are picked up by the next spool
+ * on the same directory, across segments.
+ */
+void testReopen()
+{
+    string directory = createDirectory();
+
+    {
+        DiskSpool spool(directory, SEGMENT_SIZE);
+        check(append(spool, 0, 100) == 100, "reopen: messages appended");
+
+        // Replay the first 30
+        string text;
+
+        for (int i = 0; i < 30; ++i)
+        {
+            spool.read(text);
+        }
+
+        spool.confirm();
+    }
+
+    check(::access(segmentPath(directory, 1).c_str(), F_OK) == 0, "reopen: several segments");
+
+    DiskSpool spool(directory, SEGMENT_SIZE);
+    expect(spool, 30, 70, "reopen");
+    check(spool.corruptSegments() == 0 && spool.skippedSegments() == 0, "reopen: nothing damaged");
+
+    // New messages follow the recovered ones
+    check(append(spool, 100, 10) == 10, "reopen: appended after recovery");
+    expect(spool, 30, 80, "reopen and append");
+
+    removeDirectory(directory);
+}
+
+/**
+ * A record whose bytes do not match its CRC, or a header that claims more
+ * than was written, cuts the segment short at the last intact record.
+ */
+void testDamagedRecords()
+{
+    string directory = createDirectory();
+    string path = segmentPath(directory, 0);
+
+    {
+        DiskSpool spool(directory, SEGMENT_SIZE);
+        append(spool, 0, 10);
+    }
+
+    // The write offset moved past a record header that never got written
+    uint64_t writeOffset;
+    readBack(path, WRITE_OFFSET, &writeOffset, sizeof(writeOffset));
+
+    uint64_t tornOffset = writeOffset + 4;
+    overwrite(path, WRITE_OFFSET, &tornOffset, sizeof(tornOffset));
+
+    {
+        DiskSpool spool(directory, SEGMENT_SIZE);
+        expect(spool, 0, 10, "torn record header");
+        check(spool.corruptSegments() == 1, "torn record header counted");
+    }
+
+    // A message whose bytes never all made it to disk
+    size_t offset = SPOOL_HEADER_SIZE;
+
+    for (size_t i = 0; i < 7; ++i)
+    {
+        offset += recordSize(message(i).length());
+    }
+
+    overwrite(path, offset + SPOOL_RECORD_HEADER_SIZE, "X", 1);
+
+    {
+        DiskSpool spool(directory, SEGMENT_SIZE);
+        expect(spool, 0, 7, "bad CRC");
+        check(spool.corruptSegments() == 1, "bad CRC counted");
+
+        // The damaged records are written over
+        append(spool, 7, 3);
+    }
+
+    DiskSpool spool(directory, SEGMENT_SIZE);
+    expect(spool, 0, 10, "rewritten after bad CRC");
+    check(spool.corruptSegments() == 0, "rewritten segment intact");
+
+    removeDirectory(directory);
+}
+
+/**
+ * Files that are cut short or are not segments are left out and counted, and
+ * the rest of the spool is recovered.
+ */
+void testSkippedSegments()
+{
+    string directory = createDirectory();
+
+    {
+        DiskSpool spool(directory, SEGMENT_SIZE);
+        append(spool, 0, 100);
+    }
+
+    size_t last = 0;
+
+    while (::access(segmentPath(directory, last + 1).c_str(), F_OK) == 0)
+    {
+        ++last;
+    }
+
+    check(last >= 2, "skipped: several segments");
+
+    // Cut the newest segment short, and put garbage after it
+    size_t lost = countRecords(segmentPath(directory, last));
+
+    if (::truncate(segmentPath(directory, last).c_str(), SEGMENT_SIZE / 2) != 0)
+    {
+        check(false, "skipped: segment truncated");
+    }
+
+    {
+        std::ofstream garbage(segmentPath(directory, last + 1).c_str(), std::ios::binary);
+        garbage << string(SEGMENT_SIZE, 'x');
+    }
+
+    DiskSpool spool(directory, SEGMENT_SIZE);
+    check(spool.skippedSegments() == 2, "skipped: truncated and garbage files counted");
+    expect(spool, 0, 100 - lost, "skipped");
+
+    removeDirectory(directory);
+}
+
+/**
+ * A segment file too large to map while address space is short is left out
+ * and counted, instead of failing the spool's construction.
+ */
+void testUnmappableSegment()
+{
+    string directory = createDirectory();
+
+    {
+        DiskSpool spool(directory, SEGMENT_SIZE);
+        append(spool, 0, 5);
+    }
+
+    // A sparse segment of 1 TB, mapped before its header is looked at
+    string path = segmentPath(directory, 1);
+
+    {
+        std::ofstream file(path.c_str(), std::ios::binary);
+    }
+
+    if (::truncate(path.c_str(), (off_t) 1 << 40) != 0)
+    {
+        // The file system cannot hold such a file; nothing to check
+        removeDirectory(directory);
+
+        return;
+    }
+
+    // Leave room for the spool, but not for the mapping
+    long pages = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages;
+
+    struct rlimit saved;
+    ::getrlimit(RLIMIT_AS, &saved);
+
+    struct rlimit limit = saved;
+    limit.rlim_cur = (rlim_t) pages * ::sysconf(_SC_PAGESIZE) + 256 * 1024 * 1024;
+    ::setrlimit(RLIMIT_AS, &limit);
+
+    try
+    {
+        DiskSpool spool(directory, SEGMENT_SIZE);
+        ::setrlimit(RLIMIT_AS, &saved);
+
+        check(spool.skippedSegments() == 1, "unmappable segment counted");
+        expect(spool, 0, 5, "unmappable segment");
+    }
+    catch (const std::exception &exception)
+    {
+        ::setrlimit(RLIMIT_AS, &saved);
+        check(false, string("spool opened next to an unmappable segment: ") + exception.what());
+    }
+
+    removeDirectory(directory);
+}
+
+/**
+ * Messages past the disk budget are dropped and counted, and space comes
+ * back once the oldest segment has been replayed.
+ */
+void testBudget()
+{
+    string directory = createDirectory();
+    string text(1000, 'b');
+
+    DiskSpool spool(directory, SEGMENT_SIZE, 2 * SEGMENT_SIZE);
+
+    size_t appended = 0;
+
+    while (spool.append(text.data(), text.length()))
+    {
+        ++appended;
+    }
+
+    // Four records of 1008 bytes fit in a segment
+    check(appended == 8, "budget: messages appended: " + boost::lexical_cast<string>(appended));
+    check(spool.droppedMessages() == 1, "budget: dropped message counted");
+    check(::access(segmentPath(directory, 2).c_str(), F_OK) != 0, "budget: no third segment");
+
+    // Replaying the first segment makes room for another
+    string read;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        spool.read(read);
+    }
+
+    spool.confirm();
+
+    check(spool.append(text.data(), text.length()), "budget: appended after replay");
+    check(spool.size() == 5, "budget: messages left");
+    check(spool.droppedMessages() == 1, "budget: nothing else dropped");
+
+    // A message larger than a segment never fits
+    string large(SEGMENT_SIZE, 'l');
+    check(!spool.append(large.data(), large.length()), "budget: oversized message dropped");
+
+    removeDirectory(directory);
+}
+
+/**
+ * Runs the tests.
+ * @return 0 if every check passed.
+ */
+int main()
+{
+    testReopen();
+    testDamagedRecords();
+    testSkippedSegments();
+    testUnmappableSegment();
+    testBudget();
+
+    return report();
+}
@@ -0,0 +1,318 @@
+/*
+ * File:   Gelf4CPlusAppenderTest.cpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ *
+ * Appends events to a Gelf4CPlusAppender configured with additional fields,
+ * some named like standard fields or fields set per event, and checks that
+ * each message has the fields the appender used to send when it built its
+ * messages with GelfMessage, none of them twice. Also checks that worker
+ * threads send every event, in order, and flush without being waited for.
+ * Build and run from the repository root with:
+ *
+ *   g++ -Iinclude test/Gelf4CPlusAppenderTest.cpp -o Gelf4CPlusAppenderTest \
+ *       -llog4cplus -lboost_thread -lboost_system -lz -lpthread && ./Gelf4CPlusAppenderTest
+ */
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+
+// Third-party Headers
+
+#include <boost/foreach.hpp>
+#include <log4cplus/spi/loggingevent.h>
+#include "json_spirit/json_spirit_reader_template.h"
+
+// Other Headers
+
+#include "TestSupport.hpp"
+#include "gelf4cplus/Gelf4CPlusAppender.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+using std::string;
+using namespace gelf4cplus;
+using log4cplus::helpers::Properties;
+using log4cplus::spi::InternalLoggingEvent;
+
+/*- TYPE DEFINITIONS ---------------------------------------------------------*/
+
+typedef std::map<string, json_spirit::Value> Fields; ///< Fields by name.
+
+/*- CLASSES ------------------------------------------------------------------*/
+
+/**
+ * A transport that keeps the messages sent through it.
+ */
+class RecordingTransport : public transport::ITransport
+{
+public:
+
+    std::vector<string> messages; ///< The messages, oldest first.
+    size_t flushes; ///< Calls to flush().
+
+    using transport::ITransport::send;
+
+    /**
+     * The constructor.
+     */
+    RecordingTransport() :
+        flushes(0)
+    {
+    }
+
+    /**
+     * Keeps a message.
+     * @param aMessage The message.
+     */
+    virtual void send(const string &aMessage)
+    {
+        messages.push_back(aMessage);
+    }
+
+    /**
+     * Counts a flush.
+     */
+    virtual void flush()
+    {
+        ++flushes;
+    }
+};
+
+/*- FUNCTIONS ----------------------------------------------------------------*/
+
+/**
+ * Parses a JSON object, checking that no name appears twice.
+ * @param aJson The JSON.
+ * @param aFields The fields of the object.
+ * @param aWhat What is being parsed, for the checks.
+ */
+void parse(const string &aJson, Fields &aFields, const string &aWhat)
+{
+    json_spirit::Value value;
+    aFields.clear();
+
+    if (!json_spirit::read_string(aJson, value) || value.type() != json_spirit::obj_type)
+    {
+        check(false, aWhat + " is a JSON object: " + aJson);
+
+        return;
+    }
+
+    const json_spirit::Object &object = value.get_obj();
+
+    for (size_t i = 0; i < object.size(); ++i)
+    {
+        check(aFields.count(object[i].name_) == 0, aWhat + " has one " + object[i].name_ + " field");
+        aFields[object[i].name_] = object[i].value_;
+    }
+}
+
+/**
+ * Builds a message the way the appender did with GelfMessage.
+ * @param anEvent The event.
+ * @param aProperties The appender properties.
+ * @return The JSON of the message.
+ */
+string createBaselineJson(const InternalLoggingEvent &anEvent, const Properties &aProperties)
+{
+    string fullMessage = anEvent.getMessage();
+    string facility = aProperties.getProperty("facility");
+    const log4cplus::helpers::Time &time = anEvent.getTimestamp();
+
+    message::GelfMessage gelfMessage(fullMessage.substr(0, message::SHORT_MESSAGE_LENGTH - 1),
+                                     boost::asio::ip::host_name(),
+                                     time.sec() + (time.usec() / 1000000.0),
+                                     fullMessage,
+                                     appender::SYSLOG_LEVEL.getSysLogLevel(anEvent.getLogLevel()),
+                                     facility.empty() ? anEvent.getLoggerName() : facility);
+
+    if (aProperties.getProperty("includeLocationInformation") == "true")
+    {
+        gelfMessage.file(anEvent.getFile());
+        gelfMessage.line(anEvent.getLine());
+    }
+
+    Properties additionalFields = aProperties.getPropertySubset("additionalField.");
+
+    BOOST_FOREACH(const string &key, additionalFields.propertyNames())
+    {
+        gelfMessage[key] = additionalFields.getProperty(key);
+    }
+
+    gelfMessage["type"] = (int64_t) anEvent.getType();
+    gelfMessage["thread"] = anEvent.getThread();
+    gelfMessage["logger_name"] = anEvent.getLoggerName();
+
+    if (!anEvent.getNDC().empty())
+    {
+        gelfMessage["ndc"] = anEvent.getNDC();
+    }
+
+    string json;
+    gelfMessage.toJson(json);
+
+    return json;
+}
+
+/**
+ * Appends events to an appender and compares its messages with the ones
+ * GelfMessage built.
+ * @param aProperties The appender properties.
+ * @param aWhat The name of the configuration, for the checks.
+ */
+void testConfiguration(Properties aProperties, const string &aWhat)
+{
+    aProperties.setProperty("compression", "none");
+
+    RecordingTransport *transport = new RecordingTransport();
+    appender::Gelf4CPlusAppender gelfAppender(transport, aProperties);
+
+    std::vector<InternalLoggingEvent> events;
+    events.push_back(InternalLoggingEvent("test.logger", log4cplus::INFO_LOG_LEVEL,
+                                          "A \"short\" message", "Test.cpp", 42));
+    events.push_back(InternalLoggingEvent("test.logger", log4cplus::ERROR_LOG_LEVEL,
+                                          string(400, 'x'), "Test.cpp", 43));
+    events.push_back(InternalLoggingEvent("test.logger", log4cplus::DEBUG_LOG_LEVEL, "", "Test.cpp", 44));
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        gelfAppender.doAppend(events[i]);
+    }
+
+    check(transport->messages.size() == events.size(), aWhat + " sends every event");
+
+    for (size_t i = 0; i < events.size() && i < transport->messages.size(); ++i)
+    {
+        string what = aWhat + " event " + boost::lexical_cast<string>(i);
+
+        Fields expected;
+        Fields actual;
+        parse(createBaselineJson(events[i], aProperties), expected, what + " baseline");
+        parse(transport->messages[i], actual, what);
+
+        for (Fields::const_iterator it = expected.begin(); it != expected.end(); ++it)
+        {
+            Fields::const_iterator field = actual.find(it->first);
+
+            if (field == actual.end())
+            {
+                check(false, what + " has " + it->first);
+            }
+            else if (it->first == message::TIMESTAMP && it->second.type() == json_spirit::real_type)
+            {
+                check(std::fabs(field->second.get_real() - it->second.get_real()) < 1e-6, what + " timestamp");
+            }
+            else
+            {
+                check(field->second == it->second, what + " " + it->first + " is " +
+                      json_spirit::write_string(it->second) + ", not " + json_spirit::write_string(field->second));
+            }
+        }
+
+        for (Fields::const_iterator it = actual.begin(); it != actual.end(); ++it)
+        {
+            check(expected.count(it->first) != 0, what + " has no extra " + it->first);
+        }
+    }
+}
+
+/**
+ * Messages without additional fields, with ordinary ones, with ones that
+ * replace standard fields and with ones that fields set per event replace.
+ */
+void testAdditionalFields()
+{
+    Properties plain;
+    plain.setProperty("includeLocationInformation", "true");
+    testConfiguration(plain, "plain");
+
+    Properties ordinary;
+    ordinary.setProperty("facility", "test-facility");
+    ordinary.setProperty("additionalField.custom", "value");
+    ordinary.setProperty("additionalField._other", "other value");
+    testConfiguration(ordinary, "ordinary fields");
+
+    Properties replacing;
+    const char *names[] = {"version", "host", "facility", "level", "short_message", "full_message",
+                           "timestamp", "file", "line", "type", "thread", "logger_name", "ndc",
+                           "_host", "Host", "_type"};
+
+    replacing.setProperty("includeLocationInformation", "true");
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    {
+        replacing.setProperty(string("additionalField.") + names[i], string("configured ") + names[i]);
+    }
+
+    testConfiguration(replacing, "replacing fields");
+
+    Properties fullMessage;
+    fullMessage.setProperty("additionalField.full_message", "configured");
+    testConfiguration(fullMessage, "configured full message");
+
+    Properties shortMessage;
+    shortMessage.setProperty("additionalField.short_message", "configured");
+    shortMessage.setProperty("compression.staticPrefix", "true");
+    testConfiguration(shortMessage, "configured short message");
+}
+
+/**
+ * Worker threads build and send every event in queue order, and flush the
+ * transport once they have sent them, so that flush() returns with every
+ * message sent.
+ */
+void testWorkers()
+{
+    const size_t events = 20000;
+
+    Properties properties;
+    properties.setProperty("compression", "none");
+    properties.setProperty("async", "true");
+    properties.setProperty("async.workers", "4");
+    properties.setProperty("async.policy", "block");
+
+    RecordingTransport *transport = new RecordingTransport();
+    appender::Gelf4CPlusAppender gelfAppender(transport, properties);
+
+    for (size_t i = 0; i < events; ++i)
+    {
+        gelfAppender.doAppend(InternalLoggingEvent("test.logger", log4cplus::INFO_LOG_LEVEL,
+                                                   "message " + boost::lexical_cast<string>(i), "Test.cpp", 42));
+    }
+
+    check(gelfAppender.flush(10000), "flushed in time");
+    check(transport->messages.size() == events, "sent every event: " +
+          boost::lexical_cast<string>(transport->messages.size()));
+    check(transport->flushes != 0, "transport flushed");
+
+    bool ordered = true;
+
+    for (size_t i = 0; i < transport->messages.size() && ordered; ++i)
+    {
+        Fields fields;
+        parse(transport->messages[i], fields, "worker message");
+        ordered = fields[message::SHORT_MESSAGE] == json_spirit::Value("message " + boost::lexical_cast<string>(i));
+    }
+
+    check(ordered, "sent in queue order");
+}
+
+/**
+ * Runs the tests.
+ * @return 0 if every check passed.
+ */
+int main()
+{
+    testAdditionalFields();
+    testWorkers();
+
+    return report();
+}
@@ -0,0 +1,214 @@
+/*
+ * File:   GelfEncoderTest.cpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ *
+ * Checks that GelfEncoder writes the same fields, under the same names, as
+ * GelfMessage, which the appender used to build messages with. Build and
+ * run from the repository root with:
+ *
+ *   g++ -Iinclude test/GelfEncoderTest.cpp -o GelfEncoderTest \
+ *       -lboost_thread -lboost_system -lz -lpthread && ./GelfEncoderTest
+ */
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <map>
+#include <cmath>
+
+// Third-party Headers
+
+#include "json_spirit/json_spirit_reader_template.h"
+
+// Other Headers
+
+#include "TestSupport.hpp"
+#include "gelf4cplus/GelfMessage.hpp"
+#include "gelf4cplus/GelfEncoder.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+using std::string;
+using namespace gelf4cplus::message;
+
+/*- TYPE DEFINITIONS ---------------------------------------------------------*/
+
+typedef std::map<string, json_spirit::Value> Fields; ///< Fields by name.
+
+/*- FUNCTIONS ----------------------------------------------------------------*/
+
+/**
+ * Parses a JSON object, checking that no name appears twice.
+ * @param aJson The JSON.
+ * @param aFields The fields of the object.
+ * @param aWhat What is being parsed, for the checks.
+ */
+void parse(const string &aJson, Fields &aFields, const string &aWhat)
+{
+    json_spirit::Value value;
+    aFields.clear();
+
+    if (!json_spirit::read_string(aJson, value) || value.type() != json_spirit::obj_type)
+    {
+        check(false, aWhat + " is a JSON object: " + aJson);
+
+        return;
+    }
+
+    const json_spirit::Object &object = value.get_obj();
+
+    for (size_t i = 0; i < object.size(); ++i)
+    {
+        check(aFields.count(object[i].name_) == 0, aWhat + " has one " + object[i].name_ + " field");
+        aFields[object[i].name_] = object[i].value_;
+    }
+}
+
+/**
+ * Compares the fields of two messages, allowing the timestamps to differ in
+ * how they were rounded.
+ * @param anExpected The fields GelfMessage wrote.
+ * @param anActual The fields GelfEncoder wrote.
+ * @param aWhat What is being compared, for the checks.
+ */
+void compare(const Fields &anExpected, const Fields &anActual, const string &aWhat)
+{
+    for (Fields::const_iterator it = anExpected.begin(); it != anExpected.end(); ++it)
+    {
+        Fields::const_iterator actual = anActual.find(it->first);
+
+        if (actual == anActual.end())
+        {
+            check(false, aWhat + " has " + it->first);
+        }
+        else if (it->first == TIMESTAMP)
+        {
+            check(std::fabs(actual->second.get_real() - it->second.get_real()) < 1e-6, aWhat + " timestamp");
+        }
+        else
+        {
+            check(actual->second == it->second, aWhat + " " + it->first + " is " +
+                  json_spirit::write_string(it->second));
+        }
+    }
+
+    for (Fields::const_iterator it = anActual.begin(); it != anActual.end(); ++it)
+    {
+        check(anExpected.count(it->first) != 0, aWhat + " has no extra " + it->first);
+    }
+}
+
+/**
+ * An additional field is sent under the name GelfMessage gave it: standard
+ * names as they are, other names with a '_' prefix, and "_id" not at all.
+ */
+void testAdditionalFieldNames()
+{
+    const char *keys[] = {"custom", "_custom", "type", "thread", "logger_name", "ndc",
+                          "version", "host", "short_message", "timestamp", "full_message",
+                          "level", "facility", "file", "line", "Host", "_host", "id", "_id"};
+
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+    {
+        string key = keys[i];
+        string expected;
+
+        try
+        {
+            GelfMessage gelfMessage;
+            gelfMessage[key] = "marker";
+
+            Fields fields;
+            string json;
+            gelfMessage.toJson(json);
+            parse(json, fields, "GelfMessage with " + key);
+
+            for (Fields::const_iterator it = fields.begin(); it != fields.end(); ++it)
+            {
+                if (it->second.type() == json_spirit::str_type && it->second.get_str() == "marker")
+                {
+                    expected = it->first;
+                }
+            }
+        }
+        catch (const std::invalid_argument&)
+        {
+            // Not allowed
+        }
+
+        // GelfMessage lets "id" through as "_id", which GELF does not allow
+        if (expected == "_id")
+        {
+            expected.clear();
+        }
+
+        check(GelfEncoder::makeKey(key) == expected, "name of " + key + " is " + expected);
+
+        string json;
+        GelfEncoder encoder(json);
+        encoder.additionalField(key, string("marker"));
+        encoder.finish();
+
+        Fields fields;
+        parse(json, fields, "GelfEncoder with " + key);
+        check(expected.empty() ? fields.empty() : fields.size() == 1 && fields.count(expected) == 1,
+              "GelfEncoder sends " + key + " as " + expected);
+    }
+}
+
+/**
+ * A whole message encoded field by field matches the one GelfMessage builds
+ * from the same values, text that needs escaping included.
+ */
+void testMessage()
+{
+    string fullMessage = "A \"quoted\" message\\with\ttabs\nlines, \x01 control and UTF-8 \xc3\xa9 text";
+    string shortMessage = fullMessage.substr(0, 20);
+
+    GelfMessage gelfMessage(shortMessage, "test-host", 1337705820.123456, fullMessage, 3, "test.logger");
+    gelfMessage.file("Test.cpp");
+    gelfMessage.line(42);
+    gelfMessage["thread"] = "main";
+    gelfMessage["type"] = (int64_t) 1;
+    gelfMessage["_custom"] = "value";
+
+    string expectedJson;
+    gelfMessage.toJson(expectedJson);
+
+    string json;
+    GelfEncoder encoder(json);
+    encoder.field(VERSION, GELF_VERSION);
+    encoder.field(HOST, string("test-host"));
+    encoder.messageFields(SHORT_MESSAGE, 20, FULL_MESSAGE, fullMessage);
+    encoder.timestamp(TIMESTAMP, 1337705820, 123456);
+    encoder.field(LEVEL, (int64_t) 3);
+    encoder.field(FACILITY, string("test.logger"));
+    encoder.field(gelf4cplus::message::FILE, string("Test.cpp"));
+    encoder.field(LINE, (int64_t) 42);
+    encoder.additionalField("thread", string("main"));
+    encoder.additionalField("type", (int64_t) 1);
+    encoder.additionalField("_custom", string("value"));
+    encoder.finish();
+
+    Fields expected;
+    Fields actual;
+    parse(expectedJson, expected, "GelfMessage");
+    parse(json, actual, "GelfEncoder");
+    compare(expected, actual, "encoded message");
+}
+
+/**
+ * Runs the tests.
+ * @return 0 if every check passed.
+ */
+int main()
+{
+    testAdditionalFieldNames();
+    testMessage();
+
+    return report();
+}
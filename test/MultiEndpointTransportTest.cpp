@@ -0,0 +1,394 @@
+/*
+ * File:   MultiEndpointTransportTest.cpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ *
+ * Sends through a MultiEndpointTransport to several UDP listeners on the
+ * loopback interface. Build and run from the repository root with:
+ *
+ *   g++ -Iinclude test/MultiEndpointTransportTest.cpp -o MultiEndpointTransportTest \
+ *       -lboost_thread -lboost_system -lz -lpthread && ./MultiEndpointTransportTest
+ */
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <vector>
+#include <map>
+
+// Third-party Headers
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+// Other Headers
+
+#include "TestSupport.hpp"
+#include "gelf4cplus/UdpTransport.hpp"
+#include "gelf4cplus/MultiEndpointTransport.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+using std::string;
+using namespace gelf4cplus::transport;
+namespace ip = boost::asio::ip;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t LISTENERS = 3; ///< Live Graylog inputs.
+const long RECEIVE_TIMEOUT_MS = 2000; ///< Longest wait for the datagrams.
+const int RECEIVE_BUFFER_SIZE = 1024 * 1024; ///< Socket buffer of a listener.
+
+/*- FUNCTIONS ----------------------------------------------------------------*/
+
+/**
+ * Local UDP sockets standing in for Graylog inputs.
+ */
+struct Listeners
+{
+    boost::asio::io_service service; ///< For the sockets.
+    std::vector< boost::shared_ptr<ip::udp::socket> > sockets; ///< One per input.
+
+    /**
+     * The constructor, which binds the sockets to free ports.
+     * @param aCount The number of sockets.
+     */
+    explicit Listeners(const size_t &aCount)
+    {
+        for (size_t i = 0; i < aCount; ++i)
+        {
+            sockets.push_back(boost::shared_ptr<ip::udp::socket>(new ip::udp::socket(service,
+                    ip::udp::endpoint(ip::address_v4::loopback(), 0))));
+
+            // Room for every datagram of a test, so that none is lost
+            boost::system::error_code error;
+            sockets.back()->set_option(boost::asio::socket_base::receive_buffer_size(RECEIVE_BUFFER_SIZE), error);
+        }
+    }
+
+    /**
+     * Gets the port of a socket.
+     * @param anIndex The socket.
+     * @return The port.
+     */
+    int port(const size_t &anIndex) const
+    {
+        return sockets[anIndex]->local_endpoint().port();
+    }
+
+    /**
+     * Reads datagrams until a number of them have arrived or the time is up.
+     * @param anExpected The number of datagrams to wait for.
+     * @param aDatagrams The datagrams read from each socket.
+     */
+    void receive(const size_t &anExpected, std::vector< std::vector<string> > &aDatagrams)
+    {
+        aDatagrams.assign(sockets.size(), std::vector<string>());
+
+        boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() +
+                boost::posix_time::milliseconds(RECEIVE_TIMEOUT_MS);
+        size_t received = 0;
+        char datagram[65536];
+
+        while (received < anExpected && boost::posix_time::microsec_clock::universal_time() < deadline)
+        {
+            bool idle = true;
+
+            for (size_t i = 0; i < sockets.size(); ++i)
+            {
+                boost::system::error_code error;
+
+                if (sockets[i]->available(error) == 0)
+                {
+                    continue;
+                }
+
+                size_t length = sockets[i]->receive(boost::asio::buffer(datagram), 0, error);
+
+                if (!error)
+                {
+                    aDatagrams[i].push_back(string(datagram, length));
+                    ++received;
+                    idle = false;
+                }
+            }
+
+            if (idle)
+            {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+            }
+        }
+    }
+};
+
+/**
+ * Creates connected UDP transports to ports on the loopback interface.
+ * @param aPorts The ports.
+ * @return The transports.
+ */
+MultiEndpointTransport::Transports createTransports(const std::vector<int> &aPorts)
+{
+    MultiEndpointTransport::Transports transports;
+
+    for (size_t i = 0; i < aPorts.size(); ++i)
+    {
+        boost::shared_ptr<UdpTransport> transport(new UdpTransport("127.0.0.1", aPorts[i], 1024));
+        transport->connectSocket();
+        transports.push_back(transport);
+    }
+
+    // Send one message each once the background resolution has finished, so
+    // that nothing is held later
+    for (size_t i = 0; i < transports.size(); ++i)
+    {
+        transports[i]->send(string("warm-up"));
+
+        while (transports[i]->pendingMessages() != 0)
+        {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+            transports[i]->flush();
+        }
+    }
+
+    return transports;
+}
+
+/**
+ * Round-robin gives each listener an equal share.
+ */
+void testRoundRobin()
+{
+    Listeners listeners(LISTENERS);
+    std::vector<int> ports;
+
+    for (size_t i = 0; i < LISTENERS; ++i)
+    {
+        ports.push_back(listeners.port(i));
+    }
+
+    MultiEndpointTransport transport(createTransports(ports), BALANCE_ROUND_ROBIN);
+    std::vector< std::vector<string> > datagrams;
+    listeners.receive(LISTENERS, datagrams);
+
+    for (int i = 0; i < 300; ++i)
+    {
+        transport.send("message " + boost::lexical_cast<string>(i));
+    }
+
+    transport.flush();
+    listeners.receive(300, datagrams);
+
+    for (size_t i = 0; i < LISTENERS; ++i)
+    {
+        check(datagrams[i].size() == 100, "round-robin share of listener " + boost::lexical_cast<string>(i));
+    }
+}
+
+/**
+ * Hashing sends the same message to the same listener, whole or in
+ * fragments, keeps the chunks of a message together and spreads different
+ * messages over every listener.
+ */
+void testHash()
+{
+    Listeners listeners(LISTENERS);
+    std::vector<int> ports;
+
+    for (size_t i = 0; i < LISTENERS; ++i)
+    {
+        ports.push_back(listeners.port(i));
+    }
+
+    MultiEndpointTransport transport(createTransports(ports), BALANCE_HASH);
+    std::vector< std::vector<string> > datagrams;
+    listeners.receive(LISTENERS, datagrams);
+
+    // The same message, whole and in two fragments
+    string message = "a message that is sent several times";
+    Fragment fragments[] = {boost::asio::buffer(message.data(), 10),
+                            boost::asio::buffer(message.data() + 10, message.length() - 10)};
+
+    for (int i = 0; i < 10; ++i)
+    {
+        transport.send(message);
+        transport.send(Fragments(fragments, 2));
+    }
+
+    transport.flush();
+    listeners.receive(20, datagrams);
+
+    size_t receivers = 0;
+
+    for (size_t i = 0; i < LISTENERS; ++i)
+    {
+        if (!datagrams[i].empty())
+        {
+            ++receivers;
+            check(datagrams[i].size() == 20, "repeated message on one listener");
+        }
+    }
+
+    check(receivers == 1, "repeated message on a single listener");
+
+    // Different messages of 5 chunks each
+    string padding(4500, 'x');
+
+    for (int i = 0; i < 60; ++i)
+    {
+        transport.send(boost::lexical_cast<string>(i) + padding);
+    }
+
+    transport.flush();
+    listeners.receive(300, datagrams);
+
+    std::map<string, size_t> listenerOfMessage;
+    size_t chunks = 0;
+
+    for (size_t i = 0; i < LISTENERS; ++i)
+    {
+        check(!datagrams[i].empty(), "hashed messages reach listener " + boost::lexical_cast<string>(i));
+
+        for (size_t j = 0; j < datagrams[i].size(); ++j)
+        {
+            const string &datagram = datagrams[i][j];
+
+            check(datagram.length() > CHUNK_HEADER_SIZE && datagram[0] == 0x1e && datagram[1] == 0x0f,
+                  "chunked datagram");
+
+            string messageId = datagram.substr(2, 8);
+
+            if (listenerOfMessage.count(messageId) != 0)
+            {
+                check(listenerOfMessage[messageId] == i, "chunks of one message on one listener");
+            }
+
+            listenerOfMessage[messageId] = i;
+            ++chunks;
+        }
+    }
+
+    check(chunks == 300, "every chunk received");
+    check(listenerOfMessage.size() == 60, "every message received");
+}
+
+/**
+ * Hashing spreads uncompressed messages of one length over every listener,
+ * though they start with the same static fields and end with the same
+ * per-event ones.
+ */
+void testHashUncompressed()
+{
+    Listeners listeners(LISTENERS);
+    std::vector<int> ports;
+
+    for (size_t i = 0; i < LISTENERS; ++i)
+    {
+        ports.push_back(listeners.port(i));
+    }
+
+    MultiEndpointTransport transport(createTransports(ports), BALANCE_HASH);
+    std::vector< std::vector<string> > datagrams;
+    listeners.receive(LISTENERS, datagrams);
+
+    for (int i = 0; i < 60; ++i)
+    {
+        string text = "request " + boost::lexical_cast<string>(100 + i) + " took " +
+                      boost::lexical_cast<string>(100 + (i * 37) % 900) + " ms";
+
+        transport.send("{\"version\":\"1.1\",\"host\":\"test-host\",\"level\":6,\"facility\":\"test.logger\","
+                       "\"short_message\":\"" + text + "\",\"full_message\":\"" + text + "\","
+                       "\"timestamp\":1337705820." + boost::lexical_cast<string>(100000 + i * 1234) + ","
+                       "\"_type\":0,\"_thread\":\"main\",\"_logger_name\":\"test.logger\"}");
+    }
+
+    transport.flush();
+    listeners.receive(60, datagrams);
+
+    for (size_t i = 0; i < LISTENERS; ++i)
+    {
+        check(datagrams[i].size() >= 5, "uncompressed messages reach listener " + boost::lexical_cast<string>(i) +
+              ": " + boost::lexical_cast<string>(datagrams[i].size()));
+    }
+}
+
+/**
+ * An endpoint whose port is closed is ejected, and the others get the
+ * messages.
+ */
+void testEjection()
+{
+    Listeners listeners(LISTENERS);
+    std::vector<int> ports;
+
+    // A port nothing listens on any more
+    {
+        Listeners closed(1);
+        ports.push_back(closed.port(0));
+    }
+
+    for (size_t i = 0; i < LISTENERS; ++i)
+    {
+        ports.push_back(listeners.port(i));
+    }
+
+    MultiEndpointTransport transport(createTransports(ports), BALANCE_ROUND_ROBIN);
+    std::vector< std::vector<string> > datagrams;
+    listeners.receive(LISTENERS, datagrams);
+
+    // Send until the closed port's rejection has come back and been seen
+    boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() +
+            boost::posix_time::milliseconds(RECEIVE_TIMEOUT_MS);
+    size_t sent = 0;
+
+    while (transport.ejections(0) == 0 && boost::posix_time::microsec_clock::universal_time() < deadline)
+    {
+        transport.send("probe " + boost::lexical_cast<string>(sent++));
+        transport.flush();
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+
+    check(transport.ejections(0) != 0, "closed endpoint ejected");
+    check(transport.liveEndpoints() == LISTENERS, "live endpoints left");
+
+    // The ejection lasts longer than it takes to send these
+    uint64_t rejected = transport.sentMessages(0);
+
+    for (int i = 0; i < 300; ++i)
+    {
+        transport.send("message " + boost::lexical_cast<string>(i));
+    }
+
+    transport.flush();
+    sent += 300;
+    listeners.receive(sent - rejected, datagrams);
+
+    size_t received = 0;
+
+    for (size_t i = 0; i < LISTENERS; ++i)
+    {
+        received += datagrams[i].size();
+    }
+
+    check(transport.sentMessages(0) == rejected, "closed endpoint skipped");
+    check(received == sent - rejected, "messages sent to the live listeners");
+    check(transport.healthy(), "healthy with live endpoints");
+}
+
+/**
+ * Runs the tests.
+ * @return 0 if every check passed.
+ */
+int main()
+{
+    testRoundRobin();
+    testHash();
+    testHashUncompressed();
+    testEjection();
+
+    return report();
+}
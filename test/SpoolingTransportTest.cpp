@@ -0,0 +1,173 @@
+/*
+ * File:   SpoolingTransportTest.cpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ *
+ * Sends through a SpoolingTransport wrapping a connected UdpTransport to a
+ * port on the loopback interface that nothing listens on for a while, and
+ * checks that every message spooled during the outage arrives once a
+ * listener is bound. Build and run from the repository root with:
+ *
+ *   g++ -Iinclude test/SpoolingTransportTest.cpp -o SpoolingTransportTest \
+ *       -lboost_thread -lboost_system -lz -lpthread && ./SpoolingTransportTest
+ */
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <set>
+#include <cstdlib>
+#include <cstdio>
+
+#include <unistd.h>
+
+// Third-party Headers
+
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+// Other Headers
+
+#include "TestSupport.hpp"
+#include "gelf4cplus/UdpTransport.hpp"
+#include "gelf4cplus/SpoolingTransport.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+using std::string;
+using namespace gelf4cplus::transport;
+namespace ip = boost::asio::ip;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t OUTAGE_MESSAGES = 500; ///< Sent while nothing listens.
+const long HEALTH_INTERVAL_MS = 100; ///< Time between health checks.
+const long OUTAGE_MS = 1000; ///< Health checks that replay into the outage.
+const long WAIT_TIMEOUT_MS = 10000; ///< Longest wait for the replay.
+
+/*- FUNCTIONS ----------------------------------------------------------------*/
+
+/**
+ * Waits for a spooling transport to start or stop spooling.
+ * @param aTransport The transport.
+ * @param aSpooling Wait for it to spool, or to send directly again?
+ * @return False if the time ran out.
+ */
+bool waitForSpooling(SpoolingTransport &aTransport, const bool &aSpooling)
+{
+    boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() +
+            boost::posix_time::milliseconds(WAIT_TIMEOUT_MS);
+
+    while (aTransport.spooling() != aSpooling &&
+           boost::posix_time::microsec_clock::universal_time() < deadline)
+    {
+        aTransport.send(string("probe"));
+        aTransport.flush();
+        boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+    }
+
+    return aTransport.spooling() == aSpooling;
+}
+
+/**
+ * Messages spooled while the UDP destination refuses them are replayed once
+ * it is back, none lost to health checks that pass between rejections.
+ */
+void testOutage()
+{
+    char directory[] = "/tmp/SpoolingTransportTest.XXXXXX";
+
+    if (::mkdtemp(directory) == NULL)
+    {
+        check(false, "temporary directory created");
+
+        return;
+    }
+
+    boost::asio::io_service service;
+    int port;
+
+    // A port nothing listens on until the outage is over
+    {
+        ip::udp::socket socket(service, ip::udp::endpoint(ip::address_v4::loopback(), 0));
+        port = socket.local_endpoint().port();
+    }
+
+    std::set<string> received;
+
+    {
+        UdpTransport *udpTransport = new UdpTransport("127.0.0.1", port);
+        udpTransport->connectSocket();
+
+        SpoolingTransport transport(udpTransport, directory, DEFAULT_SPOOL_SEGMENT_SIZE,
+                                    DEFAULT_SPOOL_DISK_BUDGET, 100000, "", 0, HEALTH_INTERVAL_MS);
+
+        check(waitForSpooling(transport, true), "outage noticed");
+
+        for (size_t i = 0; i < OUTAGE_MESSAGES; ++i)
+        {
+            transport.send("message " + boost::lexical_cast<string>(i));
+        }
+
+        // Health checks pass between rejections, and replay into the outage
+        boost::this_thread::sleep(boost::posix_time::milliseconds(OUTAGE_MS));
+        check(transport.spool().size() >= OUTAGE_MESSAGES, "messages kept through the outage");
+
+        ip::udp::socket listener(service, ip::udp::endpoint(ip::address_v4::loopback(), port));
+        listener.set_option(boost::asio::socket_base::receive_buffer_size(4 * 1024 * 1024));
+
+        boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() +
+                boost::posix_time::milliseconds(WAIT_TIMEOUT_MS);
+        char datagram[65536];
+
+        while (received.size() < OUTAGE_MESSAGES &&
+               boost::posix_time::microsec_clock::universal_time() < deadline)
+        {
+            boost::system::error_code error;
+
+            if (listener.available(error) == 0)
+            {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+
+                continue;
+            }
+
+            size_t length = listener.receive(boost::asio::buffer(datagram), 0, error);
+
+            if (!error && string(datagram, length) != "probe")
+            {
+                received.insert(string(datagram, length));
+            }
+        }
+
+        check(waitForSpooling(transport, false), "spooling stopped");
+
+        // The last replayed messages are confirmed by the next health check
+        while (transport.spool().size() != 0 && boost::posix_time::microsec_clock::universal_time() < deadline)
+        {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+        }
+
+        check(transport.spool().size() == 0, "spool emptied");
+    }
+
+    check(received.size() == OUTAGE_MESSAGES, "messages replayed: " +
+          boost::lexical_cast<string>(received.size()) + " of " + boost::lexical_cast<string>(OUTAGE_MESSAGES));
+
+    std::system(("rm -rf " + string(directory)).c_str());
+}
+
+/**
+ * Runs the tests.
+ * @return 0 if every check passed.
+ */
+int main()
+{
+    testOutage();
+
+    return report();
+}
@@ -0,0 +1,342 @@
+/*
+ * File:   TcpTransportTest.cpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ *
+ * Sends through a TcpTransport to a listener on the loopback interface that
+ * drops the first connection part way, and checks that the null-delimited
+ * frames arrive intact over the new one. Build and run from the repository
+ * root with:
+ *
+ *   g++ -Iinclude test/TcpTransportTest.cpp -o TcpTransportTest \
+ *       -lboost_thread -lboost_system -lz -lpthread && ./TcpTransportTest
+ */
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Headers
+
+#include <string>
+#include <vector>
+
+// Third-party Headers
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+// Other Headers
+
+#include "TestSupport.hpp"
+#include "gelf4cplus/TcpTransport.hpp"
+
+/*- NAMESPACES ---------------------------------------------------------------*/
+
+using std::string;
+using namespace gelf4cplus::transport;
+namespace ip = boost::asio::ip;
+
+/*- CONSTANTS ----------------------------------------------------------------*/
+
+const size_t FIRST_MESSAGES = 100; ///< Sent before the connection is dropped.
+const size_t SECOND_MESSAGES = 200; ///< Sent while and after reconnecting.
+const size_t MAX_LOST_MESSAGES = 5; ///< Written into the dropped connection.
+const long WAIT_TIMEOUT_MS = 5000; ///< Longest wait for the frames.
+
+/*- FUNCTIONS ----------------------------------------------------------------*/
+
+/**
+ * Builds a test message. The sizes vary up to more than a socket buffer, so
+ * that writes are split.
+ * @param aPhase Which part of the test it is sent in.
+ * @param anIndex The number of the message in its phase.
+ * @return The message.
+ */
+string createMessage(const char &aPhase, const size_t &anIndex)
+{
+    size_t size = anIndex % 10 == 0 ? 300000 : (anIndex * 997) % 5000;
+
+    return aPhase + boost::lexical_cast<string>(anIndex) + ":" + string(size, (char) ('a' + anIndex % 26));
+}
+
+/**
+ * A GELF TCP input that splits what it reads into frames at the null bytes,
+ * and drops a frame cut off by the end of a connection, as Graylog does.
+ */
+class Listener
+{
+public:
+
+    /**
+     * The constructor, which starts accepting connections.
+     * @param aDropAfter Frames after which to drop the first connection.
+     */
+    explicit Listener(const size_t &aDropAfter) :
+        m_acceptor(m_service, ip::tcp::endpoint(ip::address_v4::loopback(), 0)),
+        m_dropAfter(aDropAfter),
+        m_stopping(false),
+        m_thread(boost::bind(&Listener::run, this))
+    {
+    }
+
+    /**
+     * The destructor, which stops accepting connections.
+     */
+    ~Listener()
+    {
+        m_stopping = true;
+
+        // Wake up the accept
+        boost::system::error_code error;
+        ip::tcp::socket socket(m_service);
+        socket.connect(m_acceptor.local_endpoint(), error);
+
+        m_thread.join();
+    }
+
+    /**
+     * Gets the port to connect to.
+     * @return The port.
+     */
+    int port() const
+    {
+        return m_acceptor.local_endpoint().port();
+    }
+
+    /**
+     * Gets the frames read so far.
+     * @return The frames of each connection, in order.
+     */
+    std::vector< std::vector<string> > frames()
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+
+        return m_frames;
+    }
+
+    /**
+     * Waits until a number of frames have been read over all connections.
+     * @param aCount The number of frames.
+     * @return False if the time ran out.
+     */
+    bool waitForFrames(const size_t &aCount)
+    {
+        boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() +
+                boost::posix_time::milliseconds(WAIT_TIMEOUT_MS);
+
+        while (boost::posix_time::microsec_clock::universal_time() < deadline)
+        {
+            std::vector< std::vector<string> > frames = this->frames();
+            size_t count = 0;
+
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                count += frames[i].size();
+            }
+
+            if (count >= aCount)
+            {
+                return true;
+            }
+
+            boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+        }
+
+        return false;
+    }
+
+protected:
+
+    // Attributes
+
+    boost::asio::io_service m_service; ///< For the sockets.
+    ip::tcp::acceptor m_acceptor; ///< Takes connections.
+    size_t m_dropAfter; ///< Frames after which to drop the first connection.
+    volatile bool m_stopping; ///< Should the listener stop?
+    boost::mutex m_mutex; ///< Guards m_frames.
+    std::vector< std::vector<string> > m_frames; ///< Frames of each connection.
+    boost::thread m_thread; ///< Accepts and reads the connections.
+
+    // Methods
+
+    /**
+     * Reads one connection at a time until stopped.
+     */
+    void run()
+    {
+        while (!m_stopping)
+        {
+            ip::tcp::socket socket(m_service);
+            boost::system::error_code error;
+
+            m_acceptor.accept(socket, error);
+
+            if (error || m_stopping)
+            {
+                return;
+            }
+
+            size_t connection;
+
+            {
+                boost::lock_guard<boost::mutex> lock(m_mutex);
+                connection = m_frames.size();
+                m_frames.push_back(std::vector<string>());
+            }
+
+            string frame;
+            char data[65536];
+
+            for (;;)
+            {
+                size_t length = socket.read_some(boost::asio::buffer(data), error);
+
+                if (error)
+                {
+                    break;
+                }
+
+                boost::lock_guard<boost::mutex> lock(m_mutex);
+
+                for (size_t i = 0; i < length; ++i)
+                {
+                    if (data[i] != '\0')
+                    {
+                        frame += data[i];
+
+                        continue;
+                    }
+
+                    m_frames[connection].push_back(frame);
+                    frame.clear();
+                }
+
+                // Drop the first connection, with whatever the client
+                // has written past the frames we wanted
+                if (connection == 0 && m_frames[connection].size() >= m_dropAfter)
+                {
+                    break;
+                }
+            }
+
+            socket.close(error);
+        }
+    }
+};
+
+/**
+ * Flushes a transport until it has written every frame, giving it time to
+ * connect.
+ * @param aTransport The transport.
+ * @return False if the time ran out.
+ */
+bool flushAll(TcpTransport &aTransport)
+{
+    boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() +
+            boost::posix_time::milliseconds(WAIT_TIMEOUT_MS);
+
+    while (aTransport.pendingMessages() != 0 &&
+           boost::posix_time::microsec_clock::universal_time() < deadline)
+    {
+        aTransport.flush();
+        boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+    }
+
+    return aTransport.pendingMessages() == 0;
+}
+
+/**
+ * Frames sent before, while and after the listener drops the connection
+ * arrive whole, in order and only once, and the transport reconnects.
+ */
+void testReconnect()
+{
+    Listener listener(FIRST_MESSAGES);
+    std::vector< std::vector<string> > frames;
+
+    {
+        TcpTransport transport("127.0.0.1", listener.port(), 16);
+
+        // Connects once the name has been resolved
+        for (size_t i = 0; i < FIRST_MESSAGES; ++i)
+        {
+            transport.send(createMessage('A', i));
+        }
+
+        check(flushAll(transport), "first messages written");
+        check(listener.waitForFrames(FIRST_MESSAGES), "first connection frames received");
+
+        // The listener has dropped the connection; the transport finds out
+        // when a write fails, and reconnects after its backoff
+        for (size_t i = 0; i < SECOND_MESSAGES; ++i)
+        {
+            transport.send(createMessage('B', i));
+            transport.flush();
+            boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+        }
+
+        check(flushAll(transport), "every frame written");
+        check(transport.droppedMessages() == 0, "no frame dropped for lack of room");
+
+        listener.waitForFrames(FIRST_MESSAGES + SECOND_MESSAGES - MAX_LOST_MESSAGES);
+        frames = listener.frames();
+    }
+
+    check(frames.size() >= 2, "reconnected");
+
+    if (frames.size() < 2)
+    {
+        return;
+    }
+
+    // The first connection carries the first messages whole and in order
+    check(frames[0].size() >= FIRST_MESSAGES, "first connection frame count");
+
+    for (size_t i = 0; i < FIRST_MESSAGES && i < frames[0].size(); ++i)
+    {
+        check(frames[0][i] == createMessage('A', i), "first connection frame " + boost::lexical_cast<string>(i));
+    }
+
+    // After that, each frame is a whole message sent after the earlier
+    // ones; only those written into the dropped connection may be missing
+    size_t next = 0;
+    size_t lost = 0;
+
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        for (size_t j = i == 0 ? FIRST_MESSAGES : 0; j < frames[i].size(); ++j)
+        {
+            while (next < SECOND_MESSAGES && frames[i][j] != createMessage('B', next))
+            {
+                ++next;
+                ++lost;
+            }
+
+            check(next < SECOND_MESSAGES, "connection " + boost::lexical_cast<string>(i) + " frame " +
+                  boost::lexical_cast<string>(j) + " is a whole message in order");
+            ++next;
+        }
+    }
+
+    lost += SECOND_MESSAGES - std::min(next, SECOND_MESSAGES);
+
+    check(lost <= MAX_LOST_MESSAGES, "at most " + boost::lexical_cast<string>(MAX_LOST_MESSAGES) +
+          " messages lost, not " + boost::lexical_cast<string>(lost));
+    check(!frames.back().empty() && frames.back().back() == createMessage('B', SECOND_MESSAGES - 1),
+          "last message received");
+}
+
+/**
+ * Runs the tests.
+ * @return 0 if every check passed.
+ */
+int main()
+{
+    testReconnect();
+
+    return report();
+}
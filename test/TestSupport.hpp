@@ -0,0 +1,66 @@
+/*
+ * File:   TestSupport.hpp
+ * Author: Steven Bidny
+ *
+ * Created on May 22, 2012, 12:57 PM
+ *
+ * Checks shared by the test programs. Each program is a single translation
+ * unit, records failed checks with check() and returns report() from main().
+ */
+
+#if !defined(TESTSUPPORT_HPP)
+#define TESTSUPPORT_HPP
+
+/*- HEADER FILES -------------------------------------------------------------*/
+
+// System Header Files
+
+#include <string>
+#include <iostream>
+
+/*- FUNCTIONS ----------------------------------------------------------------*/
+
+/**
+ * Gets the number of failed checks.
+ * @return The count, which check() updates.
+ */
+inline int &failures()
+{
+    static int count = 0;
+
+    return count;
+}
+
+/**
+ * Records a failed check.
+ * @param aPassed Did the check pass?
+ * @param aWhat What was checked.
+ */
+inline void check(const bool &aPassed, const std::string &aWhat)
+{
+    if (!aPassed)
+    {
+        std::cerr << "FAILED: " << aWhat << std::endl;
+        ++failures();
+    }
+}
+
+/**
+ * Prints the outcome of the checks.
+ * @return The exit status: 0 if every check passed.
+ */
+inline int report()
+{
+    if (failures() != 0)
+    {
+        std::cerr << failures() << " check(s) failed" << std::endl;
+
+        return 1;
+    }
+
+    std::cout << "All tests passed" << std::endl;
+
+    return 0;
+}
+
+#endif // #if !defined(TESTSUPPORT_HPP)